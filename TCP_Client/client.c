@@ -148,12 +148,26 @@ void print_footer() {
 }
 
 
+// Lines pushed by the server whenever something happens to us; not part of any reply
+static int print_notification(const char *line) {
+    if (strncmp(line, "NOTIFY|", 7) != 0) return 0;
+    char note[BUFF_SIZE];
+    strncpy(note, line + 7, sizeof(note) - 1);
+    note[sizeof(note) - 1] = '\0';
+    char *nf[5];
+    if (split_fields(note, nf, 5) == 5) printf("\n[Notification] %s\n", nf[3]);
+    return 1;
+}
+
 void read_lines_from_server(int sock, ResponseType type) {
     char buff[BUFF_SIZE];
     char *message = malloc(BUFF_SIZE * 4); 
     if (!message) { perror("malloc() error"); return; };
     int printed_header = 0;
     int rcvBytes ;
+    // message only keeps the unfinished last line between two recv() calls
+    char *rest = message;
+    char *eol;
 
     message[0] = '\0';
 
@@ -166,21 +180,27 @@ void read_lines_from_server(int sock, ResponseType type) {
         //printf("[DEBUG] buff=[%s]\n", buff);
         //printf("[DEBUG] message=[%s]\n", message);
 
+        memmove(message, rest, strlen(rest) + 1);
+        rest = message;
+        if (strlen(message) + (size_t)rcvBytes >= BUFF_SIZE * 4) {
+            // A line longer than the buffer: drop what we have rather than overflow
+            message[0] = '\0';
+        }
         strcat(message, buff);
 
-        if (strstr(message, "\r\n") == NULL)
-            continue;
-
-        char *line = strtok(message, "\r\n");
-        while (line !=  NULL) {
+        while ((eol = strstr(rest, "\r\n")) != NULL) {
+            *eol = '\0';
+            char *line = rest;
+            rest = eol + 2;
+            if (*line == '\0') continue;
             //printf("\n[DEBUG] line = [%s]\n", line);
 
-             
-
             if (strcmp(line, "END") == 0) {
                 goto DONE;
             }
 
+            if (print_notification(line)) continue;
+
 
             if (!strchr(line, '|')) {
                 printf("\n%s\n", line);
@@ -196,7 +216,6 @@ void read_lines_from_server(int sock, ResponseType type) {
                         goto DONE;
                     }
                 }
-                line = strtok(NULL, "\r\n");
                 continue;
             }
 
@@ -210,7 +229,7 @@ void read_lines_from_server(int sock, ResponseType type) {
             if (type == RESP_FAVORITES && n == 6) {
                 FavoritePlace f;
                 f.id = atoi(fields[0]);
-                strcpy(f.owner, fields[1]);
+                f.owner = fields[1];
                 strcpy(f.name, fields[2]);
                 strcpy(f.category, fields[3]);
                 strcpy(f.location, fields[4]);
@@ -227,9 +246,9 @@ void read_lines_from_server(int sock, ResponseType type) {
                 FriendRel fr;
                 //printf("Comparing: %s and %s with client_username: %s\n", fields[0], fields[1], client_username);
                 if(strcmp(fields[0], client_username) == 0)
-                    strcpy(fr.user_a, fields[1]);
+                    fr.user_a = fields[1];
                 else
-                    strcpy(fr.user_a, fields[0]);
+                    fr.user_a = fields[0];
                 fr.since = atol(fields[2]);
 
                 if (!printed_header) {
@@ -243,8 +262,8 @@ void read_lines_from_server(int sock, ResponseType type) {
             else if (type == RESP_REQUESTS && n == 5) {
                 FriendRequest r;
                 r.id = atoi(fields[0]);
-                strcpy(r.from, fields[1]);
-                strcpy(r.to, fields[2]);
+                r.from = fields[1];
+                r.to = fields[2];
                 r.status = atoi(fields[3]);
                 r.created_at = atol(fields[4]);
 
@@ -259,12 +278,12 @@ void read_lines_from_server(int sock, ResponseType type) {
             else if (type == RESP_TAGGED && n == 7) {
                 FavoritePlaceWithTags t;
                 t.id = atoi(fields[0]);
-                strcpy(t.owner, fields[1]);
+                t.owner = fields[1];
                 strcpy(t.name, fields[2]);
                 strcpy(t.category, fields[3]);
                 strcpy(t.location, fields[4]);
                 t.created_at = atol(fields[5]);
-                strcpy(t.tagger, fields[6]);
+                t.tagger = fields[6];
                 
                 if (!printed_header) {
                     print_tagged_header();
@@ -273,15 +292,18 @@ void read_lines_from_server(int sock, ResponseType type) {
                 print_tagged_row(&t);
             
             }
-            line = strtok(NULL, "\r\n");
-
-           
         }
         
     }
 
 
 DONE:
+    // Notifications that came in the same read as the end of the reply
+    while ((eol = strstr(rest, "\r\n")) != NULL) {
+        *eol = '\0';
+        print_notification(rest);
+        rest = eol + 2;
+    }
     if (printed_header) {
         if(type == RESP_FAVORITES) printf("+----+------------+--------------------+------------------+---------------------------------+--------------------------------+\n");
         else if(type == RESP_FRIENDS) printf("+--------------------+---------------------+\n");
@@ -0,0 +1,270 @@
+#define LOG_TAG "accounts"
+
+#include "account_cache.h"
+#include "database.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @typedef account_entry_t: One cached row, or the fact that a username has no row.
+ * Fields:
+ *  - hnext: next entry in the same hash bucket
+ *  - prev/next: stripe LRU list, most recently used first
+ *  - hash: full hash of the username
+ *  - exists: 0 for a negative entry
+ *  - expires_ms: when a negative entry stops being trusted (rows created by another
+ *    process become visible after at most ACCOUNT_NEGATIVE_TTL_MS)
+ *  - account: the cached row
+ */
+typedef struct account_entry {
+    struct account_entry *hnext;
+    struct account_entry *prev;
+    struct account_entry *next;
+    unsigned int hash;
+    int exists;
+    long long expires_ms;
+    Account account;
+} account_entry_t;
+
+/**
+ * @typedef account_stripe_t: Independently locked slice of the cache.
+ * Fields:
+ *  - lock: guards everything below
+ *  - buckets/mask: chained hash table
+ *  - lru: sentinel of the LRU list
+ *  - count/cap: entries held and the most this stripe may hold
+ *  - gen: bumped by every write so a slow DB read cannot install a stale row
+ */
+typedef struct account_stripe {
+    pthread_mutex_t lock;
+    account_entry_t **buckets;
+    unsigned int mask;
+    account_entry_t lru;
+    size_t count;
+    size_t cap;
+    unsigned long gen;
+} account_stripe_t;
+
+static account_stripe_t g_stripes[ACCOUNT_CACHE_STRIPES];
+static int g_enabled = 0;
+static size_t g_capacity = 0;
+static unsigned long g_hits;
+static unsigned long g_negative_hits;
+static unsigned long g_misses;
+static unsigned long g_evictions;
+static unsigned long g_raced_fills;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static account_stripe_t *stripe_of(unsigned int hash) {
+    return &g_stripes[hash % ACCOUNT_CACHE_STRIPES];
+}
+
+static account_entry_t **bucket_of(account_stripe_t *st, unsigned int hash) {
+    return &st->buckets[(hash / ACCOUNT_CACHE_STRIPES) & st->mask];
+}
+
+static void lru_unlink(account_entry_t *e) {
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void lru_push_front(account_stripe_t *st, account_entry_t *e) {
+    e->prev = &st->lru;
+    e->next = st->lru.next;
+    st->lru.next->prev = e;
+    st->lru.next = e;
+}
+
+static account_entry_t *find(account_stripe_t *st, unsigned int hash, const char *username) {
+    for (account_entry_t *e = *bucket_of(st, hash); e; e = e->hnext) {
+        if (e->hash == hash && strcmp(e->account.username, username) == 0) return e;
+    }
+    return NULL;
+}
+
+static void unhash(account_stripe_t *st, account_entry_t *victim) {
+    account_entry_t **pp = bucket_of(st, victim->hash);
+    while (*pp != victim) pp = &(*pp)->hnext;
+    *pp = victim->hnext;
+}
+
+static void drop(account_stripe_t *st, account_entry_t *e) {
+    unhash(st, e);
+    lru_unlink(e);
+    st->count--;
+    free(e);
+}
+
+// Insert or overwrite; evicts the least recently used entry when the stripe is full
+static void upsert(account_stripe_t *st, unsigned int hash, const char *username,
+                   const Account *account, int exists) {
+    account_entry_t *e = find(st, hash, username);
+    if (e) {
+        lru_unlink(e);
+    } else {
+        if (st->count >= st->cap && st->lru.prev != &st->lru) {
+            e = st->lru.prev;
+            unhash(st, e);
+            lru_unlink(e);
+            st->count--;
+            __atomic_add_fetch(&g_evictions, 1, __ATOMIC_RELAXED);
+        } else {
+            e = malloc(sizeof(*e));
+            if (!e) return;
+        }
+        memset(e, 0, sizeof(*e));
+        e->hash = hash;
+        account_entry_t **bucket = bucket_of(st, hash);
+        e->hnext = *bucket;
+        *bucket = e;
+        st->count++;
+    }
+    e->exists = exists;
+    e->expires_ms = exists ? 0 : now_ms() + ACCOUNT_NEGATIVE_TTL_MS;
+    if (exists) {
+        e->account = *account;
+    } else {
+        memset(&e->account, 0, sizeof(e->account));
+    }
+    strncpy(e->account.username, username, sizeof(e->account.username) - 1);
+    lru_push_front(st, e);
+}
+
+/**
+ * @function account_cache_init: Size the cache. Must run before any worker thread.
+ *
+ * @param capacity: Most accounts (including negative entries) kept in memory; 0 disables
+ * the cache and every lookup goes to the database.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int account_cache_init(size_t capacity) {
+    g_capacity = capacity;
+    if (capacity == 0) return 0;
+
+    size_t per_stripe = (capacity + ACCOUNT_CACHE_STRIPES - 1) / ACCOUNT_CACHE_STRIPES;
+    unsigned int nbuckets = 8;
+    while (nbuckets < per_stripe) nbuckets <<= 1;
+
+    for (int i = 0; i < ACCOUNT_CACHE_STRIPES; ++i) {
+        account_stripe_t *st = &g_stripes[i];
+        pthread_mutex_init(&st->lock, NULL);
+        st->buckets = calloc(nbuckets, sizeof(*st->buckets));
+        if (!st->buckets) return -1;
+        st->mask = nbuckets - 1;
+        st->lru.prev = st->lru.next = &st->lru;
+        st->cap = per_stripe;
+    }
+    g_enabled = 1;
+    return 0;
+}
+
+/**
+ * @function account_cache_get: Read-through lookup of an account.
+ *
+ * @param username: Account to find.
+ * @param out_account: Filled on success.
+ *
+ * @return 0 if found, -2 if the account does not exist, -1 on a database error
+ * (same contract as db_fetch_account).
+ */
+int account_cache_get(const char *username, Account *out_account) {
+    if (!g_enabled) return db_fetch_account(username, out_account);
+
+    unsigned int hash = name_hash(username);
+    account_stripe_t *st = stripe_of(hash);
+
+    pthread_mutex_lock(&st->lock);
+    account_entry_t *e = find(st, hash, username);
+    if (e && !e->exists && now_ms() >= e->expires_ms) {
+        drop(st, e);
+        e = NULL;
+    }
+    if (e) {
+        lru_unlink(e);
+        lru_push_front(st, e);
+        int rc = 0;
+        if (e->exists) {
+            *out_account = e->account;
+            __atomic_add_fetch(&g_hits, 1, __ATOMIC_RELAXED);
+        } else {
+            rc = -2;
+            __atomic_add_fetch(&g_negative_hits, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&st->lock);
+        return rc;
+    }
+    unsigned long gen = st->gen;
+    pthread_mutex_unlock(&st->lock);
+
+    __atomic_add_fetch(&g_misses, 1, __ATOMIC_RELAXED);
+    int rc = db_fetch_account(username, out_account);
+    // Only a definite answer is cached; an error must not lock the account out
+    if (rc != 0 && rc != -2) return rc;
+
+    pthread_mutex_lock(&st->lock);
+    if (st->gen == gen) {
+        upsert(st, hash, username, out_account, rc == 0);
+    } else {
+        // A write landed while we were reading; the next lookup reloads
+        __atomic_add_fetch(&g_raced_fills, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return rc;
+}
+
+/**
+ * @function account_cache_put: Record a newly created account, replacing any negative entry.
+ *
+ * @param account: Row as written to the database.
+ */
+void account_cache_put(const Account *account) {
+    if (!g_enabled) return;
+    unsigned int hash = name_hash(account->username);
+    account_stripe_t *st = stripe_of(hash);
+    pthread_mutex_lock(&st->lock);
+    st->gen++;
+    upsert(st, hash, account->username, account, 1);
+    pthread_mutex_unlock(&st->lock);
+}
+
+void account_cache_dump_metrics(FILE *out) {
+    if (!g_enabled) {
+        fprintf(out, "disabled\n");
+        return;
+    }
+    size_t entries = 0;
+    for (int i = 0; i < ACCOUNT_CACHE_STRIPES; ++i) {
+        pthread_mutex_lock(&g_stripes[i].lock);
+        entries += g_stripes[i].count;
+        pthread_mutex_unlock(&g_stripes[i].lock);
+    }
+    unsigned long hits = __atomic_load_n(&g_hits, __ATOMIC_RELAXED);
+    unsigned long neg = __atomic_load_n(&g_negative_hits, __ATOMIC_RELAXED);
+    unsigned long misses = __atomic_load_n(&g_misses, __ATOMIC_RELAXED);
+    unsigned long total = hits + neg + misses;
+    fprintf(out, "hits=%lu negative_hits=%lu misses=%lu hit_rate=%.1f%% evictions=%lu raced_fills=%lu\n",
+            hits, neg, misses, total ? 100.0 * (double)(hits + neg) / (double)total : 0.0,
+            __atomic_load_n(&g_evictions, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_raced_fills, __ATOMIC_RELAXED));
+    fprintf(out, "entries=%zu capacity=%zu memory=%zuKB\n", entries, g_capacity,
+            entries * sizeof(account_entry_t) / 1024);
+}
@@ -0,0 +1,18 @@
+#ifndef TCP_SERVER_ACCOUNT_CACHE_H
+#define TCP_SERVER_ACCOUNT_CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "../entity/entities.h"
+
+#define DEFAULT_ACCOUNT_CACHE 32768
+#define ACCOUNT_CACHE_STRIPES 64
+#define ACCOUNT_NEGATIVE_TTL_MS 30000
+
+// ACCOUNT CACHE FUNCTIONS
+int account_cache_init(size_t capacity);
+int account_cache_get(const char *username, Account *out_account);
+void account_cache_put(const Account *account);
+void account_cache_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,492 @@
+#include "activity_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_WRITE_BUF (64 * 1024)
+#define LOG_IDLE_WAIT_MS 200
+#define LOG_PATH_LEN 256
+
+/**
+ * @typedef log_slot_t: One fixed-size ring slot. A message longer than LOG_SLOT_TEXT
+ * spans consecutive slots; only the first carries the header fields.
+ * Fields:
+ *  - seq: slot sequence number (free for position p when seq == p, filled when p + 1)
+ *  - nslots: slots used by the message (first slot only)
+ *  - len: text bytes stored in this slot
+ *  - kind/dir/opcode: record type, direction and command (see binlog.h)
+ *  - session_id: session the message belongs to (0 if none)
+ *  - bytes: full message length (the ring may hold less in binary mode)
+ *  - mono_ns: CLOCK_MONOTONIC time of the message
+ *  - peer: client address
+ *  - text: message bytes (not NUL-terminated)
+ */
+typedef struct log_slot {
+    unsigned long seq;
+    unsigned short nslots;
+    unsigned short len;
+    unsigned char kind;
+    unsigned char dir;
+    unsigned short opcode;
+    unsigned int session_id;
+    unsigned int bytes;
+    uint64_t mono_ns;
+    char peer[LOG_PEER_LEN];
+    char text[LOG_SLOT_TEXT];
+} log_slot_t;
+
+/**
+ * @typedef segment_t: Binary segment being filled through a shared mapping.
+ */
+typedef struct segment {
+    int fd;
+    char *map;
+    size_t size;
+    size_t pos;
+    unsigned int index;
+} segment_t;
+
+static log_slot_t *g_ring = NULL;
+static size_t g_mask = 0;
+static size_t g_max_slots = 0;
+static unsigned long g_enqueue_pos = 0;
+static unsigned long g_dequeue_pos = 0;
+static log_config_t g_cfg;
+static char g_base[LOG_PATH_LEN];
+static int g_fd = -1;
+static segment_t g_seg = {-1, NULL, 0, 0, 0};
+static uint64_t g_run_id = 0;
+
+static pthread_mutex_t g_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+static int g_writer_idle = 0;
+
+static unsigned long g_logged = 0;
+static unsigned long g_dropped = 0;
+static unsigned long g_blocked = 0;
+static unsigned long g_write_calls = 0;
+static unsigned long g_bytes = 0;
+static unsigned long g_segments = 0;
+
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void wake_writer(void) {
+    if (!__atomic_load_n(&g_writer_idle, __ATOMIC_SEQ_CST)) return;
+    pthread_mutex_lock(&g_wake_lock);
+    pthread_cond_signal(&g_wake);
+    pthread_mutex_unlock(&g_wake_lock);
+}
+
+/**
+ * @function enqueue: Copy one message into the ring. Lock-free for producers: a CAS on
+ * the enqueue position claims every slot of the message at once, so messages from
+ * different sessions never interleave.
+ */
+static void enqueue(const log_slot_t *hdr, const char *text, size_t len) {
+    size_t n = len ? (len + LOG_SLOT_TEXT - 1) / LOG_SLOT_TEXT : 1;
+    if (n > g_max_slots) {
+        n = g_max_slots;
+        len = n * LOG_SLOT_TEXT;
+    }
+
+    unsigned long pos = __atomic_load_n(&g_enqueue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        // The writer frees slots in order, so if the last one is free all of them are.
+        log_slot_t *last = &g_ring[(pos + n - 1) & g_mask];
+        long diff = (long)(__atomic_load_n(&last->seq, __ATOMIC_ACQUIRE) - (pos + n - 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&g_enqueue_pos, &pos, pos + n, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (diff < 0) {
+            if (g_cfg.full == LOG_FULL_DROP) {
+                __atomic_add_fetch(&g_dropped, 1, __ATOMIC_RELAXED);
+                return;
+            }
+            __atomic_add_fetch(&g_blocked, 1, __ATOMIC_RELAXED);
+            wake_writer();
+            sched_yield();
+            pos = __atomic_load_n(&g_enqueue_pos, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&g_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        log_slot_t *slot = &g_ring[(pos + i) & g_mask];
+        size_t chunk = len - i * LOG_SLOT_TEXT;
+        if (chunk > LOG_SLOT_TEXT) chunk = LOG_SLOT_TEXT;
+        if (i == 0) {
+            slot->nslots = (unsigned short)n;
+            slot->kind = hdr->kind;
+            slot->dir = hdr->dir;
+            slot->opcode = hdr->opcode;
+            slot->session_id = hdr->session_id;
+            slot->bytes = hdr->bytes;
+            slot->mono_ns = hdr->mono_ns;
+            memcpy(slot->peer, hdr->peer, sizeof(slot->peer));
+        }
+        slot->len = (unsigned short)chunk;
+        if (chunk) memcpy(slot->text, text + i * LOG_SLOT_TEXT, chunk);
+        __atomic_store_n(&slot->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_add_fetch(&g_logged, 1, __ATOMIC_RELAXED);
+    wake_writer();
+}
+
+/**
+ * @function activity_log_write: Queue bytes sent to or received from a client.
+ *
+ * @param session_id: Session the bytes belong to (0 if none).
+ * @param peer: Client address, formatted once per session.
+ * @param dir: BINLOG_IN for received data, BINLOG_OUT for replies.
+ * @param opcode: Command being answered for replies; ignored for received data,
+ *                whose command is read from the text.
+ * @param text: NUL-terminated data.
+ */
+void activity_log_write(unsigned int session_id, const char *peer, binlog_dir_t dir, int opcode, const char *text) {
+    if (!g_ring) return;
+    if (!text) text = "";
+    log_slot_t hdr;
+    size_t len = strlen(text);
+    hdr.kind = BINLOG_DATA;
+    hdr.dir = (unsigned char)dir;
+    hdr.opcode = (unsigned short)(dir == BINLOG_IN ? binlog_opcode_of(text) : opcode);
+    hdr.session_id = session_id;
+    hdr.bytes = (unsigned int)len;
+    hdr.mono_ns = clock_ns(CLOCK_MONOTONIC);
+    strncpy(hdr.peer, peer ? peer : "", sizeof(hdr.peer) - 1);
+    hdr.peer[sizeof(hdr.peer) - 1] = '\0';
+    // Binary records keep only a prefix: don't move the rest through the ring.
+    if (g_cfg.format == LOG_FORMAT_BINARY && len > g_cfg.payload_max) len = g_cfg.payload_max;
+    enqueue(&hdr, text, len);
+}
+
+/**
+ * @function activity_log_meta: Record a session event the binary log needs to rebuild
+ * the text format (peer of a session id, user behind it). The text log prints these
+ * fields on every line and skips such records.
+ *
+ * @param session_id: Session concerned.
+ * @param kind: BINLOG_OPEN (text = peer) or BINLOG_LOGIN (text = username).
+ * @param text: Event payload.
+ */
+void activity_log_meta(unsigned int session_id, binlog_kind_t kind, const char *text) {
+    if (!g_ring || g_cfg.format != LOG_FORMAT_BINARY) return;
+    log_slot_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.kind = (unsigned char)kind;
+    hdr.session_id = session_id;
+    hdr.bytes = (unsigned int)strlen(text);
+    hdr.mono_ns = clock_ns(CLOCK_MONOTONIC);
+    enqueue(&hdr, text, hdr.bytes);
+}
+
+// TEXT OUTPUT
+
+typedef struct write_buf {
+    char data[LOG_WRITE_BUF];
+    size_t used;
+} write_buf_t;
+
+static void flush_buf(write_buf_t *wb) {
+    size_t off = 0;
+    while (off < wb->used) {
+        ssize_t w = write(g_fd, wb->data + off, wb->used - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("Cannot write log file");
+            break;
+        }
+        off += (size_t)w;
+        __atomic_add_fetch(&g_write_calls, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&g_bytes, (unsigned long)off, __ATOMIC_RELAXED);
+    wb->used = 0;
+}
+
+static void put(write_buf_t *wb, const char *src, size_t len) {
+    while (len > 0) {
+        if (wb->used == sizeof(wb->data)) flush_buf(wb);
+        size_t room = sizeof(wb->data) - wb->used;
+        size_t chunk = len < room ? len : room;
+        memcpy(wb->data + wb->used, src, chunk);
+        wb->used += chunk;
+        src += chunk;
+        len -= chunk;
+    }
+}
+
+/**
+ * @typedef text_state_t: Writer-side cache so localtime_r() and the clock offset are
+ * computed at most once per second of log time.
+ */
+typedef struct text_state {
+    write_buf_t *wb;
+    uint64_t stamp_sec;
+    int64_t wall_offset_ns;
+    char stamp[64];
+} text_state_t;
+
+static void emit_text(text_state_t *ts, unsigned long pos) {
+    log_slot_t *head = &g_ring[pos & g_mask];
+    if (head->kind != BINLOG_DATA) return;
+
+    uint64_t sec = head->mono_ns / 1000000000ull;
+    if (sec != ts->stamp_sec) {
+        ts->wall_offset_ns = (int64_t)(clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC));
+        time_t wall = (time_t)(((int64_t)head->mono_ns + ts->wall_offset_ns) / 1000000000ll);
+        struct tm t;
+        localtime_r(&wall, &t);
+        snprintf(ts->stamp, sizeof(ts->stamp), "[%02d/%02d/%04d %02d:%02d:%02d]",
+                 t.tm_mday, t.tm_mon + 1, t.tm_year + 1900, t.tm_hour, t.tm_min, t.tm_sec);
+        ts->stamp_sec = sec;
+    }
+    const char *type = head->dir == BINLOG_OUT ? "REQUEST" : "RESPONSE";
+    put(ts->wb, ts->stamp, strlen(ts->stamp));
+    put(ts->wb, "$", 1);
+    put(ts->wb, head->peer, strlen(head->peer));
+    put(ts->wb, "$", 1);
+    put(ts->wb, type, strlen(type));
+    put(ts->wb, "$", 1);
+    for (size_t i = 0; i < head->nslots; ++i) {
+        log_slot_t *slot = &g_ring[(pos + i) & g_mask];
+        put(ts->wb, slot->text, slot->len);
+    }
+    put(ts->wb, "\n", 1);
+}
+
+// BINARY OUTPUT
+
+static void close_segment(segment_t *seg) {
+    if (seg->map) munmap(seg->map, seg->size);
+    if (seg->fd >= 0) close(seg->fd);
+    seg->map = NULL;
+    seg->fd = -1;
+}
+
+/**
+ * @function open_segment: Create the next segment file, reserve its blocks up front
+ * and map it, so appending a record is a memcpy with no syscall.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int open_segment(segment_t *seg) {
+    char path[LOG_PATH_LEN + 16];
+    int fd = -1;
+    // Never overwrite segments from earlier runs.
+    while (fd < 0) {
+        snprintf(path, sizeof(path), "%s.%06u.bin", g_base, seg->index++);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) {
+            perror("Cannot create log segment");
+            return -1;
+        }
+    }
+    int rc = posix_fallocate(fd, 0, (off_t)g_cfg.segment_bytes);
+    if (rc != 0) {
+        fprintf(stderr, "Cannot preallocate %s: %s\n", path, strerror(rc));
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, g_cfg.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+
+    binlog_segment_header_t *hdr = (binlog_segment_header_t *)map;
+    hdr->magic = BINLOG_MAGIC;
+    hdr->version = BINLOG_VERSION;
+    hdr->header_size = sizeof(binlog_segment_header_t);
+    hdr->run_id = g_run_id;
+    hdr->wall_offset_ns = (int64_t)(clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC));
+    hdr->segment_size = (uint32_t)g_cfg.segment_bytes;
+
+    seg->fd = fd;
+    seg->map = map;
+    seg->size = g_cfg.segment_bytes;
+    seg->pos = sizeof(binlog_segment_header_t);
+    __atomic_add_fetch(&g_segments, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void emit_binary(segment_t *seg, unsigned long pos) {
+    log_slot_t *head = &g_ring[pos & g_mask];
+    size_t payload = 0;
+    for (size_t i = 0; i < head->nslots; ++i) payload += g_ring[(pos + i) & g_mask].len;
+    size_t size = (sizeof(binlog_record_t) + payload + BINLOG_ALIGN - 1) & ~(size_t)(BINLOG_ALIGN - 1);
+
+    if (!seg->map || seg->pos + size > seg->size) {
+        close_segment(seg);
+        if (open_segment(seg) != 0) {
+            __atomic_add_fetch(&g_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    binlog_record_t *rec = (binlog_record_t *)(seg->map + seg->pos);
+    char *dst = (char *)(rec + 1);
+    for (size_t i = 0; i < head->nslots; ++i) {
+        log_slot_t *slot = &g_ring[(pos + i) & g_mask];
+        memcpy(dst, slot->text, slot->len);
+        dst += slot->len;
+    }
+    rec->kind = head->kind;
+    rec->dir = head->dir;
+    rec->session_id = head->session_id;
+    rec->mono_ns = head->mono_ns;
+    rec->opcode = head->opcode;
+    rec->status = 0;
+    if (head->kind == BINLOG_DATA && head->dir == BINLOG_OUT && payload >= 3) {
+        const char *p = (const char *)(rec + 1);
+        if (p[0] >= '0' && p[0] <= '9' && p[1] >= '0' && p[1] <= '9' && p[2] >= '0' && p[2] <= '9') {
+            rec->status = (uint16_t)((p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0'));
+        }
+    }
+    rec->bytes = head->bytes;
+    rec->payload_len = (uint16_t)payload;
+    // Size last: a reader treats size 0 as the end of the data.
+    rec->size = (uint16_t)size;
+    seg->pos += size;
+    __atomic_add_fetch(&g_bytes, (unsigned long)size, __ATOMIC_RELAXED);
+}
+
+// Wait until slot pos holds a complete entry; a claimed slot is filled right after the CAS.
+static int slot_ready(unsigned long pos) {
+    return __atomic_load_n(&g_ring[pos & g_mask].seq, __ATOMIC_ACQUIRE) == pos + 1;
+}
+
+/**
+ * @function writer_thread: Drain the ring into the log. Text output goes through a
+ * large buffer appended with as few write() calls as possible; binary output is
+ * copied into the mapped segment.
+ */
+static void *writer_thread(void *arg) {
+    (void)arg;
+    text_state_t ts;
+    memset(&ts, 0, sizeof(ts));
+    ts.stamp_sec = UINT64_MAX;
+    if (g_cfg.format == LOG_FORMAT_TEXT) {
+        ts.wb = malloc(sizeof(write_buf_t));
+        if (!ts.wb) return NULL;
+        ts.wb->used = 0;
+    }
+
+    while (1) {
+        unsigned long pos = g_dequeue_pos;
+        if (!slot_ready(pos)) {
+            if (ts.wb && ts.wb->used) flush_buf(ts.wb);
+            pthread_mutex_lock(&g_wake_lock);
+            __atomic_store_n(&g_writer_idle, 1, __ATOMIC_SEQ_CST);
+            if (!slot_ready(pos)) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&g_wake, &g_wake_lock, &deadline);
+            }
+            __atomic_store_n(&g_writer_idle, 0, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&g_wake_lock);
+            continue;
+        }
+
+        size_t n = g_ring[pos & g_mask].nslots;
+        for (size_t i = 1; i < n; ++i) {
+            while (!slot_ready(pos + i)) sched_yield();
+        }
+
+        if (g_cfg.format == LOG_FORMAT_BINARY) emit_binary(&g_seg, pos);
+        else emit_text(&ts, pos);
+
+        for (size_t i = 0; i < n; ++i) {
+            __atomic_store_n(&g_ring[(pos + i) & g_mask].seq, pos + i + g_mask + 1, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&g_dequeue_pos, pos + n, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * @function activity_log_start: Open the log output once and start the writer thread.
+ *
+ * @param basename: Output path without extension (".txt", or ".NNNNNN.bin" segments).
+ * @param cfg: Ring size, full ring policy and output format.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int activity_log_start(const char *basename, const log_config_t *cfg) {
+    size_t cap = 64;
+    while (cap < cfg->ring_slots) cap <<= 1;
+
+    g_cfg = *cfg;
+    snprintf(g_base, sizeof(g_base), "%s", basename);
+    g_run_id = clock_ns(CLOCK_REALTIME) ^ ((uint64_t)getpid() << 48);
+    if (g_cfg.format == LOG_FORMAT_BINARY) {
+        size_t max_payload = UINT16_MAX - sizeof(binlog_record_t) - BINLOG_ALIGN;
+        if (g_cfg.payload_max > max_payload) g_cfg.payload_max = max_payload;
+        if (g_cfg.segment_bytes < 4 * (sizeof(binlog_record_t) + g_cfg.payload_max)) {
+            g_cfg.segment_bytes = 4 * (sizeof(binlog_record_t) + g_cfg.payload_max);
+        }
+        if (open_segment(&g_seg) != 0) return -1;
+    } else {
+        char path[LOG_PATH_LEN + 8];
+        snprintf(path, sizeof(path), "%s.txt", g_base);
+        g_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (g_fd == -1) {
+            perror("Cannot open log file");
+            return -1;
+        }
+    }
+
+    log_slot_t *ring = calloc(cap, sizeof(log_slot_t));
+    if (!ring) return -1;
+    for (size_t i = 0; i < cap; ++i) ring[i].seq = i;
+    g_mask = cap - 1;
+    g_max_slots = cap / 4;
+
+    pthread_t tid;
+    g_ring = ring;
+    if (pthread_create(&tid, NULL, writer_thread, NULL) != 0) {
+        g_ring = NULL;
+        free(ring);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void activity_log_dump_metrics(FILE *out) {
+    unsigned long enq = __atomic_load_n(&g_enqueue_pos, __ATOMIC_RELAXED);
+    unsigned long deq = __atomic_load_n(&g_dequeue_pos, __ATOMIC_RELAXED);
+    fprintf(out, "logged=%lu dropped=%lu producer_waits=%lu ring_used=%lu/%zu policy=%s\n",
+            __atomic_load_n(&g_logged, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_dropped, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_blocked, __ATOMIC_RELAXED),
+            enq - deq, g_mask + 1,
+            g_cfg.full == LOG_FULL_DROP ? "drop" : "block");
+    if (g_cfg.format == LOG_FORMAT_BINARY) {
+        fprintf(out, "format=binary segments=%lu record_bytes=%lu payload_max=%zu\n",
+                __atomic_load_n(&g_segments, __ATOMIC_RELAXED),
+                __atomic_load_n(&g_bytes, __ATOMIC_RELAXED), g_cfg.payload_max);
+    } else {
+        fprintf(out, "format=text write_calls=%lu bytes=%lu\n",
+                __atomic_load_n(&g_write_calls, __ATOMIC_RELAXED),
+                __atomic_load_n(&g_bytes, __ATOMIC_RELAXED));
+    }
+}
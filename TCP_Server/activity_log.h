@@ -0,0 +1,57 @@
+#ifndef TCP_SERVER_ACTIVITY_LOG_H
+#define TCP_SERVER_ACTIVITY_LOG_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "binlog.h"
+
+#define LOG_PEER_LEN 32
+#define LOG_SLOT_TEXT 192
+#define DEFAULT_LOG_RING 8192
+#define DEFAULT_LOG_PAYLOAD 256
+#define DEFAULT_LOG_SEGMENT_MB 16
+
+/**
+ * @typedef log_full_policy_t: What a producer does when the log ring is full.
+ *  - LOG_FULL_BLOCK: wait for the writer thread to free slots (nothing is lost)
+ *  - LOG_FULL_DROP: discard the message and count it
+ */
+typedef enum log_full_policy {
+    LOG_FULL_BLOCK = 0,
+    LOG_FULL_DROP
+} log_full_policy_t;
+
+/**
+ * @typedef log_format_t: On-disk format of the activity log.
+ *  - LOG_FORMAT_TEXT: "[dd/mm/yyyy hh:mm:ss]$ip:port$TYPE$payload" lines in <base>.txt
+ *  - LOG_FORMAT_BINARY: binlog.h records in preallocated <base>.NNNNNN.bin segments
+ */
+typedef enum log_format {
+    LOG_FORMAT_TEXT = 0,
+    LOG_FORMAT_BINARY
+} log_format_t;
+
+/**
+ * @typedef log_config_t: Activity log options.
+ * Fields:
+ *  - ring_slots: ring capacity between session threads and the writer
+ *  - full: full ring policy
+ *  - format: text or binary output
+ *  - payload_max: payload bytes kept per binary record (the byte count is always exact)
+ *  - segment_bytes: size of each preallocated binary segment
+ */
+typedef struct log_config {
+    size_t ring_slots;
+    log_full_policy_t full;
+    log_format_t format;
+    size_t payload_max;
+    size_t segment_bytes;
+} log_config_t;
+
+// ACTIVITY LOG FUNCTIONS
+int activity_log_start(const char *basename, const log_config_t *cfg);
+void activity_log_write(unsigned int session_id, const char *peer, binlog_dir_t dir, int opcode, const char *text);
+void activity_log_meta(unsigned int session_id, binlog_kind_t kind, const char *text);
+void activity_log_dump_metrics(FILE *out);
+
+#endif
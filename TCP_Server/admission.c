@@ -0,0 +1,86 @@
+#include "admission.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static admission_limits_t g_limits;
+static long g_live_sessions = 0;
+static long g_live_bytes = 0;
+static unsigned long g_admitted = 0;
+static unsigned long g_shed = 0;
+static unsigned long g_pauses = 0;
+
+void admission_configure(const admission_limits_t *limits) {
+    g_limits = *limits;
+}
+
+static int over(long sessions, size_t bytes_limit, long session_limit) {
+    long bytes = __atomic_load_n(&g_live_bytes, __ATOMIC_RELAXED);
+    return sessions >= session_limit || (bytes > 0 && (size_t)bytes >= bytes_limit);
+}
+
+/**
+ * @function admission_gate: Decide whether a freshly accepted connection may get a
+ * session. Past the soft limit the client receives a one-line "503 Server busy"
+ * and the socket is closed before any per-session memory is allocated.
+ *
+ * @param connfd: Accepted socket.
+ *
+ * @return 1 if admitted, 0 if the connection was shed (connfd is closed).
+ */
+int admission_gate(int connfd) {
+    long sessions = __atomic_load_n(&g_live_sessions, __ATOMIC_RELAXED);
+    if (!over(sessions, g_limits.soft_bytes, g_limits.soft_sessions)) {
+        __atomic_add_fetch(&g_admitted, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    static const char busy[] = "503 Server busy\r\n";
+    send(connfd, busy, sizeof(busy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(connfd);
+    __atomic_add_fetch(&g_shed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @function admission_should_pause: 1 when the hard limit is reached and acceptors
+ * should leave new connections in the kernel queue.
+ */
+int admission_should_pause(void) {
+    long sessions = __atomic_load_n(&g_live_sessions, __ATOMIC_RELAXED);
+    return over(sessions, g_limits.hard_bytes, g_limits.hard_sessions);
+}
+
+void admission_note_pause(void) {
+    __atomic_add_fetch(&g_pauses, 1, __ATOMIC_RELAXED);
+}
+
+void admission_session_opened(size_t bytes) {
+    __atomic_add_fetch(&g_live_sessions, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_live_bytes, (long)bytes, __ATOMIC_RELAXED);
+}
+
+void admission_session_closed(size_t bytes) {
+    __atomic_sub_fetch(&g_live_sessions, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&g_live_bytes, (long)bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function admission_charge: Account memory that grows and shrinks with a session's
+ * traffic (reply buffers), in addition to its fixed footprint.
+ *
+ * @param bytes: Positive when allocating, negative when freeing.
+ */
+void admission_charge(long bytes) {
+    __atomic_add_fetch(&g_live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void admission_dump_metrics(FILE *out) {
+    fprintf(out, "live_sessions=%ld live_bytes=%ld admitted=%lu shed_503=%lu accept_pauses=%lu\n",
+            __atomic_load_n(&g_live_sessions, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_live_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_admitted, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_shed, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_pauses, __ATOMIC_RELAXED));
+    fprintf(out, "limits: soft=%ld sessions/%zu bytes hard=%ld sessions/%zu bytes\n",
+            g_limits.soft_sessions, g_limits.soft_bytes, g_limits.hard_sessions, g_limits.hard_bytes);
+}
@@ -0,0 +1,33 @@
+#ifndef TCP_SERVER_ADMISSION_H
+#define TCP_SERVER_ADMISSION_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define DEFAULT_SOFT_MEM_MB 256
+#define DEFAULT_HARD_MEM_MB 512
+
+/**
+ * @typedef admission_limits_t: Load thresholds for new connections.
+ * Fields:
+ *  - soft_sessions/soft_bytes: past either, new clients get "503 Server busy" and are closed
+ *  - hard_sessions/hard_bytes: past either, listeners stop accepting until load drops
+ */
+typedef struct admission_limits {
+    long soft_sessions;
+    long hard_sessions;
+    size_t soft_bytes;
+    size_t hard_bytes;
+} admission_limits_t;
+
+// ADMISSION CONTROL FUNCTIONS
+void admission_configure(const admission_limits_t *limits);
+int admission_gate(int connfd);
+int admission_should_pause(void);
+void admission_note_pause(void);
+void admission_session_opened(size_t bytes);
+void admission_session_closed(size_t bytes);
+void admission_charge(long bytes);
+void admission_dump_metrics(FILE *out);
+
+#endif
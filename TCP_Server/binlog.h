@@ -0,0 +1,108 @@
+#ifndef TCP_SERVER_BINLOG_H
+#define TCP_SERVER_BINLOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * On-disk layout of the binary activity log, shared by the server and mmt-logcat.
+ * A segment is a preallocated file: one binlog_segment_header_t, then records back
+ * to back. The zero-filled tail reads as a record of size 0, which ends the data.
+ */
+
+#define BINLOG_MAGIC 0x474f4c4du /* "MLOG" */
+#define BINLOG_VERSION 1
+#define BINLOG_ALIGN 8
+
+/**
+ * @typedef binlog_segment_header_t: Start of every segment file.
+ * Fields:
+ *  - run_id: identifies the server process; session ids are only unique within a run
+ *  - wall_offset_ns: CLOCK_REALTIME minus CLOCK_MONOTONIC when the segment was opened
+ *  - segment_size: preallocated file size
+ */
+typedef struct binlog_segment_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t run_id;
+    int64_t wall_offset_ns;
+    uint32_t segment_size;
+    uint32_t reserved;
+} binlog_segment_header_t;
+
+/**
+ * @typedef binlog_kind_t: Record types.
+ *  - BINLOG_DATA: bytes received from or sent to a client
+ *  - BINLOG_OPEN: session opened, payload is the peer "ip:port"
+ *  - BINLOG_LOGIN: session logged in, payload is the username
+ */
+typedef enum binlog_kind {
+    BINLOG_DATA = 0,
+    BINLOG_OPEN,
+    BINLOG_LOGIN
+} binlog_kind_t;
+
+/**
+ * @typedef binlog_dir_t: Direction of a data record, named like the text log tags.
+ *  - BINLOG_IN: received from the client ("RESPONSE" in the text log)
+ *  - BINLOG_OUT: sent to the client ("REQUEST" in the text log)
+ */
+typedef enum binlog_dir {
+    BINLOG_IN = 0,
+    BINLOG_OUT
+} binlog_dir_t;
+
+/**
+ * @typedef binlog_record_t: Fixed record header, followed by payload_len bytes.
+ * Fields:
+ *  - size: whole record including padding to BINLOG_ALIGN (0 = end of data)
+ *  - mono_ns: CLOCK_MONOTONIC timestamp
+ *  - opcode: command received, or being answered (binlog_opcode_of)
+ *  - status: 3-digit reply code for BINLOG_OUT records, 0 otherwise
+ *  - bytes: payload length before truncation
+ */
+typedef struct binlog_record {
+    uint16_t size;
+    uint8_t kind;
+    uint8_t dir;
+    uint32_t session_id;
+    uint64_t mono_ns;
+    uint16_t opcode;
+    uint16_t status;
+    uint32_t bytes;
+    uint16_t payload_len;
+    uint16_t reserved[3];
+} binlog_record_t;
+
+static const char *const binlog_opcode_names[] = {
+    "", "LOGIN", "REGISTER", "LOGOUT", "ADD_FAVORITE", "LIST_FAVORITES", "DEL_FAVORITE",
+    "EDIT_FAVORITE", "LIST_TAGGED_FAVORITES", "LIST_FRIEND_REQUESTS", "ADD_FRIEND",
+    "LIST_FRIENDS", "ACCEPT_FRIEND", "LIST_REQUESTS", "REJECT_FRIEND", "REMOVE_FRIEND",
+    "TAG_FRIEND", "LIST_NOTIFICATIONS", "SEEN_NOTIFICATION", "NOTIFY", "WATCH"
+};
+
+#define BINLOG_OPCODES (int)(sizeof(binlog_opcode_names) / sizeof(binlog_opcode_names[0]))
+
+/**
+ * @function binlog_opcode_of: Opcode of the command at the start of text (0 if unknown).
+ */
+static inline int binlog_opcode_of(const char *text) {
+    size_t n = strcspn(text, "|\r\n");
+    for (int op = 1; op < BINLOG_OPCODES; ++op) {
+        if (strlen(binlog_opcode_names[op]) == n && strncmp(text, binlog_opcode_names[op], n) == 0) return op;
+    }
+    return 0;
+}
+
+/**
+ * @function binlog_opcode_by_name: Reverse lookup for filters (-1 if unknown).
+ */
+static inline int binlog_opcode_by_name(const char *name) {
+    for (int op = 1; op < BINLOG_OPCODES; ++op) {
+        if (strcmp(name, binlog_opcode_names[op]) == 0) return op;
+    }
+    return -1;
+}
+
+#endif
@@ -1,7 +1,19 @@
+#define LOG_TAG "cmd"
+
 #include "command_handlers.h"
 #include "ultilities.h"
-
+#include "activity_log.h"
+#include "presence.h"
+#include "session.h"
+#include "watch.h"
+#include "reply_cache.h"
+#include "worker_pool.h"
+#include "log.h"
+
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void handle_login(client_session_t *session, const char *payload);
@@ -11,26 +23,317 @@ static void handle_add_favorite(client_session_t *session, const char *payload);
 static void handle_add_friend(client_session_t *session, const char *payload);
 static void handle_accept_friend(client_session_t *session, const char *payload);
 static void handle_list_favorites(client_session_t *session, const char *payload);
-static void handle_list_friends(client_session_t *session);
-static void handle_list_friend_requests(client_session_t *session);
+static void handle_list_friends(client_session_t *session, const char *payload);
+static void handle_list_friend_requests(client_session_t *session, const char *payload);
 static void handle_remove_friend(client_session_t *session, const char *payload);
 static void handle_reject_friend(client_session_t *session, const char *payload);
 static void handle_delete_favorite(client_session_t *session, const char *payload);
 static void handle_edit_favorite(client_session_t *session, const char *payload);
-static void handle_list_tagged_favorites(client_session_t *session);
+static void handle_list_tagged_favorites(client_session_t *session, const char *payload);
 static void handle_tag_friend(client_session_t *session, const char *payload);
-static void handle_not_implemented(client_session_t *session);
+static void handle_list_notifications(client_session_t *session, const char *payload);
+static void handle_seen_notification(client_session_t *session, const char *payload);
+static void handle_watch(client_session_t *session, const char *payload);
 
 static void send_bad_request(client_session_t *session, const char *message) {
     char buff[128];
     snprintf(buff, sizeof(buff), "400 %s\r\n", message ? message : "Bad request");
-    send_request(session->sockfd, buff);
+    send_reply(session, buff);
+}
+
+/**
+ * @function parse_page_args: Parse "|after=<id>|limit=<n>" (either part optional, in
+ * any order) following a LIST_* command name.
+ *
+ * @param payload: Text after the command name.
+ * @param page: Filled with the cursor; limit defaults to PAGE_DEFAULT_LIMIT.
+ *
+ * @return 1 for a paged listing, 0 when no arguments were given (the legacy full
+ * listing), -1 on malformed arguments.
+ */
+static int parse_page_args(const char *payload, db_page_t *page) {
+    page->after = 0;
+    page->limit = PAGE_DEFAULT_LIMIT;
+    if (!payload) return 0;
+
+    int paged = 0;
+    const char *p = payload;
+    while (*p == '|') {
+        ++p;
+        const char *end = p + strcspn(p, "|\r\n");
+        char *num_end = NULL;
+        if (strncmp(p, "after=", 6) == 0) {
+            unsigned long v = strtoul(p + 6, &num_end, 10);
+            if (num_end == p + 6 || num_end != end || v > INT_MAX) return -1;
+            page->after = (uint32_t)v;
+        } else if (strncmp(p, "limit=", 6) == 0) {
+            long v = strtol(p + 6, &num_end, 10);
+            if (num_end == p + 6 || num_end != end || v <= 0) return -1;
+            page->limit = v > PAGE_MAX_LIMIT ? PAGE_MAX_LIMIT : (int)v;
+        } else {
+            return -1;
+        }
+        paged = 1;
+        p = end;
+    }
+    if (*p != '\0' && *p != '\r' && *p != '\n') return -1;
+    return paged;
+}
+
+/**
+ * @typedef list_reply_t: A LIST_* reply written from the db_scan_* callbacks straight
+ * into the session's output buffer, a chunk at a time, so a listing of any length
+ * needs neither a row array nor a reply-sized buffer.
+ * Fields:
+ *  - session: receiving session
+ *  - header: status line format, taking the row count
+ *  - paged: the listing is a page, so the reply carries the next cursor
+ *  - begun: the status line has been written
+ *  - more: another page follows
+ *  - rows: rows written
+ *  - last_key: key of the last row written (the next page's cursor)
+ *  - failed: a chunk could not be queued on the session
+ *  - cache_list/cache_page/cache_version: reply cache key the reply is stored under
+ *    once complete (cache_list -1 if it is not cached)
+ *  - capture/captured/capture_cap: copy of the text sent so far, for the reply cache
+ *  - len/chunk: text not yet handed to the session
+ */
+typedef struct list_reply {
+    client_session_t *session;
+    const char *header;
+    int paged;
+    int begun;
+    int more;
+    int rows;
+    uint32_t last_key;
+    int failed;
+    int cache_list;
+    const db_page_t *cache_page;
+    uint32_t cache_version;
+    char *capture;
+    size_t captured;
+    size_t capture_cap;
+    size_t len;
+    char chunk[LIST_CHUNK_SIZE];
+} list_reply_t;
+
+static void list_reply_init(list_reply_t *reply, client_session_t *session, const char *header, int paged) {
+    reply->session = session;
+    reply->header = header;
+    reply->paged = paged;
+    reply->begun = 0;
+    reply->more = 0;
+    reply->rows = 0;
+    reply->last_key = 0;
+    reply->failed = 0;
+    reply->cache_list = -1;
+    reply->cache_page = NULL;
+    reply->cache_version = 0;
+    reply->capture = NULL;
+    reply->captured = 0;
+    reply->capture_cap = 0;
+    reply->len = 0;
+    reply->chunk[0] = '\0';
+}
+
+// Keep a copy of the pending chunk for the reply cache; a reply that outgrows a cache
+// entry is sent without being kept
+static void list_capture(list_reply_t *reply) {
+    size_t need = reply->captured + reply->len;
+    size_t max = reply_cache_max_entry();
+    if (need > reply->capture_cap && need <= max) {
+        size_t cap = reply->capture_cap ? reply->capture_cap * 2 : LIST_CHUNK_SIZE;
+        while (cap < need) cap *= 2;
+        if (cap > max) cap = max;
+        char *grown = realloc(reply->capture, cap);
+        if (grown) {
+            reply->capture = grown;
+            reply->capture_cap = cap;
+        }
+    }
+    if (need > reply->capture_cap) {
+        free(reply->capture);
+        reply->capture = NULL;
+        reply->cache_list = -1;
+        return;
+    }
+    memcpy(reply->capture + reply->captured, reply->chunk, reply->len);
+    reply->captured = need;
+}
+
+/*
+ * Answer a listing from the reply cache when it holds the current version. On a miss
+ * the reply is set up to be captured and stored by list_finish().
+ * Returns 1 if the cached reply was sent.
+ */
+static int list_from_cache(list_reply_t *reply, reply_list_t list, const db_page_t *page) {
+    uint32_t version = 0;
+    reply_entry_t *entry = reply_cache_get(reply->session->user_id, list, page, &version);
+    if (entry) {
+        send_reply(reply->session, reply_entry_data(entry));
+        reply_cache_release(entry);
+        return 1;
+    }
+    if (reply_cache_max_entry() > 0) {
+        reply->cache_list = (int)list;
+        reply->cache_page = page;
+        reply->cache_version = version;
+    }
+    return 0;
+}
+
+static int list_flush(list_reply_t *reply) {
+    if (reply->len == 0 || reply->failed) return reply->failed ? -1 : 0;
+    if (reply->cache_list >= 0) list_capture(reply);
+    if (send_reply(reply->session, reply->chunk) < 0) reply->failed = 1;
+    reply->len = 0;
+    reply->chunk[0] = '\0';
+    return reply->failed ? -1 : 0;
+}
+
+// Append one formatted line, handing the chunk to the session first if it is full
+static int list_printf(list_reply_t *reply, const char *fmt, ...) {
+    if (reply->failed) return -1;
+    for (;;) {
+        size_t room = sizeof(reply->chunk) - reply->len;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(reply->chunk + reply->len, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return -1;
+        if ((size_t)n < room || reply->len == 0) {
+            // A line longer than a whole chunk (not possible with current field sizes) is cut
+            reply->len += (size_t)n < room ? (size_t)n : room - 1;
+            return 0;
+        }
+        reply->chunk[reply->len] = '\0';
+        if (list_flush(reply) != 0) return -1;
+    }
+}
+
+static int list_begin(void *ctx, int count, int more) {
+    list_reply_t *reply = ctx;
+    reply->begun = 1;
+    reply->more = more;
+    return list_printf(reply, reply->header, count);
+}
+
+/*
+ * Run a database-backed scan into the reply. Its connection stays locked until the
+ * scan returns, so meanwhile full chunks are written only as far as the socket takes
+ * them without blocking; the rest goes out once the connection is released.
+ */
+static int list_scan_db(list_reply_t *reply, int (*scan)(uint32_t, const db_page_t *, const db_sink_t *),
+                        const db_page_t *page, const db_sink_t *sink) {
+    session_begin_nowait(reply->session);
+    int rc = scan(reply->session->user_id, page, sink);
+    if (session_end_nowait(reply->session) != 0) reply->failed = 1;
+    return rc;
+}
+
+// Close the reply: the next cursor when a page has a successor, then END. A scan
+// that failed before the status line went out gets a 500 instead. A complete reply
+// being captured goes to the reply cache.
+static void list_finish(list_reply_t *reply, int rc) {
+    if (!reply->begun) {
+        send_reply(reply->session, "500 Internal server error\r\n");
+        free(reply->capture);
+        return;
+    }
+    if (rc != 0) LOG_WARN("Listing cut short by a database error after %d rows", reply->rows);
+    if (reply->paged && reply->more) list_printf(reply, "NEXT|%u\r\n", reply->last_key);
+    list_printf(reply, "END\r\n");
+    list_flush(reply);
+    if (rc == 0 && !reply->failed && reply->cache_list >= 0) {
+        reply_cache_put(reply->session->user_id, (reply_list_t)reply->cache_list, reply->cache_page,
+                        reply->cache_version, reply->capture, reply->captured);
+    }
+    free(reply->capture);
+}
+
+static int favorite_row(void *ctx, const void *row) {
+    list_reply_t *reply = ctx;
+    const FavoritePlace *fav = row;
+    reply->rows++;
+    reply->last_key = (uint32_t)fav->id;
+    return list_printf(reply, "%d|%s|%s|%s|%s|%ld\r\n",
+                       fav->id, fav->owner, fav->name, fav->category, fav->location,
+                       (long)fav->created_at);
+}
+
+static int tagged_row(void *ctx, const void *row) {
+    list_reply_t *reply = ctx;
+    const FavoritePlaceWithTags *fav = row;
+    reply->rows++;
+    reply->last_key = (uint32_t)fav->id;
+    return list_printf(reply, "%d|%s|%s|%s|%s|%ld|%s\r\n",
+                       fav->id, fav->owner, fav->name, fav->category, fav->location,
+                       (long)fav->created_at, fav->tagger);
+}
+
+static int friend_row(void *ctx, const void *row) {
+    list_reply_t *reply = ctx;
+    const FriendRel *rel = row;
+    reply->rows++;
+    // Friend pages are keyed on the friend's user id
+    reply->last_key = rel->user_a_id == reply->session->user_id ? rel->user_b_id : rel->user_a_id;
+    return list_printf(reply, "%s|%s|%ld\r\n", rel->user_a, rel->user_b, (long)rel->since);
+}
+
+static int request_row(void *ctx, const void *row) {
+    list_reply_t *reply = ctx;
+    const FriendRequest *request = row;
+    reply->rows++;
+    reply->last_key = (uint32_t)request->id;
+    return list_printf(reply, "%d|%s|%s|%d|%ld\r\n",
+                       request->id, request->from, request->to, request->status,
+                       (long)request->created_at);
+}
+
+static int notification_row(void *ctx, const void *row) {
+    list_reply_t *reply = ctx;
+    const Notification *note = row;
+    reply->rows++;
+    reply->last_key = (uint32_t)note->id;
+    return list_printf(reply, "%d|%s|%d|%s|%d|%ld\r\n",
+                       note->id, note->from, note->fav_id, note->message, note->seen,
+                       (long)note->created_at);
+}
+
+// WATCH topic names, indexed by notify_kind_t
+static const char *const watch_topics[NOTIFY_KINDS] = { "requests", "friends", "tags" };
+
+/**
+ * @typedef watch_reply_t: A WATCH delta: notifications after since_version, filtered
+ * to the watched topics.
+ * Fields:
+ *  - list: the reply itself; first member, so list_begin() can take the whole struct
+ *  - topics: bit per notify_kind_t
+ *  - scanned: id of the last notification read, matching or not
+ */
+typedef struct watch_reply {
+    list_reply_t list;
+    unsigned int topics;
+    uint32_t scanned;
+} watch_reply_t;
+
+static int watch_row(void *ctx, const void *row) {
+    watch_reply_t *watch = ctx;
+    const Notification *note = row;
+    watch->scanned = (uint32_t)note->id;
+    if (note->kind < 0 || note->kind >= NOTIFY_KINDS || !(watch->topics & (1u << note->kind))) return 0;
+    watch->list.rows++;
+    watch->list.last_key = (uint32_t)note->id;
+    return list_printf(&watch->list, "%d|%s|%s|%d|%s|%ld\r\n",
+                       note->id, watch_topics[note->kind], note->from, note->fav_id, note->message,
+                       (long)note->created_at);
 }
 
 void dispatch_command(client_session_t *session, const char *command) {
     if (!session || !command) {
         return;
     }
+    session->cur_opcode = binlog_opcode_of(command);
     if (strncmp(command, "LOGIN|", 6) == 0) {
         handle_login(session, command + 6);
     } else if (strncmp(command, "REGISTER|", 9) == 0) {
@@ -46,26 +349,30 @@ void dispatch_command(client_session_t *session, const char *command) {
     } else if (strncmp(command, "EDIT_FAVORITE|", 13) == 0 ){
         handle_edit_favorite(session, command + 13);
     } else if (strncmp(command, "LIST_TAGGED_FAVORITES", 21) == 0 ){
-        handle_list_tagged_favorites(session);
+        handle_list_tagged_favorites(session, command + 21);
     } else if(strncmp(command, "LIST_FRIEND_REQUESTS", 20) == 0 ){
-        handle_list_friend_requests(session);
+        handle_list_friend_requests(session, command + 20);
     }
     else if (strncmp(command, "ADD_FRIEND|", 11) == 0 ){
         handle_add_friend(session, command + 11);
     } else if (strncmp(command, "LIST_FRIENDS", 12) == 0 ){
-        handle_list_friends(session);
+        handle_list_friends(session, command + 12);
     } else if (strncmp(command, "ACCEPT_FRIEND|", 14) == 0 ){
         handle_accept_friend(session, command + 14);
     } else if (strncmp(command, "LIST_REQUESTS", 13) == 0 ){
-        handle_list_friend_requests(session);
+        handle_list_friend_requests(session, command + 13);
     } else if (strncmp(command, "REJECT_FRIEND|", 14) == 0 ){
         handle_reject_friend(session, command + 14);
     } else if (strncmp(command, "REMOVE_FRIEND|", 14) == 0 ){
         handle_remove_friend(session, command + 14);
     } else if (strncmp(command, "TAG_FRIEND|", 11) == 0 ){
         handle_tag_friend(session, command + 11);
-    } else if (strncmp(command, "LIST_NOTIFICATIONS", 19) == 0){
-        handle_not_implemented(session);
+    } else if (strncmp(command, "LIST_NOTIFICATIONS", 18) == 0){
+        handle_list_notifications(session, command + 18);
+    } else if (strncmp(command, "SEEN_NOTIFICATION|", 18) == 0){
+        handle_seen_notification(session, command + 18);
+    } else if (strncmp(command, "WATCH|", 6) == 0){
+        handle_watch(session, command + 6);
     } else {
         send_bad_request(session, "Unknown command");
     }
@@ -76,166 +383,165 @@ static void handle_login(client_session_t *session, const char *payload) {
     char username[MAX_NAME_LEN];
     char password[MAX_PASS_LEN];
     if(session->logged_in){
-        printf("402 Already logged in\n");
-        send_request(session->sockfd, "406 Already logged in\r\n");
+        LOG_DEBUG("402 Already logged in");
+        send_reply(session, "406 Already logged in\r\n");
         return;
     }
 
     if (!payload || sscanf(payload, "%63[^|]|%127[^\r\n]", username, password) != 2) {
-        printf("Invalid LOGIN format\n");
+        LOG_DEBUG("Invalid LOGIN format");
         send_bad_request(session, "Invalid LOGIN format");
         return;
     }
 
     Account acc;
-    if (get_account(username, &acc) != 0) {
-        printf("Account not found\n");
-        send_request(session->sockfd, "401 Invalid username or password\r\n");
+    int found = get_account(username, &acc);
+    if (found == -1) {
+        LOG_DEBUG("Account lookup failed");
+        send_reply(session, "500 Internal server error\r\n");
+        return;
+    }
+    if (found != 0) {
+        LOG_DEBUG("Account not found");
+        send_reply(session, "401 Invalid username or password\r\n");
         return;
     }
 
-    if (acc.is_logged_in) {
-        printf("Account already logged in\n");
-        send_request(session->sockfd, "411 Account already logged in by another user\r\n");
+    if (presence_is_online(username)) {
+        LOG_DEBUG("Account already logged in");
+        send_reply(session, "411 Account already logged in by another user\r\n");
         return;
     }
 
     if (strcmp(acc.password, password) != 0) {
-        printf("Invalid password\n");
-        send_request(session->sockfd, "401 Invalid username or password\r\n");
+        LOG_DEBUG("Invalid password");
+        send_reply(session, "401 Invalid username or password\r\n");
         return;
     }
 
-    db_update_logged_in_status(username, 1);
+    int rc = presence_claim(session, username);
+    if (rc == -2) {
+        LOG_DEBUG("Account already logged in");
+        send_reply(session, "411 Account already logged in by another user\r\n");
+        return;
+    } else if (rc != 0) {
+        LOG_DEBUG("Online registry full");
+        send_reply(session, "503 Server busy\r\n");
+        return;
+    }
     session->logged_in = 1;
+    session->user_id = acc.id;
     strncpy(session->username, username, sizeof(session->username) - 1);
     session->username[sizeof(session->username) - 1] = '\0';
+    activity_log_meta(session->id, BINLOG_LOGIN, session->username);
 
-    printf("Login successful\n");
-    send_request(session->sockfd, "200 Login successful\r\n");
+    LOG_DEBUG("Login successful");
+    send_reply(session, "200 Login successful\r\n");
 }
 
 
 static void handle_logout(client_session_t *session) {
     if (!session->logged_in) {
-        printf("Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
-    db_update_logged_in_status(session->username, 0);
+    presence_release(session);
     session->logged_in = 0;
+    session->user_id = 0;
     session->username[0] = '\0';
 
-    printf("Logout successful\n");
-    send_request(session->sockfd, "200 Logout successful\r\n");
+    LOG_DEBUG("Logout successful");
+    send_reply(session, "200 Logout successful\r\n");
 }
 
 static void handle_register(client_session_t *session, const char *payload) {
     char username[MAX_NAME_LEN];
     char password[MAX_PASS_LEN];
     if(session->logged_in){
-        printf("Already logged in\n");
-        send_request(session->sockfd, "406 Already logged in\r\n");
+        LOG_DEBUG("Already logged in");
+        send_reply(session, "406 Already logged in\r\n");
         return;
     }
 
     if (!payload || sscanf(payload, "%63[^|]|%127[^\r\n]", username, password) != 2) {
-        printf("Invalid REGISTER format\n");
+        LOG_DEBUG("Invalid REGISTER format");
         send_bad_request(session, "Invalid REGISTER format");
         return;
     }
 
     int result = create_account(username, password);
     if (result == 0) {
-        printf("Register successful\n");
-        send_request(session->sockfd, "200 Register successful\r\n");
+        LOG_DEBUG("Register successful");
+        send_reply(session, "200 Register successful\r\n");
     } else if (result == -2) {
-        printf("Username already exists\n");
-        send_request(session->sockfd, "404 Username already exists\r\n");
+        LOG_DEBUG("Username already exists");
+        send_reply(session, "404 Username already exists\r\n");
     } else if (result == -1) {
-        printf("Server full, cannot register\n");
-        send_request(session->sockfd, "500 Server full, cannot register\r\n");
+        LOG_DEBUG("Server full, cannot register");
+        send_reply(session, "500 Server full, cannot register\r\n");
     } else {
-        printf("Internal server error during registration\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("Internal server error during registration");
+        send_reply(session, "500 Internal server error\r\n");
     }
 }
 
 // FAVORITE COMMAND HANDLERS
 static void handle_add_favorite(client_session_t *session, const char *payload) {
-    char owner[MAX_NAME_LEN];
     char name[MAX_TITLE_LEN];
     char category[MAX_CAT_LEN];
     char location[MAX_DESC_LEN];
 
     if(!session->logged_in){
-        printf("[ADD_FAVORITE] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[ADD_FAVORITE] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     if (!payload || sscanf(payload, "%127[^|]|%63[^|]|%255[^\r\n]", name, category, location) != 3) {
-        printf("[ADD_FAVORITE] Failed - Invalid format\n");
+        LOG_DEBUG("[ADD_FAVORITE] Failed - Invalid format");
         send_bad_request(session, "Invalid ADD_FAVORITE format");
         return;
     }
 
-    int result = create_favorite(session->username, name, category, location);
+    int result = create_favorite(session->user_id, name, category, location);
     if (result == 0) {
-        printf("[ADD_FAVORITE] Success - owner:%s, name:%s, category:%s\n", session->username, name, category);
-        send_request(session->sockfd, "200 Favorite added successfully\r\n");
+        LOG_DEBUG("[ADD_FAVORITE] Success - owner:%s, name:%s, category:%s", session->username, name, category);
+        send_reply(session, "200 Favorite added successfully\r\n");
     } else if (result == -1) {
-        printf("[ADD_FAVORITE] Failed - Internal server error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[ADD_FAVORITE] Failed - Internal server error");
+        send_reply(session, "500 Internal server error\r\n");
     } else if (result == -2) {
-        printf("[ADD_FAVORITE] Failed - User not found: %s\n", owner);
-        send_request(session->sockfd, "404 User not found\r\n");
+        LOG_DEBUG("[ADD_FAVORITE] Failed - User not found: %s", session->username);
+        send_reply(session, "404 User not found\r\n");
     }
 }
 
 static void handle_list_favorites(client_session_t *session, const char *payload) {
-    (void)payload;
     if (!session->logged_in) {
-        printf("[LIST_FAVORITES] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[LIST_FAVORITES] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
-    FavoritePlace favs[MAX_FAVS];
-    int fav_count = 0;
-    int rc = get_user_favorites(session->username, favs, MAX_FAVS, &fav_count);
-    if (rc == -2) {
-        printf("[LIST_FAVORITES] Failed - User not found\n");
-        send_request(session->sockfd, "404 User not found\r\n");
+    db_page_t page;
+    int paged = parse_page_args(payload, &page);
+    if (paged < 0) {
+        LOG_DEBUG("[LIST_FAVORITES] Failed - Invalid format");
+        send_bad_request(session, "Invalid LIST_FAVORITES format");
         return;
-    } else if (rc == -1) {
-        printf("[LIST_FAVORITES] Failed - Internal error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
-        return;
-    }
-
-    printf("[LIST_FAVORITES] Found %d favorites\n", fav_count);
-    char buff[8192];
-    int offset = snprintf(buff, sizeof(buff), "200 %d favorites found\r\n", fav_count);
-    for (int i = 0; i < fav_count; ++i) {
-        offset += snprintf(buff + offset, sizeof(buff) - offset,
-                           "%d|%s|%s|%s|%s|%ld\r\n",
-                           favs[i].id,
-                           favs[i].owner,
-                           favs[i].name,
-                           favs[i].category,
-                           favs[i].location,
-                           (long)favs[i].created_at);
-        if (offset >= (int)sizeof(buff)) {
-            break;
-        }
     }
-    offset += snprintf(buff + offset, sizeof(buff) - offset,
-                   "END\r\n");
-
-    printf("[LIST_FAVORITES] Sending response %s\n", buff);
 
-    send_request(session->sockfd, buff);
+    list_reply_t reply;
+    list_reply_init(&reply, session, "200 %d favorites found\r\n", paged);
+    if (list_from_cache(&reply, REPLY_LIST_FAVORITES, paged ? &page : NULL)) {
+        LOG_DEBUG("[LIST_FAVORITES] Sent cached reply");
+        return;
+    }
+    db_sink_t sink = { list_begin, favorite_row, &reply };
+    int rc = list_scan_db(&reply, scan_user_favorites, paged ? &page : NULL, &sink);
+    LOG_DEBUG("[LIST_FAVORITES] Sent %d rows", reply.rows);
+    list_finish(&reply, rc);
 }
 
 
@@ -247,30 +553,34 @@ static void handle_edit_favorite(client_session_t *session, const char *payload)
     char location[MAX_DESC_LEN];
 
     if (!session->logged_in) {
-        printf("[EDIT_FAVORITE] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[EDIT_FAVORITE] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     if (!payload || sscanf(payload, "%d|%63[^|]|%127[^|]|%63[^|]|%255[^\r\n]", &fav_id, owner, name, category, location) != 5) {
-        printf("[EDIT_FAVORITE] Failed - Invalid format\n");
+        LOG_DEBUG("[EDIT_FAVORITE] Failed - Invalid format");
         send_bad_request(session, "Invalid EDIT_FAVORITE format");
         return;
     }
 
-    int rc = update_favorite(fav_id, owner, name, category, location);
+    // An owner that does not exist cannot own the favorite either: nothing to change
+    uint32_t owner_id = 0;
+    int rc = get_user_id(owner, &owner_id);
+    if (rc == 0) rc = update_favorite(fav_id, owner_id, name, category, location);
+    else if (rc == -2) rc = -3;
     if (rc == 0) {
-        printf("[EDIT_FAVORITE] Success - fav_id:%d, user:%s\n", fav_id, session->username);
-        send_request(session->sockfd, "200 Favorite updated successfully\r\n");
+        LOG_DEBUG("[EDIT_FAVORITE] Success - fav_id:%d, user:%s", fav_id, session->username);
+        send_reply(session, "200 Favorite updated successfully\r\n");
     } else if (rc == -2) {
-        printf("[EDIT_FAVORITE] Failed - Favorite not found: %d\n", fav_id);
-        send_request(session->sockfd, "406 Favorite not exist\r\n");
+        LOG_DEBUG("[EDIT_FAVORITE] Failed - Favorite not found: %d", fav_id);
+        send_reply(session, "406 Favorite not exist\r\n");
     } else if (rc == -1) {
-        printf("[EDIT_FAVORITE] Failed - Internal server error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[EDIT_FAVORITE] Failed - Internal server error");
+        send_reply(session, "500 Internal server error\r\n");
     } else if (rc == -3) {
-        printf("[EDIT_FAVORITE] Failed - No changes made\n");
-        send_request(session->sockfd, "407 No changes made to favorite\r\n");
+        LOG_DEBUG("[EDIT_FAVORITE] Failed - No changes made");
+        send_reply(session, "407 No changes made to favorite\r\n");
     }
 }
 
@@ -278,385 +588,497 @@ static void handle_delete_favorite(client_session_t *session, const char *payloa
     int fav_id = 0;
 
     if (!session->logged_in) {
-        printf("[DEL_FAVORITE] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[DEL_FAVORITE] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     if (!payload || sscanf(payload, "%d[^\r\n]", &fav_id) != 1) {
-        printf("[DEL_FAVORITE] Failed - Invalid format\n");
+        LOG_DEBUG("[DEL_FAVORITE] Failed - Invalid format");
         send_bad_request(session, "Invalid DEL_FAVORITE format");
         return;
     }
 
-    int rc = delete_favorite(fav_id, session->username);
+    int rc = delete_favorite(fav_id, session->user_id);
     if (rc == 0) {
-        printf("[DEL_FAVORITE] Success - fav_id:%d, user:%s\n", fav_id, session->username);
-        send_request(session->sockfd, "200 Favorite deleted successfully\r\n");
+        LOG_DEBUG("[DEL_FAVORITE] Success - fav_id:%d, user:%s", fav_id, session->username);
+        send_reply(session, "200 Favorite deleted successfully\r\n");
     } else if (rc == -2) {
-        printf("[DEL_FAVORITE] Failed - Favorite not found: %d\n", fav_id);
-        send_request(session->sockfd, "406 Favorite not exist\r\n");
+        LOG_DEBUG("[DEL_FAVORITE] Failed - Favorite not found: %d", fav_id);
+        send_reply(session, "406 Favorite not exist\r\n");
     } else if (rc == -1) {
-        printf("[DEL_FAVORITE] Failed - Internal server error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[DEL_FAVORITE] Failed - Internal server error");
+        send_reply(session, "500 Internal server error\r\n");
     } 
 }
 
-static void handle_list_tagged_favorites(client_session_t *session) {
+static void handle_list_tagged_favorites(client_session_t *session, const char *payload) {
     if (!session->logged_in) {
-        printf("[LIST_TAGGED_FAVORITES] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[LIST_TAGGED_FAVORITES] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
-    FavoritePlaceWithTags favs[MAX_FAVS];
-    int fav_count = 0;
-    int rc = get_tagged_favorites(session->username, favs, MAX_FAVS, &fav_count);
-    if (rc == -2) {
-        printf("[LIST_TAGGED_FAVORITES] Failed - User not found\n");
-        send_request(session->sockfd, "406 User not exist\r\n");
+    db_page_t page;
+    int paged = parse_page_args(payload, &page);
+    if (paged < 0) {
+        LOG_DEBUG("[LIST_TAGGED_FAVORITES] Failed - Invalid format");
+        send_bad_request(session, "Invalid LIST_TAGGED_FAVORITES format");
+        return;
+    }
+
+    list_reply_t reply;
+    list_reply_init(&reply, session, "200 %d favorites found\r\n", paged);
+    if (list_from_cache(&reply, REPLY_LIST_TAGGED, paged ? &page : NULL)) {
+        LOG_DEBUG("[LIST_TAGGED_FAVORITES] Sent cached reply");
         return;
-    } else if (rc == -1) {
-        printf("[LIST_TAGGED_FAVORITES] Failed - Internal server error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
-        return;
-    }
-
-    char buff[8192];
-    int offset = snprintf(buff, sizeof(buff), "200 %d favorites found\r\n", fav_count);
-    for (int i = 0; i < fav_count; ++i) {
-        offset += snprintf(buff + offset, sizeof(buff) - offset,
-                           "%d|%s|%s|%s|%s|%ld|%s\r\n",
-                           favs[i].id,
-                           favs[i].owner,
-                           favs[i].name,
-                           favs[i].category,
-                           favs[i].location,
-                           (long)favs[i].created_at,
-                           favs[i].tagger);
-        if (offset >= (int)sizeof(buff)) {
-            break;
-        }
     }
-    offset += snprintf(buff + offset, sizeof(buff) - offset,
-                   "END\r\n");
-    printf("[LIST_TAGGED_FAVORITES] Sending response %s\n", buff);
-    send_request(session->sockfd, buff);
+    db_sink_t sink = { list_begin, tagged_row, &reply };
+    int rc = list_scan_db(&reply, scan_tagged_favorites, paged ? &page : NULL, &sink);
+    LOG_DEBUG("[LIST_TAGGED_FAVORITES] Sent %d rows", reply.rows);
+    list_finish(&reply, rc);
 }
 // FRIEND COMMAND HANDLERS
 static void handle_add_friend(client_session_t *session, const char *payload) {
     if (!session->logged_in) {
-        printf("[ADD_FRIEND] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[ADD_FRIEND] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     char target[MAX_NAME_LEN];
     if (!payload || sscanf(payload, "%63[^\r\n]", target) != 1) {
-        printf("[ADD_FRIEND] Failed - Invalid format\n");
+        LOG_DEBUG("[ADD_FRIEND] Failed - Invalid format");
         send_bad_request(session, "Invalid ADD_FRIEND format");
         return;
     }
 
     if (strcmp(target, session->username) == 0) {
-        printf("[ADD_FRIEND] Failed - Cannot friend yourself\n");
+        LOG_DEBUG("[ADD_FRIEND] Failed - Cannot friend yourself");
         send_bad_request(session, "Cannot friend yourself");
         return;
     }
 
-    Account target_acc;
-    if (get_account(target, &target_acc) != 0) {
-        printf("[ADD_FRIEND] Failed - User not found: %s\n", target);
-        send_request(session->sockfd, "406 User not exist\r\n");
+    uint32_t target_id = 0;
+    int rc = send_friend_request(session->user_id, target, &target_id);
+    if (rc == -2) {
+        LOG_DEBUG("[ADD_FRIEND] Failed - User not found: %s", target);
+        send_reply(session, "406 User not exist\r\n");
         return;
-    }
-
-    if(check_friendship(session->username, target) == 1 ) {
-        printf("[ADD_FRIEND] Failed - Already friends\n");
-        send_request(session->sockfd, "407 Already friends\r\n");
+    } else if (rc == -3) {
+        LOG_DEBUG("[ADD_FRIEND] Failed - Already friends");
+        send_reply(session, "407 Already friends\r\n");
         return;
-    }
-
-    if(db_check_duplicate_friend_request(session->username, target) == 1){
-        printf("[ADD_FRIEND] Failed - Friend request already sent\n");
-        send_request(session->sockfd, "409 Friend request already sent\r\n");
+    } else if (rc == -4) {
+        LOG_DEBUG("[ADD_FRIEND] Failed - Friend request already sent");
+        send_reply(session, "409 Friend request already sent\r\n");
         return;
-    }
-
-    int rc = create_friend_request(session->username, target);
-    if (rc != 0) {
-        printf("[ADD_FRIEND] Failed - Create request error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+    } else if (rc == -5) {
+        LOG_DEBUG("[ADD_FRIEND] Failed - Cannot friend yourself");
+        send_bad_request(session, "Cannot friend yourself");
+        return;
+    } else if (rc != 0) {
+        LOG_DEBUG("[ADD_FRIEND] Failed - Create request error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
-    printf("[ADD_FRIEND] Success - friend request sent to: %s\n", target);
-    send_request(session->sockfd, "200 Friend request sent\r\n");
+    LOG_DEBUG("[ADD_FRIEND] Success - friend request sent to: %s", target);
+    send_reply(session, "200 Friend request sent\r\n");
+    create_notification(target_id, session->user_id, NOTIFY_FRIEND_REQUEST, 0);
 }
 
 static void handle_accept_friend(client_session_t *session, const char *payload) {
     if (!session->logged_in) {
-        printf("[ACCEPT_FRIEND] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     int request_id = 0;
     if (!payload || sscanf(payload, "%d", &request_id) != 1 || request_id <= 0) {
-        printf("[ACCEPT_FRIEND] Failed - Invalid format\n");
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Invalid format");
         send_bad_request(session, "Invalid ACCEPT_FRIEND format");
         return;
     }
 
     FriendRequest request;
-    int rc = get_friend_request_by_id(request_id, session->username, &request);
+    int rc = get_friend_request_by_id(request_id, session->user_id, &request);
     if (rc == -2) {
-        printf("[ACCEPT_FRIEND] Failed - Request not found: %d\n", request_id);
-        send_request(session->sockfd, "406 Request not exist\r\n");
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Request not found: %d", request_id);
+        send_reply(session, "406 Request not exist\r\n");
         return;
     } else if (rc != 0) {
-        printf("[ACCEPT_FRIEND] Failed - Fetch request error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Fetch request error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
 
-    printf("Request to: %s, session user: %s\n", request.to, session->username);
-    if (strcmp(request.to, session->username) != 0) {
-        printf("[ACCEPT_FRIEND] Failed - Not authorized\n");
-        send_request(session->sockfd, "403 Not authorized to accept this request\r\n");
+    LOG_DEBUG("Request to: %s, session user: %s", request.to, session->username);
+    if (request.to_id != session->user_id) {
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Not authorized");
+        send_reply(session, "403 Not authorized to accept this request\r\n");
         return;
     }
 
     if (request.status != 0) {
-        printf("[ACCEPT_FRIEND] Failed - Request already accepted\n");
-        send_request(session->sockfd, "409 Accept request already sent\r\n");
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Request already accepted");
+        send_reply(session, "409 Accept request already sent\r\n");
         return;
     }
 
-    rc = accept_friend_request(request_id, session->username);;
+    rc = accept_friend_request(request_id, session->user_id);
     if (rc != 0) {
-        printf("[ACCEPT_FRIEND] Failed - Accept error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[ACCEPT_FRIEND] Failed - Accept error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
 
-    printf("[ACCEPT_FRIEND] Success - request_id:%d\n", request_id);
-    send_request(session->sockfd, "200 Accept friend successful\r\n");
+    LOG_DEBUG("[ACCEPT_FRIEND] Success - request_id:%d", request_id);
+    send_reply(session, "200 Accept friend successful\r\n");
+    create_notification(request.from_id, session->user_id, NOTIFY_FRIEND_ACCEPTED, 0);
 }
 
 static void handle_tag_friend(client_session_t *session, const char *payload) {
     if (!session->logged_in) {
-        printf("[TAG_FRIEND] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[TAG_FRIEND] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     int fav_id = 0;
     char tagged_user[MAX_TAGGED_LEN];
-    printf("Payload: %s\n", payload);
+    LOG_TRACE("Payload: %s", payload);
     if (!payload || sscanf(payload, "%d|%63[^\r\n]", &fav_id, tagged_user) != 2) {
-        printf("[TAG_FRIEND] Failed - Invalid format\n");
+        LOG_DEBUG("[TAG_FRIEND] Failed - Invalid format");
         send_bad_request(session, "Invalid TAG_FRIEND format");
         return;
     }
     
-    FavoritePlace fav;
-    if(get_favorite_by_id(fav_id,session->username ,&fav) != 0){
-        printf("[TAG_FRIEND] Failed - Favorite not found: %d\n", fav_id);
-        send_request(session->sockfd, "406 Favorite not exist\r\n");
+    uint32_t tagged_id = 0;
+    int rc = tag_favorite(fav_id, session->user_id, tagged_user, &tagged_id);
+    if (rc == -2) {
+        LOG_DEBUG("[TAG_FRIEND] Failed - Favorite not found: %d", fav_id);
+        send_reply(session, "406 Favorite not exist\r\n");
         return;
-    }
-    Account acc;
-    if(get_account(tagged_user, &acc) != 0){
-        printf("[TAG_FRIEND] Failed - User not found: %s\n", tagged_user);
-        send_request(session->sockfd, "406 User not exist\r\n");
+    } else if (rc == -3) {
+        LOG_DEBUG("[TAG_FRIEND] Failed - User not found: %s", tagged_user);
+        send_reply(session, "406 User not exist\r\n");
         return;
-    }
-
-    if(check_friendship(session->username, tagged_user) != 1 ) {
-        printf("[TAG_FRIEND] Failed - Not friends with user: %s\n", tagged_user);
-        send_request(session->sockfd, "410 Not friends with the user\r\n");
+    } else if (rc == -4) {
+        LOG_DEBUG("[TAG_FRIEND] Failed - Not friends with user: %s", tagged_user);
+        send_reply(session, "410 Not friends with the user\r\n");
         return;
-    }
-
-    int rc = tag_favorite(fav_id, session->username, tagged_user);
-    if (rc == -2) {
-        printf("[TAG_FRIEND] Failed - Favorite not found: %d\n", fav_id);
-        send_request(session->sockfd, "411 You already tagged them to this place\r\n");
+    } else if (rc == -5) {
+        LOG_DEBUG("[TAG_FRIEND] Failed - Already tagged: %s", tagged_user);
+        send_reply(session, "411 You already tagged them to this place\r\n");
         return;
     } else if (rc != 0) {
-        printf("[TAG_FRIEND] Failed - Tag error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[TAG_FRIEND] Failed - Tag error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
 
-    printf("[TAG_FRIEND] Success - fav_id:%d, user:%s\n", fav_id, tagged_user);
-    send_request(session->sockfd, "200 Tag friend successful\r\n");
+    LOG_DEBUG("[TAG_FRIEND] Success - fav_id:%d, user:%s", fav_id, tagged_user);
+    send_reply(session, "200 Tag friend successful\r\n");
+    create_notification(tagged_id, session->user_id, NOTIFY_TAGGED, fav_id);
 }
 
 
 static void handle_reject_friend(client_session_t *session, const char *payload) {
     if (!session->logged_in) {
-        printf("[REJECT_FRIEND] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     int request_id = 0;
     if (!payload || sscanf(payload, "%d", &request_id) != 1 || request_id <= 0) {
-        printf("[REJECT_FRIEND] Failed - Invalid format\n");
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Invalid format");
         send_bad_request(session, "Invalid REJECT_FRIEND format");
         return;
     }
 
     FriendRequest request;
-    int rc = get_friend_request_by_id(request_id,session->username ,&request);
+    int rc = get_friend_request_by_id(request_id, session->user_id, &request);
     if (rc == -2) {
-        printf("[REJECT_FRIEND] Failed - Request not found: %d\n", request_id);
-        send_request(session->sockfd, "406 Request not exist\r\n");
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Request not found: %d", request_id);
+        send_reply(session, "406 Request not exist\r\n");
         return;
     } else if (rc != 0) {
-        printf("[REJECT_FRIEND] Failed - Fetch request error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Fetch request error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
     
-    if (strcmp(request.to, session->username) != 0) {
-        printf("[REJECT_FRIEND] Failed - Not authorized\n");
-        send_request(session->sockfd, "403 Not authorized to reject this request\r\n");
+    if (request.to_id != session->user_id) {
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Not authorized");
+        send_reply(session, "403 Not authorized to reject this request\r\n");
         return;
     }
 
     if (request.status != 0) {
-        printf("[REJECT_FRIEND] Failed - Request already processed\n");
-        send_request(session->sockfd, "409 reject request already sent\r\n");
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Request already processed");
+        send_reply(session, "409 reject request already sent\r\n");
         return;
     }
 
-    rc = reject_friend_request(request_id, session->username);;
+    rc = reject_friend_request(request_id, session->user_id);
     if (rc != 0) {
-        printf("[REJECT_FRIEND] Failed - Reject error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[REJECT_FRIEND] Failed - Reject error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
 
-    printf("[REJECT_FRIEND] Success - request_id:%d\n", request_id);
-    send_request(session->sockfd, "200 Reject friend successful\r\n");
+    LOG_DEBUG("[REJECT_FRIEND] Success - request_id:%d", request_id);
+    send_reply(session, "200 Reject friend successful\r\n");
 }
 
 static void handle_remove_friend(client_session_t *session, const char *payload) {
     if (!session->logged_in) {
-        printf("[REMOVE_FRIEND] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[REMOVE_FRIEND] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
     char target[MAX_NAME_LEN];
     if (!payload || sscanf(payload, "%63[^\r\n]", target) != 1) {
-        printf("[REMOVE_FRIEND] Failed - Invalid format\n");
+        LOG_DEBUG("[REMOVE_FRIEND] Failed - Invalid format");
         send_bad_request(session, "Invalid REMOVE_FRIEND format");
         return;
     }
 
-    int rc = remove_friendship(session->username, target);
+    uint32_t target_id = 0;
+    int rc = get_user_id(target, &target_id);
+    if (rc == 0) rc = remove_friendship(session->user_id, target_id);
     if (rc == -2) {
-        printf("[REMOVE_FRIEND] Failed - User not found: %s\n", target);
-        send_request(session->sockfd, "406 User not exist\r\n");
+        LOG_DEBUG("[REMOVE_FRIEND] Failed - User not found: %s", target);
+        send_reply(session, "406 User not exist\r\n");
         return;
     } else if (rc != 0) {
-        printf("[REMOVE_FRIEND] Failed - Remove error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
+        LOG_DEBUG("[REMOVE_FRIEND] Failed - Remove error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
     }
 
-    printf("[REMOVE_FRIEND] Success - removed friend: %s\n", target);
-    send_request(session->sockfd, "200 Remove friend successful\r\n");
+    LOG_DEBUG("[REMOVE_FRIEND] Success - removed friend: %s", target);
+    send_reply(session, "200 Remove friend successful\r\n");
 }
 
-static void handle_list_friends(client_session_t *session) {
-    printf("[LIST_FRIENDS] Command received from user: %s\n", session->username);
+static void handle_list_friends(client_session_t *session, const char *payload) {
+    LOG_TRACE("[LIST_FRIENDS] Command received from user: %s", session->username);
     if (!session->logged_in) {
-        printf("[LIST_FRIENDS] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[LIST_FRIENDS] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
         return;
     }
 
-    FriendRel friends[MAX_FRIENDS];
-    int friend_count = 0;
-    int rc = get_user_friends(session->username, friends, MAX_FRIENDS, &friend_count);
-    if (rc == -2) {
-        printf("[LIST_FRIENDS] Failed - User not found\n");
-        send_request(session->sockfd, "406 User not exist\r\n");
+    db_page_t page;
+    int paged = parse_page_args(payload, &page);
+    if (paged < 0) {
+        LOG_DEBUG("[LIST_FRIENDS] Failed - Invalid format");
+        send_bad_request(session, "Invalid LIST_FRIENDS format");
+        return;
+    }
 
+    list_reply_t reply;
+    list_reply_init(&reply, session, "200 List friend successful, %d friends\r\n", paged);
+    if (list_from_cache(&reply, REPLY_LIST_FRIENDS, paged ? &page : NULL)) {
+        LOG_DEBUG("[LIST_FRIENDS] Sent cached reply");
         return;
-    } else if (rc == -1) {
-        printf("[LIST_FRIENDS] Failed - Fetch error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
-        return;
-    }
-
-    printf("[LIST_FRIENDS] Found %d friends\n", friend_count);
-    char buff[8192];
-    int offset = snprintf(buff, sizeof(buff), "200 List friend successful, %d friends\r\n", friend_count);
-    for (int i = 0; i < friend_count; ++i) {
-        offset += snprintf(buff + offset, sizeof(buff) - offset,
-                           "%s|%s|%ld\r\n",
-                           friends[i].user_a,
-                           friends[i].user_b,
-                           (long)friends[i].since);
-        if (offset >= (int)sizeof(buff)) {
-            break;
-        }
     }
-    offset += snprintf(buff + offset, sizeof(buff) - offset,
-                   "END\r\n");
+    db_sink_t sink = { list_begin, friend_row, &reply };
+    int rc = scan_user_friends(session->user_id, paged ? &page : NULL, &sink);
+    LOG_DEBUG("[LIST_FRIENDS] Sent %d rows", reply.rows);
+    list_finish(&reply, rc);
+}
 
+static void handle_list_friend_requests(client_session_t *session, const char *payload) {
+    LOG_TRACE("[LIST_REQUESTS] Command received from user: %s", session->username);
+    if (!session->logged_in) {
+        LOG_DEBUG("[LIST_REQUESTS] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
+        return;
+    }
 
-    printf("[LIST_FRIENDS] Sending response with %d items\n", friend_count);
-    send_request(session->sockfd, buff);
+    db_page_t page;
+    int paged = parse_page_args(payload, &page);
+    if (paged < 0) {
+        LOG_DEBUG("[LIST_REQUESTS] Failed - Invalid format");
+        send_bad_request(session, "Invalid LIST_REQUESTS format");
+        return;
+    }
+
+    list_reply_t reply;
+    list_reply_init(&reply, session, "200 List request successful, %d requests\r\n", paged);
+    db_sink_t sink = { list_begin, request_row, &reply };
+    int rc = list_scan_db(&reply, scan_user_requests, paged ? &page : NULL, &sink);
+    LOG_DEBUG("[LIST_REQUESTS] Sent %d rows", reply.rows);
+    list_finish(&reply, rc);
 }
 
-static void handle_list_friend_requests(client_session_t *session) {
-    printf("[LIST_REQUESTS] Command received from user: %s\n", session->username);
+// NOTIFICATION COMMAND HANDLERS
+static void handle_list_notifications(client_session_t *session, const char *payload) {
+    LOG_TRACE("[LIST_NOTIFICATIONS] Command received from user: %s", session->username);
     if (!session->logged_in) {
-        printf("[LIST_REQUESTS] Failed - Not logged in\n");
-        send_request(session->sockfd, "405 Not logged in\r\n");
+        LOG_DEBUG("[LIST_NOTIFICATIONS] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
+        return;
+    }
+
+    db_page_t page;
+    int paged = parse_page_args(payload, &page);
+    if (paged < 0) {
+        LOG_DEBUG("[LIST_NOTIFICATIONS] Failed - Invalid format");
+        send_bad_request(session, "Invalid LIST_NOTIFICATIONS format");
         return;
     }
 
-    FriendRequest requests[MAX_REQUESTS];
-    int req_count = 0;
-    int rc = get_user_requests(session->username, requests, MAX_REQUESTS, &req_count);
+    list_reply_t reply;
+    list_reply_init(&reply, session, "200 List notifications successful, %d notifications\r\n", paged);
+    db_sink_t sink = { list_begin, notification_row, &reply };
+    int rc = list_scan_db(&reply, scan_user_notifications, paged ? &page : NULL, &sink);
+    LOG_DEBUG("[LIST_NOTIFICATIONS] Sent %d rows", reply.rows);
+    list_finish(&reply, rc);
+}
+
+static void handle_seen_notification(client_session_t *session, const char *payload) {
+    if (!session->logged_in) {
+        LOG_DEBUG("[SEEN_NOTIFICATION] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
+        return;
+    }
+
+    int notif_id = 0;
+    if (!payload || sscanf(payload, "%d", &notif_id) != 1 || notif_id <= 0) {
+        LOG_DEBUG("[SEEN_NOTIFICATION] Failed - Invalid format");
+        send_bad_request(session, "Invalid SEEN_NOTIFICATION format");
+        return;
+    }
+
+    int rc = mark_notification_seen(notif_id, session->user_id);
     if (rc == -2) {
-        printf("[LIST_REQUESTS] Failed - User not found\n");
-        send_request(session->sockfd, "406 User not exist\r\n");
+        LOG_DEBUG("[SEEN_NOTIFICATION] Failed - Notification not found: %d", notif_id);
+        send_reply(session, "406 Notification not exist\r\n");
+        return;
+    } else if (rc != 0) {
+        LOG_DEBUG("[SEEN_NOTIFICATION] Failed - Update error");
+        send_reply(session, "500 Internal server error\r\n");
         return;
-    } else if (rc == -1) {
-        printf("[LIST_REQUESTS] Failed - Fetch error\n");
-        send_request(session->sockfd, "500 Internal server error\r\n");
-        return;
-    }
-
-    printf("[LIST_REQUESTS] Found %d requests\n", req_count);
-    char buff[8192];
-    int offset = snprintf(buff, sizeof(buff), "200 List request successful, %d requests\r\n", req_count);
-    for (int i = 0; i < req_count; ++i) {
-        offset += snprintf(buff + offset, sizeof(buff) - offset,
-                           "%d|%s|%s|%d|%ld\r\n",
-                           requests[i].id,
-                           requests[i].from,
-                           requests[i].to,
-                           requests[i].status,
-                           (long)requests[i].created_at);
-        if (offset >= (int)sizeof(buff)) {
-            break;
-        }
     }
-    offset += snprintf(buff + offset, sizeof(buff) - offset,
-                   "END\r\n");
 
-    send_request(session->sockfd, buff);
+    LOG_DEBUG("[SEEN_NOTIFICATION] Success - notif_id:%d", notif_id);
+    send_reply(session, "200 Notification marked as seen\r\n");
+}
+
+/*
+ * Parse "requests,tags" (or "all") into a notify_kind_t bit mask.
+ * Returns the mask, 0 if a topic is unknown; *end is left after the list.
+ */
+static unsigned int parse_watch_topics(const char *p, const char **end) {
+    unsigned int topics = 0;
+    for (;;) {
+        size_t len = strcspn(p, ",|\r\n");
+        unsigned int bit = 0;
+        if (len == 3 && strncmp(p, "all", 3) == 0) {
+            bit = (1u << NOTIFY_KINDS) - 1;
+        } else {
+            for (int k = 0; k < NOTIFY_KINDS; ++k) {
+                if (strlen(watch_topics[k]) == len && strncmp(p, watch_topics[k], len) == 0) bit = 1u << k;
+            }
+        }
+        if (!bit) return 0;
+        topics |= bit;
+        p += len;
+        if (*p != ',') break;
+        p++;
+    }
+    *end = p;
+    return topics;
 }
 
-static void handle_not_implemented(client_session_t *session) {
-    send_request(session->sockfd, "501 Not implemented\r\n");
+// WATCH|<topics>|<since_version>[|<timeout_sec>]
+static void handle_watch(client_session_t *session, const char *payload) {
+    LOG_TRACE("[WATCH] Command received from user: %s", session->username);
+    if (!session->logged_in) {
+        LOG_DEBUG("[WATCH] Failed - Not logged in");
+        send_reply(session, "405 Not logged in\r\n");
+        return;
+    }
+
+    const char *p = payload;
+    unsigned int topics = parse_watch_topics(p, &p);
+    char *num_end = NULL;
+    unsigned long since = 0;
+    long timeout = WATCH_DEFAULT_TIMEOUT_SEC;
+    int valid = topics != 0 && *p == '|';
+    if (valid) {
+        since = strtoul(p + 1, &num_end, 10);
+        valid = num_end != p + 1 && since <= INT_MAX;
+        p = num_end;
+    }
+    if (valid && *p == '|') {
+        timeout = strtol(p + 1, &num_end, 10);
+        valid = num_end != p + 1 && timeout >= 0;
+        p = num_end;
+    }
+    if (!valid || (*p != '\0' && *p != '\r' && *p != '\n')) {
+        LOG_DEBUG("[WATCH] Failed - Invalid format");
+        send_bad_request(session, "Invalid WATCH format");
+        return;
+    }
+    if (timeout > WATCH_MAX_TIMEOUT_SEC) timeout = WATCH_MAX_TIMEOUT_SEC;
+
+    uint32_t version = 0;
+    if (watch_version(session->user_id, topics, &version) != 0) {
+        LOG_DEBUG("[WATCH] Failed - Version lookup error");
+        send_reply(session, "500 Internal server error\r\n");
+        return;
+    }
+
+    // Nothing new yet: park until the notifier or the timeout dispatches the retry,
+    // which carries a zero timeout so that it answers whatever it finds. The retry
+    // needs worker threads: run inline it would share the session with its own I/O
+    // thread, so with --workers=0 WATCH answers at once like a zero timeout.
+    if (version <= since && timeout > 0 && worker_pool_enabled()) {
+        char retry[WATCH_LINE_LEN];
+        int len = snprintf(retry, sizeof(retry), "WATCH|");
+        for (int k = 0; k < NOTIFY_KINDS; ++k) {
+            if (topics & (1u << k)) len += snprintf(retry + len, sizeof(retry) - len, "%s,", watch_topics[k]);
+        }
+        snprintf(retry + len - 1, sizeof(retry) - len + 1, "|%lu|0", since);
+        int rc = watch_park(session, topics, (uint32_t)since, (int)timeout * 1000, retry);
+        if (rc == 0) {
+            LOG_DEBUG("[WATCH] Parked - since:%lu timeout:%lds", since, timeout);
+            return;
+        } else if (rc < 0) {
+            LOG_DEBUG("[WATCH] Failed - Could not park");
+            send_reply(session, "500 Internal server error\r\n");
+            return;
+        }
+        watch_version(session->user_id, topics, &version);
+    }
+
+    watch_reply_t reply;
+    list_reply_init(&reply.list, session, "200 Watch successful\r\n", 0);
+    reply.topics = topics;
+    reply.scanned = (uint32_t)since;
+    int rc = 0;
+    if (version > since) {
+        db_page_t page = { (uint32_t)since, PAGE_MAX_LIMIT };
+        db_sink_t sink = { list_begin, watch_row, &reply };
+        rc = list_scan_db(&reply.list, scan_user_notifications, &page, &sink);
+    } else {
+        // Timed out: the in-memory version already says there is no delta
+        list_begin(&reply.list, 0, 0);
+    }
+    if (!reply.list.begun) {
+        list_finish(&reply.list, rc);
+        return;
+    }
+    // A complete delta brings the client up to the watched version; a cut one resumes
+    // where the scan stopped
+    uint32_t next = reply.list.more || version < reply.scanned ? reply.scanned : version;
+    list_printf(&reply.list, "VERSION|%u\r\n", next);
+    LOG_DEBUG("[WATCH] Sent %d rows, version:%u", reply.list.rows, next);
+    list_finish(&reply.list, rc);
 }
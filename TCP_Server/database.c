@@ -1,12 +1,430 @@
+#define LOG_TAG "db"
+
 #include "database.h"
+#include "migrations.h"
+#include "friend_graph.h"
+#include "intern.h"
+#include "reply_cache.h"
+#include "log.h"
 
 #include <sqlite3.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+#include <errno.h>
+
+// Open-addressed, power of two; comfortably above the number of distinct queries in this file
+#define STMT_CACHE_SLOTS 64
+
+typedef struct {
+    char *sql;                  // owned copy of the query text, NULL for an empty slot
+    sqlite3_stmt *stmt;
+} stmt_slot_t;
+
+// One SQLite connection and its statement cache. The lock is recursive and is
+// held from stmt_acquire() to stmt_release(), or across a whole transaction, so
+// a connection is only ever used by one thread at a time.
+typedef struct {
+    sqlite3 *db;
+    pthread_mutex_t lock;
+    unsigned long waits;        // lock was contended
+    unsigned int schema_gen;
+    stmt_slot_t slots[STMT_CACHE_SLOTS];
+} db_conn_t;
+
+// WAL lets the read-only connections run in parallel with the single writer.
+static db_pool_config_t g_pool_cfg = {
+    DEFAULT_DB_READERS, DEFAULT_DB_BUSY_TIMEOUT_MS, DEFAULT_DB_BATCH_MS, DEFAULT_DB_BATCH_OPS, DB_SYNC_FULL
+};
+static db_conn_t g_writer;
+static db_conn_t *g_readers = NULL;
+static int g_reader_count = 0;
+static unsigned int g_next_reader;
+static __thread db_conn_t *t_reader;   // reader connection this thread sticks to
+
+typedef void (*commit_hook_fn)(void *arg);
+
+// A caller blocked in write_finish() until the batch holding its write commits.
+// on_commit mirrors the write into in-memory state once it is durable.
+typedef struct batch_waiter {
+    struct batch_waiter *next;
+    int done;
+    int committed;
+    commit_hook_fn on_commit;
+    void *arg;
+} batch_waiter_t;
+
+// Group commit: concurrent writes share one BEGIN IMMEDIATE ... COMMIT on the
+// writer, each inside its own savepoint. open/ops/opened_ms/waiters are guarded by
+// g_writer.lock; waiters sleep on lock/cond and are marked done under both locks.
+typedef struct {
+    int open;
+    int ops;
+    long long opened_ms;
+    batch_waiter_t *waiters;    // in write order
+    batch_waiter_t *waiters_tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} write_batch_t;
+
+static write_batch_t g_batch;
+static unsigned int g_write_queued;   // writers waiting for g_writer.lock
+static __thread batch_waiter_t t_waiter;
+static __thread int t_standalone;     // this write could not join a batch
+static unsigned long g_batch_commits;
+static unsigned long g_batch_ops;
+static unsigned long g_batch_failures;
+static int g_batch_max;
+
+static intern_table_t g_user_dir;     // username <-> accounts.id, committed accounts only
+static unsigned long g_user_dir_misses;
+
+static unsigned int g_schema_gen;     // bumped whenever migrations change the schema
+static unsigned long g_stmt_hits;
+static unsigned long g_stmt_misses;
+static unsigned long g_stmt_flushes;
+static unsigned long g_stmt_errors;
+
+// Finalize every cached statement; caller holds conn->lock
+static void stmt_cache_flush(db_conn_t *conn) {
+    int flushed = 0;
+    for (int i = 0; i < STMT_CACHE_SLOTS; ++i) {
+        stmt_slot_t *slot = &conn->slots[i];
+        if (!slot->sql) continue;
+        sqlite3_finalize(slot->stmt);
+        free(slot->sql);
+        slot->sql = NULL;
+        slot->stmt = NULL;
+        flushed = 1;
+    }
+    if (flushed) __atomic_add_fetch(&g_stmt_flushes, 1, __ATOMIC_RELAXED);
+}
+
+static unsigned int stmt_hash(const char *sql) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)sql; *p; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void conn_lock(db_conn_t *conn) {
+    if (pthread_mutex_trylock(&conn->lock) == 0) return;
+    __atomic_add_fetch(&conn->waits, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&conn->lock);
+}
+
+// Read-only connection for this thread, handed out round-robin on first use.
+// Falls back to the writer when the pool has no readers.
+static db_conn_t *db_reader(void) {
+    if (t_reader) return t_reader;
+    if (g_reader_count == 0) return &g_writer;
+    unsigned int n = __atomic_fetch_add(&g_next_reader, 1, __ATOMIC_RELAXED);
+    t_reader = &g_readers[n % (unsigned int)g_reader_count];
+    return t_reader;
+}
+
+// Lock conn and return its cached statement for sql, preparing it on first use.
+// Returns NULL (with the lock released) if the query cannot be prepared.
+static sqlite3_stmt *stmt_acquire(db_conn_t *conn, const char *sql) {
+    conn_lock(conn);
+
+    unsigned int gen = __atomic_load_n(&g_schema_gen, __ATOMIC_ACQUIRE);
+    if (conn->schema_gen != gen) {
+        stmt_cache_flush(conn);
+        conn->schema_gen = gen;
+    }
+
+    unsigned int mask = STMT_CACHE_SLOTS - 1;
+    unsigned int i = stmt_hash(sql) & mask;
+    for (unsigned int probes = 0; probes < STMT_CACHE_SLOTS; ++probes, i = (i + 1) & mask) {
+        stmt_slot_t *slot = &conn->slots[i];
+        if (!slot->sql) break;
+        if (strcmp(slot->sql, sql) == 0) {
+            __atomic_add_fetch(&g_stmt_hits, 1, __ATOMIC_RELAXED);
+            return slot->stmt;
+        }
+    }
+    if (conn->slots[i].sql) {
+        // Table full: start over rather than grow, the query set is fixed
+        stmt_cache_flush(conn);
+        i = stmt_hash(sql) & mask;
+    }
+
+    __atomic_add_fetch(&g_stmt_misses, 1, __ATOMIC_RELAXED);
+    sqlite3_stmt *stmt = NULL;
+    char *copy = strdup(sql);
+    if (!copy || sqlite3_prepare_v3(conn->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
+        __atomic_add_fetch(&g_stmt_errors, 1, __ATOMIC_RELAXED);
+        LOG_ERROR("Failed to prepare statement: %s", sqlite3_errmsg(conn->db));
+        free(copy);
+        sqlite3_finalize(stmt);
+        pthread_mutex_unlock(&conn->lock);
+        return NULL;
+    }
+    conn->slots[i].sql = copy;
+    conn->slots[i].stmt = stmt;
+    return stmt;
+}
 
+// Reset a statement from stmt_acquire() for its next user and unlock the connection
+static void stmt_release(db_conn_t *conn, sqlite3_stmt *stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Step a cached parameterless statement (BEGIN, SAVEPOINT, COMMIT...) on conn
+static int conn_exec(db_conn_t *conn, const char *sql) {
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return -1;
+    int rc = sqlite3_step(stmt);
+    stmt_release(conn, stmt);
+    return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+// Commit the open batch and wake its waiters; caller holds g_writer.lock
+static void batch_commit(void) {
+    // An I/O or disk-full error may already have rolled the whole transaction back
+    int ok = !sqlite3_get_autocommit(g_writer.db) && conn_exec(&g_writer, "COMMIT") == 0;
+    if (!ok) {
+        LOG_WARN("Group commit of %d write(s) failed: %s", g_batch.ops, sqlite3_errmsg(g_writer.db));
+        if (!sqlite3_get_autocommit(g_writer.db)) sqlite3_exec(g_writer.db, "ROLLBACK", NULL, NULL, NULL);
+        __atomic_add_fetch(&g_batch_failures, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&g_batch_commits, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_batch_ops, (unsigned long)g_batch.ops, __ATOMIC_RELAXED);
+    if (g_batch.ops > g_batch_max) __atomic_store_n(&g_batch_max, g_batch.ops, __ATOMIC_RELAXED);
+
+    // Hooks run in commit order under the writer lock, before anyone is acknowledged
+    for (batch_waiter_t *h = g_batch.waiters; ok && h; h = h->next) {
+        if (h->on_commit) h->on_commit(h->arg);
+    }
+
+    pthread_mutex_lock(&g_batch.lock);
+    batch_waiter_t *w = g_batch.waiters;
+    while (w) {
+        batch_waiter_t *next = w->next;   // w lives on a stack that may unwind once done is set
+        w->committed = ok;
+        w->done = 1;
+        w = next;
+    }
+    pthread_cond_broadcast(&g_batch.cond);
+    pthread_mutex_unlock(&g_batch.lock);
+
+    g_batch.waiters = NULL;
+    g_batch.waiters_tail = NULL;
+    g_batch.open = 0;
+    g_batch.ops = 0;
+}
+
+// Commit now if the batch is full, nobody else is about to join, or the window is over
+static void batch_maybe_commit(void) {
+    if (!g_batch.open) return;
+    int queued = (int)__atomic_load_n(&g_write_queued, __ATOMIC_ACQUIRE);
+    if (sqlite3_get_autocommit(g_writer.db) ||
+        g_batch.ops >= g_pool_cfg.batch_ops ||
+        (queued == 0 && (g_pool_cfg.batch_ms == 0 || now_ms() - g_batch.opened_ms >= g_pool_cfg.batch_ms))) {
+        batch_commit();
+    }
+}
+
+// Lock the writer and open a savepoint for one logical write, joining the open batch
+static db_conn_t *write_begin(void) {
+    __atomic_add_fetch(&g_write_queued, 1, __ATOMIC_RELEASE);
+    conn_lock(&g_writer);
+    __atomic_sub_fetch(&g_write_queued, 1, __ATOMIC_RELEASE);
+
+    t_standalone = 0;
+    t_waiter.on_commit = NULL;
+    if (!g_batch.open) {
+        if (conn_exec(&g_writer, "BEGIN IMMEDIATE") == 0) {
+            g_batch.open = 1;
+            g_batch.opened_ms = now_ms();
+        } else {
+            // Outside a transaction the savepoint is its own transaction
+            t_standalone = 1;
+        }
+    }
+    conn_exec(&g_writer, "SAVEPOINT write_op");
+    return &g_writer;
+}
+
+// Run fn(arg) once the current write has committed; call between write_begin and write_finish
+static void write_on_commit(commit_hook_fn fn, void *arg) {
+    t_waiter.on_commit = fn;
+    t_waiter.arg = arg;
+}
+
+/*
+ * Close the savepoint from write_begin(), unlock the writer and return result. A
+ * successful write is only acknowledged once the COMMIT holding it has returned, so
+ * every 0 handed back is as durable as the synchronous setting makes a commit; if
+ * that commit fails the caller gets -1 instead. Failed writes are rolled back to
+ * the savepoint and return at once without waiting.
+ */
+static int write_finish(db_conn_t *conn, int result) {
+    if (result != 0) conn_exec(conn, "ROLLBACK TO write_op");
+    int released = conn_exec(conn, "RELEASE write_op") == 0;
+
+    if (t_standalone || result != 0) {
+        if (t_standalone && result == 0 && released && t_waiter.on_commit) t_waiter.on_commit(t_waiter.arg);
+        batch_maybe_commit();
+        pthread_mutex_unlock(&conn->lock);
+        if (result != 0) return result;
+        return released ? 0 : -1;
+    }
+
+    batch_waiter_t *w = &t_waiter;
+    w->done = 0;
+    w->committed = 0;
+    w->next = NULL;
+    if (g_batch.waiters_tail) g_batch.waiters_tail->next = w;
+    else g_batch.waiters = w;
+    g_batch.waiters_tail = w;
+    g_batch.ops++;
+    if (!released) batch_commit();
+    else batch_maybe_commit();
+    long long window = g_pool_cfg.batch_ms > 0 ? g_pool_cfg.batch_ms : DB_BATCH_FALLBACK_MS;
+    long long deadline = g_batch.opened_ms + window;
+    pthread_mutex_unlock(&conn->lock);
+
+    pthread_mutex_lock(&g_batch.lock);
+    while (!w->done) {
+        struct timespec ts = { (time_t)(deadline / 1000), (long)(deadline % 1000) * 1000000L };
+        if (pthread_cond_timedwait(&g_batch.cond, &g_batch.lock, &ts) != ETIMEDOUT) continue;
+        // Window over and nobody committed: close the batch ourselves
+        pthread_mutex_unlock(&g_batch.lock);
+        conn_lock(conn);
+        if (!w->done && g_batch.open) batch_commit();
+        pthread_mutex_unlock(&conn->lock);
+        pthread_mutex_lock(&g_batch.lock);
+    }
+    int committed = w->committed;
+    pthread_mutex_unlock(&g_batch.lock);
+    return (committed && released) ? 0 : -1;
+}
+
+// Friendship change mirrored into the friend graph once its transaction commits
+typedef struct {
+    uint32_t user_a;
+    uint32_t user_b;
+    time_t since;
+} friendship_change_t;
+
+static void graph_add_hook(void *arg) {
+    friendship_change_t *change = arg;
+    if (friend_graph_add(change->user_a, change->user_b, change->since) < 0) {
+        LOG_ERROR("Friend graph out of memory adding %u/%u", change->user_a, change->user_b);
+    }
+    reply_cache_bump(change->user_a, REPLY_LIST_FRIENDS);
+    reply_cache_bump(change->user_b, REPLY_LIST_FRIENDS);
+}
+
+static void graph_remove_hook(void *arg) {
+    friendship_change_t *change = arg;
+    friend_graph_remove(change->user_a, change->user_b);
+    reply_cache_bump(change->user_a, REPLY_LIST_FRIENDS);
+    reply_cache_bump(change->user_b, REPLY_LIST_FRIENDS);
+}
+
+/*
+ * Favorite listings whose cached replies go stale once the write commits: the
+ * owner's LIST_FAVORITES (owner 0 for none) and LIST_TAGGED_FAVORITES of every user
+ * tagged in the favorite.
+ */
+typedef struct {
+    uint32_t owner;
+    uint32_t *tagged;
+    int ntagged;
+} favorite_change_t;
+
+static void favorite_change_hook(void *arg) {
+    favorite_change_t *change = arg;
+    if (change->owner) reply_cache_bump(change->owner, REPLY_LIST_FAVORITES);
+    for (int i = 0; i < change->ntagged; ++i) reply_cache_bump(change->tagged[i], REPLY_LIST_TAGGED);
+}
+
+// New account published to the user directory once its transaction commits
+typedef struct {
+    const char *username;
+    uint32_t id;
+} account_change_t;
+
+static void user_dir_add_hook(void *arg) {
+    account_change_t *change = arg;
+    if (intern_put(&g_user_dir, change->username, change->id) != 0) {
+        LOG_ERROR("User directory could not add %s (id %u)", change->username, change->id);
+    }
+}
+
+// Name behind a user id for a result row; "" if the account is gone
+static const char *row_user_name(uint32_t id) {
+    const char *name = db_user_name(id);
+    return name ? name : "";
+}
+
+// Load every account name into the user directory
+static int load_user_directory(void) {
+    long long start = now_ms();
+    if (intern_init(&g_user_dir) != 0) return -1;
+
+    sqlite3_stmt *stmt = stmt_acquire(&g_writer, "SELECT id, username FROM accounts");
+    if (!stmt) return -1;
+    int rc;
+    unsigned long count = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(stmt, 1);
+        if (!name || intern_put(&g_user_dir, name, (uint32_t)sqlite3_column_int64(stmt, 0)) != 0) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        count++;
+    }
+    stmt_release(&g_writer, stmt);
+    if (rc != SQLITE_DONE) return -1;
+
+    LOG_INFO("User directory: %lu accounts loaded in %lldms, %zuKB",
+             count, now_ms() - start, intern_memory(&g_user_dir) / 1024);
+    return 0;
+}
+
+// Load every friendship into the friend graph
+static int load_friend_graph(void) {
+    long long start = now_ms();
+    if (friend_graph_init() != 0) return -1;
+
+    sqlite3_stmt *stmt = stmt_acquire(&g_writer, "SELECT user_a_id, user_b_id, since FROM friendships");
+    if (!stmt) return -1;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (friend_graph_add((uint32_t)sqlite3_column_int64(stmt, 0), (uint32_t)sqlite3_column_int64(stmt, 1),
+                             (time_t)sqlite3_column_int64(stmt, 2)) < 0) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+    }
+    stmt_release(&g_writer, stmt);
+    if (rc != SQLITE_DONE) return -1;
+
+    unsigned long users, friendships;
+    size_t bytes;
+    friend_graph_stats(&users, &friendships, &bytes);
+    LOG_INFO("Friend graph: %lu friendships between %lu users loaded in %lldms, %zuKB",
+             friendships, users, now_ms() - start, bytes / 1024);
+    return 0;
+}
 
-static sqlite3 *g_db = NULL;
 // Helper function to copy text safely
 static void copy_text(char *dest, size_t dest_size, const void *src) {
     if (!dest || dest_size == 0) return;
@@ -18,649 +436,1076 @@ static void copy_text(char *dest, size_t dest_size, const void *src) {
     strncpy(dest, s, dest_size - 1);
     dest[dest_size - 1] = '\0';
 }
-// Helper function to execute simple SQL statements
+// Helper function to execute simple SQL statements on the writer connection
 static int run_simple_sql(const char *sql) {
     char *errmsg = NULL;
-    int rc = sqlite3_exec(g_db, sql, NULL, NULL, &errmsg);
+    int rc = sqlite3_exec(g_writer.db, sql, NULL, NULL, &errmsg);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "SQLite error: %s\n", errmsg ? errmsg : "unknown");
+        LOG_ERROR("SQLite error: %s", errmsg ? errmsg : "unknown");
         sqlite3_free(errmsg);
         return -1;
     }
     return 0;
 }
+
+static int copy_first_column(void *arg, int ncols, char **values, char **names) {
+    (void)names;
+    if (ncols > 0) copy_text((char *)arg, 16, values[0]);
+    return 0;
+}
+
+// Open one pooled connection; flags decide read-only or read-write
+static int conn_open(db_conn_t *conn, const char *path, int flags) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&conn->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // NOMUTEX: conn->lock already keeps each connection to one thread at a time
+    if (sqlite3_open_v2(path, &conn->db, flags | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+        LOG_ERROR("Failed to open DB %s: %s", path, sqlite3_errmsg(conn->db));
+        sqlite3_close(conn->db);
+        conn->db = NULL;
+        return -1;
+    }
+    sqlite3_busy_timeout(conn->db, g_pool_cfg.busy_timeout_ms);
+    return 0;
+}
+
+static void conn_close(db_conn_t *conn) {
+    if (!conn->db) return;
+    pthread_mutex_lock(&conn->lock);
+    stmt_cache_flush(conn);
+    sqlite3_close(conn->db);
+    conn->db = NULL;
+    pthread_mutex_unlock(&conn->lock);
+}
+
 // DATABASE INITIALIZATION AND SHUTDOWN
+/**
+ * @function db_configure: Set the connection pool options used by db_initialize.
+ *
+ * @param cfg: Reader count, busy timeout, group commit and durability settings.
+ */
+void db_configure(const db_pool_config_t *cfg) {
+    g_pool_cfg = *cfg;
+    if (g_pool_cfg.readers < 0) g_pool_cfg.readers = 0;
+    if (g_pool_cfg.busy_timeout_ms < 0) g_pool_cfg.busy_timeout_ms = 0;
+    if (g_pool_cfg.batch_ms < 0) g_pool_cfg.batch_ms = 0;
+    if (g_pool_cfg.batch_ops < 1) g_pool_cfg.batch_ops = 1;
+}
+
 int db_initialize(const char *db_path) {
     const char *path = db_path ? db_path : "data/mmt.db";
 
-    if (sqlite3_open(path, &g_db) != SQLITE_OK) {
-        fprintf(stderr, "Failed to open DB %s: %s\n", path, sqlite3_errmsg(g_db));
-        sqlite3_close(g_db);
-        g_db = NULL;
-        return -1;
+    if (conn_open(&g_writer, path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) != 0) return -1;
+
+    char mode[16] = "";
+    sqlite3_exec(g_writer.db, "PRAGMA journal_mode = WAL;", copy_first_column, mode, NULL);
+    if (strcmp(mode, "wal") != 0) {
+        LOG_WARN("WAL journal mode unavailable (%s); readers will block behind writes", mode);
+    }
+    // FULL: each acknowledged write survived an fsync. NORMAL (WAL only): may lose the
+    // last commits on power loss, never on a process crash.
+    run_simple_sql(g_pool_cfg.sync == DB_SYNC_NORMAL ? "PRAGMA synchronous = NORMAL;" : "PRAGMA synchronous = FULL;");
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_batch.cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_mutex_init(&g_batch.lock, NULL);
+
+    int applied = 0;
+    if (db_migrate(g_writer.db, &applied) != 0) return -1;
+    if (applied > 0) {
+        // Plans prepared against the old schema are stale
+        __atomic_add_fetch(&g_schema_gen, 1, __ATOMIC_RELEASE);
     }
 
     run_simple_sql("PRAGMA foreign_keys = ON;");
 
-    if (run_simple_sql(
-        "CREATE TABLE IF NOT EXISTS accounts(" \
-        "username TEXT PRIMARY KEY," \
-        "password TEXT NOT NULL)")) return -1;
-
-    if (run_simple_sql(
-        "CREATE TABLE IF NOT EXISTS favorites(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT," \
-        "owner TEXT NOT NULL," \
-        "name TEXT NOT NULL," \
-        "category TEXT NOT NULL," \
-        "location TEXT NOT NULL," \
-        "tagged TEXT DEFAULT ''," \
-        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now'))," \
-        "FOREIGN KEY(owner) REFERENCES accounts(username) ON DELETE CASCADE)")) return -1;
-
-    if (run_simple_sql(
-        "CREATE TABLE IF NOT EXISTS friendships(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT," \
-        "user_a TEXT NOT NULL," \
-        "user_b TEXT NOT NULL," \
-        "since INTEGER NOT NULL DEFAULT (strftime('%s','now'))," \
-        "UNIQUE(user_a, user_b)," \
-        "FOREIGN KEY(user_a) REFERENCES accounts(username) ON DELETE CASCADE," \
-        "FOREIGN KEY(user_b) REFERENCES accounts(username) ON DELETE CASCADE)")) return -1;
-
-    if (run_simple_sql(
-        "CREATE TABLE IF NOT EXISTS friend_requests(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT," \
-        "requester TEXT NOT NULL," \
-        "requestee TEXT NOT NULL," \
-        "status INTEGER NOT NULL DEFAULT 0," \
-        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now'))," \
-        "FOREIGN KEY(requester) REFERENCES accounts(username) ON DELETE CASCADE," \
-        "FOREIGN KEY(requestee) REFERENCES accounts(username) ON DELETE CASCADE)")) return -1;
-
-    if (run_simple_sql(
-        "CREATE TABLE IF NOT EXISTS notifications(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT," \
-        "recipient TEXT NOT NULL," \
-        "actor TEXT NOT NULL," \
-        "fav_id INTEGER," \
-        "message TEXT NOT NULL," \
-        "seen INTEGER NOT NULL DEFAULT 0," \
-        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now'))," \
-        "FOREIGN KEY(recipient) REFERENCES accounts(username) ON DELETE CASCADE," \
-        "FOREIGN KEY(actor) REFERENCES accounts(username) ON DELETE CASCADE)")) return -1;
-
-    if (run_simple_sql(
-        "CREATE TABLE IF NOT EXISTS favorite_tags(" \
-        "fav_id INTEGER NOT NULL," \
-        "tagger TEXT NOT NULL," \
-        "tagged_users TEXT NOT NULL," \
-        "UNIQUE(fav_id, tagged_users)," \
-        "FOREIGN KEY(fav_id) REFERENCES favorites(id) ON DELETE CASCADE," \
-        "FOREIGN KEY(tagged_users) REFERENCES accounts(username) ON DELETE CASCADE," \
-        "FOREIGN KEY(tagger) REFERENCES accounts(username) ON DELETE CASCADE)" )) return -1;
-
-   
+    if (load_user_directory() != 0) {
+        LOG_ERROR("Failed to load the user directory");
+        return -1;
+    }
+    if (load_friend_graph() != 0) {
+        LOG_ERROR("Failed to load the friend graph");
+        return -1;
+    }
+
+    g_readers = calloc(g_pool_cfg.readers > 0 ? (size_t)g_pool_cfg.readers : 1, sizeof(db_conn_t));
+    if (!g_readers) return -1;
+    for (int i = 0; i < g_pool_cfg.readers; ++i) {
+        if (conn_open(&g_readers[i], path, SQLITE_OPEN_READONLY) != 0) return -1;
+        g_reader_count++;
+    }
 
+    LOG_INFO("Database %s: schema v%d (%d migration(s) applied), %d reader connection(s), 1 writer, "
+             "journal_mode=%s, busy_timeout=%dms", path, db_schema_latest(), applied, g_reader_count, mode,
+             g_pool_cfg.busy_timeout_ms);
+    LOG_INFO("Group commit: window %dms%s, up to %d writes per commit, synchronous=%s",
+             g_pool_cfg.batch_ms, g_pool_cfg.batch_ms ? "" : " (commit when no writer is waiting)",
+             g_pool_cfg.batch_ops, g_pool_cfg.sync == DB_SYNC_NORMAL ? "normal" : "full");
     return 0;
 }
 
 void db_shutdown(void) {
-    if (g_db) {
-        sqlite3_close(g_db);
-        g_db = NULL;
+    for (int i = 0; i < g_reader_count; ++i) conn_close(&g_readers[i]);
+    g_reader_count = 0;
+    free(g_readers);
+    g_readers = NULL;
+    if (g_writer.db) {
+        conn_lock(&g_writer);
+        if (g_batch.open) batch_commit();
+        pthread_mutex_unlock(&g_writer.lock);
     }
+    conn_close(&g_writer);
+}
+
+void db_dump_metrics(FILE *out) {
+    unsigned long hits = __atomic_load_n(&g_stmt_hits, __ATOMIC_RELAXED);
+    unsigned long misses = __atomic_load_n(&g_stmt_misses, __ATOMIC_RELAXED);
+    unsigned long total = hits + misses;
+    unsigned long reader_waits = 0;
+    for (int i = 0; i < g_reader_count; ++i) reader_waits += __atomic_load_n(&g_readers[i].waits, __ATOMIC_RELAXED);
+    fprintf(out, "readers=%d writer_waits=%lu reader_waits=%lu\n", g_reader_count,
+            __atomic_load_n(&g_writer.waits, __ATOMIC_RELAXED), reader_waits);
+    unsigned long commits = __atomic_load_n(&g_batch_commits, __ATOMIC_RELAXED);
+    unsigned long ops = __atomic_load_n(&g_batch_ops, __ATOMIC_RELAXED);
+    fprintf(out, "group_commits=%lu batched_writes=%lu writes_per_commit=%.1f max_batch=%d commit_failures=%lu\n",
+            commits, ops, commits ? (double)ops / (double)commits : 0.0,
+            __atomic_load_n(&g_batch_max, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_batch_failures, __ATOMIC_RELAXED));
+    fprintf(out, "stmt_hits=%lu stmt_misses=%lu stmt_hit_rate=%.1f%% stmt_flushes=%lu stmt_errors=%lu\n",
+            hits, misses, total ? 100.0 * (double)hits / (double)total : 0.0,
+            __atomic_load_n(&g_stmt_flushes, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_stmt_errors, __ATOMIC_RELAXED));
+    if (!g_user_dir.names) return;
+    pthread_rwlock_rdlock(&g_user_dir.lock);
+    unsigned int names = g_user_dir.count;
+    pthread_rwlock_unlock(&g_user_dir.lock);
+    fprintf(out, "user_dir_names=%u user_dir_misses=%lu user_dir_memory=%zuKB\n", names,
+            __atomic_load_n(&g_user_dir_misses, __ATOMIC_RELAXED), intern_memory(&g_user_dir) / 1024);
 }
 
 // ACCOUNT DATABASE FUNCTIONS
 int db_fetch_accounts(Account accounts[], int max_users, int *out_count) {
-    if (!g_db || !out_count || max_users <= 0) return -1;
+    if (!g_writer.db || !out_count || max_users <= 0) return -1;
 
     *out_count = 0;
     if (!accounts) return 0;
 
-    const char *sql = "SELECT username, password FROM accounts ORDER BY username";
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    const char *sql = "SELECT id, username, password FROM accounts ORDER BY username";
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return -1;
 
     int idx = 0;
     while (sqlite3_step(stmt) == SQLITE_ROW && idx < max_users) {
-        copy_text(accounts[idx].username, sizeof(accounts[idx].username), sqlite3_column_text(stmt, 0));
-        copy_text(accounts[idx].password, sizeof(accounts[idx].password), sqlite3_column_text(stmt, 1));
-        accounts[idx].is_logged_in = 0;
+        accounts[idx].id = (uint32_t)sqlite3_column_int64(stmt, 0);
+        copy_text(accounts[idx].username, sizeof(accounts[idx].username), sqlite3_column_text(stmt, 1));
+        copy_text(accounts[idx].password, sizeof(accounts[idx].password), sqlite3_column_text(stmt, 2));
         idx++;
     }
 
-    sqlite3_finalize(stmt);
+    stmt_release(conn, stmt);
     *out_count = idx;
     return 0;
 }
-int db_create_account(const char *username, const char *password) {
-    if (!g_db || !username || !password) return -1;
+int db_create_account(const char *username, const char *password, uint32_t *out_id) {
+    if (!g_writer.db || !username || !password) return -1;
 
     const char *sql = "INSERT INTO accounts(username, password) VALUES(?, ?)";
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, password, -1, SQLITE_TRANSIENT);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    stmt_release(conn, stmt);
 
-    if (rc == SQLITE_CONSTRAINT) return -2;
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    if (rc == SQLITE_CONSTRAINT) return write_finish(conn, -2);
+    if (rc != SQLITE_DONE) return write_finish(conn, -1);
+
+    account_change_t change = { username, (uint32_t)sqlite3_last_insert_rowid(conn->db) };
+    if (out_id) *out_id = change.id;
+    write_on_commit(user_dir_add_hook, &change);
+    return write_finish(conn, 0);
 }
 
 int db_fetch_account(const char * username, Account *out_account) {
-    if(!g_db || !username || !out_account) return -1;
-    const char * sql = "SELECT username, password, is_logged_in FROM accounts WHERE username = ?";
+    if(!g_writer.db || !username || !out_account) return -1;
+    const char * sql = "SELECT id, username, password FROM accounts WHERE username = ?";
 
-    sqlite3_stmt * stmt = NULL;
-    if(sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return -1;
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
     int step = sqlite3_step(stmt);
 
     if(step != SQLITE_ROW){
-        sqlite3_finalize(stmt);
-        return -2;
+        stmt_release(conn, stmt);
+        // Only a completed lookup proves the account is missing (BUSY, I/O errors do not)
+        return step == SQLITE_DONE ? -2 : -1;
     }
 
-    copy_text(out_account->username, sizeof(out_account->username), sqlite3_column_text(stmt, 0));
-    copy_text(out_account->password, sizeof(out_account->password), sqlite3_column_text(stmt, 1));
-    out_account->is_logged_in = sqlite3_column_int(stmt, 2);
-    sqlite3_finalize(stmt);
+    out_account->id = (uint32_t)sqlite3_column_int64(stmt, 0);
+    copy_text(out_account->username, sizeof(out_account->username), sqlite3_column_text(stmt, 1));
+    copy_text(out_account->password, sizeof(out_account->password), sqlite3_column_text(stmt, 2));
+    stmt_release(conn, stmt);
     return 0;
 }
 
-int db_update_logged_in_status(const char *username, int is_logged_in) {
-    if (!g_db || !username) return -1;
-
-    const char *sql = "UPDATE accounts SET is_logged_in = ? WHERE username = ?";
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
-
-    sqlite3_bind_int(stmt, 1, is_logged_in);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_TRANSIENT);
+/**
+ * @function db_user_id: Resolve a username to its account id. Served from the user
+ * directory; a name it does not know (an account created by another process) is
+ * looked up once and remembered.
+ *
+ * @param username: Name as received from a client.
+ * @param out_id: Filled on success.
+ *
+ * @return 0 if found, -2 if there is no such account, -1 on a database error.
+ */
+int db_user_id(const char *username, uint32_t *out_id) {
+    if (!g_writer.db || !username || !out_id) return -1;
+
+    uint32_t id = intern_lookup(&g_user_dir, username);
+    if (id) {
+        *out_id = id;
+        return 0;
+    }
 
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    __atomic_add_fetch(&g_user_dir_misses, 1, __ATOMIC_RELAXED);
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, "SELECT id FROM accounts WHERE username = ?");
+    if (!stmt) return -1;
+    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
+    int step = sqlite3_step(stmt);
+    if (step == SQLITE_ROW) id = (uint32_t)sqlite3_column_int64(stmt, 0);
+    stmt_release(conn, stmt);
+    if (step == SQLITE_DONE) return -2;
+    if (step != SQLITE_ROW) return -1;
 
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    intern_put(&g_user_dir, username, id);
+    *out_id = id;
+    return 0;
 }
 
+/**
+ * @function db_user_name: Username behind an account id, for replies.
+ *
+ * @param id: Account id.
+ *
+ * @return The name (valid for the life of the process), or NULL if there is no such
+ * account or it could not be read.
+ */
+const char *db_user_name(uint32_t id) {
+    if (!g_writer.db || id == 0) return NULL;
+
+    const char *name = intern_name(&g_user_dir, id);
+    if (name) return name;
+
+    __atomic_add_fetch(&g_user_dir_misses, 1, __ATOMIC_RELAXED);
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, "SELECT username FROM accounts WHERE id = ?");
+    if (!stmt) return NULL;
+    sqlite3_bind_int64(stmt, 1, id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *text = (const char *)sqlite3_column_text(stmt, 0);
+        if (text) intern_put(&g_user_dir, text, id);
+    }
+    stmt_release(conn, stmt);
+    return intern_name(&g_user_dir, id);
+}
 
-// FAVORITE PLACE DATABASE FUNCTIONS
-int db_fetch_user_favorites(const char *owner, FavoritePlace favs[], int max_items, int *out_count) {
-    
-    if (!g_db || !owner || !out_count || max_items <= 0) return -1;
 
-    const char *sql = "SELECT * FROM favorites WHERE owner = ?";
+// LISTING SCANS
+// Fills the row struct handed to a sink from the current result row
+typedef void (*row_read_fn)(sqlite3_stmt *stmt, void *row);
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+// Bind the listing key, then after (paged queries only), then a LIMIT when positive
+static void bind_listing(sqlite3_stmt *stmt, uint32_t key, const db_page_t *page, int limit) {
+    int idx = 1;
+    sqlite3_bind_int64(stmt, idx++, key);
+    if (page) sqlite3_bind_int64(stmt, idx++, page->after);
+    if (limit > 0) sqlite3_bind_int(stmt, idx++, limit);
+}
 
-    sqlite3_bind_text(stmt, 1, owner, -1, SQLITE_TRANSIENT);
+/*
+ * Count the rows of one listing, announce them to sink->begin, then step the row
+ * query and hand each row to sink->row, all inside one read snapshot. The row query
+ * is limited to the counted total, so the count and the rows delivered agree. Paged
+ * counts stop at limit + 1, which is enough to know whether another page follows.
+ * Only one row struct is live at a time, however long the listing. The sink must not
+ * block (e.g. write to a socket): the connection stays locked until the scan ends.
+ */
+static int scan_listing(const char *count_sql, const char *rows_sql, uint32_t key, const db_page_t *page,
+                        row_read_fn read, void *row, const db_sink_t *sink) {
+    db_conn_t *conn = db_reader();
+    conn_lock(conn);
+    // On the writer an open group commit already is the snapshot
+    int snapshot = sqlite3_get_autocommit(conn->db) && conn_exec(conn, "BEGIN") == 0;
+
+    int total = -1;
+    sqlite3_stmt *stmt = stmt_acquire(conn, count_sql);
+    if (stmt) {
+        bind_listing(stmt, key, page, page ? page->limit + 1 : 0);
+        if (sqlite3_step(stmt) == SQLITE_ROW) total = sqlite3_column_int(stmt, 0);
+        stmt_release(conn, stmt);
+    }
 
-    int idx = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW && idx < max_items) {
-        favs[idx].id = sqlite3_column_int(stmt, 0);
-        copy_text(favs[idx].owner, sizeof(favs[idx].owner), sqlite3_column_text(stmt, 1));
-        copy_text(favs[idx].name, sizeof(favs[idx].name), sqlite3_column_text(stmt, 2));
-        copy_text(favs[idx].category, sizeof(favs[idx].category), sqlite3_column_text(stmt, 3));
-        copy_text(favs[idx].location, sizeof(favs[idx].location), sqlite3_column_text(stmt, 4));
-        favs[idx].created_at = (time_t)sqlite3_column_int64(stmt, 6);
-        idx++;
+    int rc = -1;
+    if (total >= 0) {
+        int more = page && total > page->limit;
+        int count = more ? page->limit : total;
+        rc = 0;
+        if (sink->begin(sink->ctx, count, more) == 0 && count > 0) {
+            stmt = stmt_acquire(conn, rows_sql);
+            if (stmt) {
+                bind_listing(stmt, key, page, count);
+                int step;
+                while ((step = sqlite3_step(stmt)) == SQLITE_ROW) {
+                    read(stmt, row);
+                    if (sink->row(sink->ctx, row) != 0) break;
+                }
+                if (step != SQLITE_ROW && step != SQLITE_DONE) rc = -1;
+                stmt_release(conn, stmt);
+            } else {
+                rc = -1;
+            }
+        }
     }
 
-    sqlite3_finalize(stmt);
-    *out_count = idx;
-    return 0;
+    if (snapshot) conn_exec(conn, "COMMIT");
+    pthread_mutex_unlock(&conn->lock);
+    return rc;
+}
+
+// FAVORITE PLACE DATABASE FUNCTIONS
+// Columns: id, owner_id, name, category, location, created_at
+static void read_favorite_row(sqlite3_stmt *stmt, void *row) {
+    FavoritePlace *fav = row;
+    fav->id = sqlite3_column_int(stmt, 0);
+    fav->owner_id = (uint32_t)sqlite3_column_int64(stmt, 1);
+    fav->owner = row_user_name(fav->owner_id);
+    copy_text(fav->name, sizeof(fav->name), sqlite3_column_text(stmt, 2));
+    copy_text(fav->category, sizeof(fav->category), sqlite3_column_text(stmt, 3));
+    copy_text(fav->location, sizeof(fav->location), sqlite3_column_text(stmt, 4));
+    fav->created_at = (time_t)sqlite3_column_int64(stmt, 5);
+}
+
+/**
+ * @function db_scan_user_favorites: Stream a user's favorites (FavoritePlace rows,
+ * keyed on id) to a sink.
+ *
+ * @param owner_id: Owner.
+ * @param page: Keyset page in id order, or NULL for every favorite.
+ * @param sink: Receives the count, then the rows.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int db_scan_user_favorites(uint32_t owner_id, const db_page_t *page, const db_sink_t *sink) {
+    if (!g_writer.db || !owner_id || !sink || (page && page->limit <= 0)) return -1;
+
+    FavoritePlace fav;
+    if (!page) {
+        return scan_listing(
+            "SELECT COUNT(*) FROM favorites WHERE owner_id = ?",
+            "SELECT id, owner_id, name, category, location, created_at FROM favorites "
+            "WHERE owner_id = ? ORDER BY id LIMIT ?",
+            owner_id, NULL, read_favorite_row, &fav, sink);
+    }
+    return scan_listing(
+        "SELECT COUNT(*) FROM (SELECT 1 FROM favorites WHERE owner_id = ? AND id > ? LIMIT ?)",
+        "SELECT id, owner_id, name, category, location, created_at FROM favorites "
+        "WHERE owner_id = ? AND id > ? ORDER BY id LIMIT ?",
+        owner_id, page, read_favorite_row, &fav, sink);
 }
 
-int db_create_favorite(const char *owner, const char *name, const char *category, const char *location) {
+int db_create_favorite(uint32_t owner_id, const char *name, const char *category, const char *location) {
     
-    if (!g_db || !owner || !name || !category || !location) return -1;
+    if (!g_writer.db || !owner_id || !name || !category || !location) return -1;
 
     const char *sql =
-        "INSERT INTO favorites(owner, name, category, location, created_at) "
+        "INSERT INTO favorites(owner_id, name, category, location, created_at) "
         "VALUES(?, ?, ?, ?, strftime('%s','now'))";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
 
-    sqlite3_bind_text(stmt, 1, owner, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 1, owner_id);
     sqlite3_bind_text(stmt, 2, name, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 3, category, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 4, location, -1, SQLITE_TRANSIENT);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    stmt_release(conn, stmt);
 
-    if (rc == SQLITE_CONSTRAINT) return -2;
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    if (rc == SQLITE_CONSTRAINT) return write_finish(conn, -2);
+    if (rc != SQLITE_DONE) return write_finish(conn, -1);
+
+    favorite_change_t change = { owner_id, NULL, 0 };
+    write_on_commit(favorite_change_hook, &change);
+    return write_finish(conn, 0);
 }
 
-int db_fetch_favorite_by_id(int fav_id, char *username , FavoritePlace *out_fav) {
-    printf("Entering db_fetch_favorite_by_id with fav_id: %d, username: %s\n", fav_id, username);
-    if (!g_db || fav_id <= 0 || !out_fav || !username ) return -1;
+int db_fetch_favorite_by_id(int fav_id, uint32_t owner_id, FavoritePlace *out_fav) {
+    LOG_TRACE("Entering db_fetch_favorite_by_id with fav_id: %d, owner_id: %u", fav_id, owner_id);
+    if (!g_writer.db || fav_id <= 0 || !out_fav || !owner_id) return -1;
 
     const char *sql =
-        "SELECT id, owner, name, category, location," \
-        " COALESCE(created_at,0) FROM favorites WHERE id = ? AND owner = ?";
-    printf("SQL Query: %s\n", sql);
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+        "SELECT id, owner_id, name, category, location," \
+        " COALESCE(created_at,0) FROM favorites WHERE id = ? AND owner_id = ?";
+    LOG_TRACE("SQL Query: %s", sql);
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, fav_id);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_TRANSIENT);
-    printf("Executing SQL statement...\n");
+    sqlite3_bind_int64(stmt, 2, owner_id);
+    LOG_TRACE("Executing SQL statement...");
     int step = sqlite3_step(stmt);
     if (step != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt_release(conn, stmt);
         return -2;
     }
 
-    out_fav->id = sqlite3_column_int(stmt, 0);
-    copy_text(out_fav->owner, sizeof(out_fav->owner), sqlite3_column_text(stmt, 1));
-    copy_text(out_fav->name, sizeof(out_fav->name), sqlite3_column_text(stmt, 2));
-    copy_text(out_fav->category, sizeof(out_fav->category), sqlite3_column_text(stmt, 3));
-    copy_text(out_fav->location, sizeof(out_fav->location), sqlite3_column_text(stmt, 4));
-    out_fav->created_at = (time_t)sqlite3_column_int64(stmt, 5);
+    read_favorite_row(stmt, out_fav);
 
-    sqlite3_finalize(stmt);
+    stmt_release(conn, stmt);
     return 0;
 }
 
-int db_update_favorite(int fav_id, const char *owner, const char *name, const char *category, const char *location) {
-    if (!g_db || fav_id <= 0 || !owner || !name || !category || !location) return -1;
+// Add the users tagged in fav_id to change->tagged (caller frees); 0 on success, -1 on error
+static int favorite_tagged_users(db_conn_t *conn, int fav_id, favorite_change_t *change) {
+    sqlite3_stmt *stmt = stmt_acquire(conn, "SELECT tagged_id FROM favorite_tags WHERE fav_id = ?");
+    if (!stmt) return -1;
+    sqlite3_bind_int(stmt, 1, fav_id);
+    int cap = 0, step;
+    while ((step = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (change->ntagged == cap) {
+            int grown = cap ? cap * 2 : 8;
+            uint32_t *tagged = realloc(change->tagged, (size_t)grown * sizeof(*tagged));
+            if (!tagged) break;
+            change->tagged = tagged;
+            cap = grown;
+        }
+        change->tagged[change->ntagged++] = (uint32_t)sqlite3_column_int64(stmt, 0);
+    }
+    stmt_release(conn, stmt);
+    return step == SQLITE_DONE ? 0 : -1;
+}
+
+int db_update_favorite(int fav_id, uint32_t owner_id, const char *name, const char *category, const char *location) {
+    if (!g_writer.db || fav_id <= 0 || !owner_id || !name || !category || !location) return -1;
 
     const char *sql =
         "UPDATE favorites SET name = ?, category = ?, location = ? "
-        "WHERE id = ? AND owner = ?";
+        "WHERE id = ? AND owner_id = ?";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    favorite_change_t change = { owner_id, NULL, 0 };
+    db_conn_t *conn = write_begin();
+    if (favorite_tagged_users(conn, fav_id, &change) != 0) {
+        free(change.tagged);
+        return write_finish(conn, -1);
+    }
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) {
+        free(change.tagged);
+        return write_finish(conn, -1);
+    }
 
     sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, category, -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 3, location, -1, SQLITE_TRANSIENT);
     sqlite3_bind_int(stmt, 4, fav_id);
-    sqlite3_bind_text(stmt, 5, owner, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 5, owner_id);
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    if (rc == SQLITE_CONSTRAINT) return -2;
-    if (sqlite3_changes(g_db) == 0) return -3;
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
+
+    int result = rc == SQLITE_CONSTRAINT ? -2 : changed == 0 ? -3 : rc == SQLITE_DONE ? 0 : -1;
+    if (result == 0) write_on_commit(favorite_change_hook, &change);
+    result = write_finish(conn, result);
+    free(change.tagged);
+    return result;
 }
 
-int db_delete_favorite(int fav_id, const char *owner) {
-    if (!g_db || fav_id <= 0 || !owner) return -1;
+int db_delete_favorite(int fav_id, uint32_t owner_id) {
+    if (!g_writer.db || fav_id <= 0 || !owner_id) return -1;
 
-    const char *sql = "DELETE FROM favorites WHERE id = ? AND owner = ?";
+    const char *sql = "DELETE FROM favorites WHERE id = ? AND owner_id = ?";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    // Tags go with the favorite (ON DELETE CASCADE), so read who was tagged first
+    favorite_change_t change = { owner_id, NULL, 0 };
+    db_conn_t *conn = write_begin();
+    if (favorite_tagged_users(conn, fav_id, &change) != 0) {
+        free(change.tagged);
+        return write_finish(conn, -1);
+    }
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) {
+        free(change.tagged);
+        return write_finish(conn, -1);
+    }
 
     sqlite3_bind_int(stmt, 1, fav_id);
-    sqlite3_bind_text(stmt, 2, owner, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, owner_id);
 
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    if (rc == SQLITE_CONSTRAINT ) return -2;
-    if (sqlite3_changes(g_db) == 0) return -3;
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
+
+    int result = rc == SQLITE_CONSTRAINT ? -2 : changed == 0 ? -3 : rc == SQLITE_DONE ? 0 : -1;
+    if (result == 0) write_on_commit(favorite_change_hook, &change);
+    result = write_finish(conn, result);
+    free(change.tagged);
+    return result;
 }
 
-int db_fetch_tagged_favorites(const char *username, FavoritePlaceWithTags favs[], int max_items, int *out_count) {
-    if( !g_db || !username || !out_count || max_items <= 0) return -1;
-
-    *out_count = 0;
-    if(!favs) return 0;
-
-    const char * sql =
-        "SELECT f.id, f.owner, f.name, f.category, f.location, f.created_at, ft.tagger "
-        "FROM favorites f "
-        "JOIN favorite_tags ft ON f.id = ft.fav_id "
-        "WHERE ft.tagged_users = ? "
-        "ORDER BY f.created_at DESC";
+// Columns: favorite columns as in read_favorite_row, then tagger_id
+static void read_tagged_row(sqlite3_stmt *stmt, void *row) {
+    FavoritePlaceWithTags *fav = row;
+    fav->id = sqlite3_column_int(stmt, 0);
+    fav->owner_id = (uint32_t)sqlite3_column_int64(stmt, 1);
+    fav->owner = row_user_name(fav->owner_id);
+    copy_text(fav->name, sizeof(fav->name), sqlite3_column_text(stmt, 2));
+    copy_text(fav->category, sizeof(fav->category), sqlite3_column_text(stmt, 3));
+    copy_text(fav->location, sizeof(fav->location), sqlite3_column_text(stmt, 4));
+    fav->created_at = (time_t)sqlite3_column_int64(stmt, 5);
+    fav->tagger_id = (uint32_t)sqlite3_column_int64(stmt, 6);
+    fav->tagger = row_user_name(fav->tagger_id);
+}
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
-    int idx = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW && idx < max_items) {
-        favs[idx].id = sqlite3_column_int(stmt, 0);
-        copy_text(favs[idx].owner, sizeof(favs[idx].owner), sqlite3_column_text(stmt, 1));
-        copy_text(favs[idx].name, sizeof(favs[idx].name), sqlite3_column_text(stmt, 2));
-        copy_text(favs[idx].category, sizeof(favs[idx].category), sqlite3_column_text(stmt, 3));
-        copy_text(favs[idx].location, sizeof(favs[idx].location), sqlite3_column_text(stmt, 4));
-        favs[idx].created_at = (time_t)sqlite3_column_int64(stmt, 5);
-        copy_text(favs[idx].tagger, sizeof(favs[idx].tagger), sqlite3_column_text(stmt, 6));
-        idx++;
+/**
+ * @function db_scan_tagged_favorites: Stream the favorites a user was tagged in
+ * (FavoritePlaceWithTags rows, keyed on favorite id) to a sink.
+ *
+ * @param user_id: Tagged user.
+ * @param page: Keyset page in favorite id order, or NULL for every tag, newest
+ * favorite first.
+ * @param sink: Receives the count, then the rows.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int db_scan_tagged_favorites(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+    if (!g_writer.db || !user_id || !sink || (page && page->limit <= 0)) return -1;
+
+    FavoritePlaceWithTags fav;
+    if (!page) {
+        return scan_listing(
+            "SELECT COUNT(*) FROM favorite_tags ft "
+            "JOIN favorites f ON f.id = ft.fav_id "
+            "WHERE ft.tagged_id = ?",
+            "SELECT f.id, f.owner_id, f.name, f.category, f.location, f.created_at, ft.tagger_id "
+            "FROM favorites f "
+            "JOIN favorite_tags ft ON f.id = ft.fav_id "
+            "WHERE ft.tagged_id = ? "
+            "ORDER BY f.created_at DESC LIMIT ?",
+            user_id, NULL, read_tagged_row, &fav, sink);
     }
-    sqlite3_finalize(stmt);
-    *out_count = idx;
-    return 0;
+    return scan_listing(
+        "SELECT COUNT(*) FROM (SELECT 1 FROM favorite_tags ft "
+        "JOIN favorites f ON f.id = ft.fav_id "
+        "WHERE ft.tagged_id = ? AND ft.fav_id > ? LIMIT ?)",
+        "SELECT f.id, f.owner_id, f.name, f.category, f.location, f.created_at, ft.tagger_id "
+        "FROM favorite_tags ft "
+        "JOIN favorites f ON f.id = ft.fav_id "
+        "WHERE ft.tagged_id = ? AND ft.fav_id > ? "
+        "ORDER BY ft.fav_id LIMIT ?",
+        user_id, page, read_tagged_row, &fav, sink);
 }
 
 // FRIEND DATABASE FUNCTIONS
-int db_fetch_user_friends(const char *username, FriendRel friends[], int max_items, int *out_count) {
-    if (!g_db || !username || !out_count || max_items <= 0) return -1;
-
-    *out_count = 0;
-    if (!friends) return 0;
-
-    const char *sql =
-        "SELECT user_a, user_b, since FROM friendships "
-        "WHERE user_a = ? OR user_b = ? ORDER BY since DESC";
-
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_TRANSIENT);
-
-    int idx = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW && idx < max_items) {
-        copy_text(friends[idx].user_a, sizeof(friends[idx].user_a), sqlite3_column_text(stmt, 0));
-        copy_text(friends[idx].user_b, sizeof(friends[idx].user_b), sqlite3_column_text(stmt, 1));
-        friends[idx].since = (time_t)sqlite3_column_int64(stmt, 2);
-        idx++;
-    }
-
-    sqlite3_finalize(stmt);
-    *out_count = idx;
-    return 0;
+// Answered from the friend graph; friendships is only read at startup
+// Turns friend graph callbacks into FriendRel rows for a db_sink_t
+typedef struct {
+    uint32_t self;
+    const db_sink_t *sink;
+    FriendRel rel;
+} friend_scan_t;
+
+static int friend_scan_begin(void *ctx, int count, int more) {
+    friend_scan_t *scan = ctx;
+    return scan->sink->begin(scan->sink->ctx, count, more);
 }
 
-int db_fetch_user_requests(const char *username, FriendRequest requests[], int max_items, int *out_count) {
-    if (!g_db || !username || !out_count || max_items <= 0) return -1;
-
-    *out_count = 0;
-    if (!requests) return 0;
-
-    const char *sql =
-        "SELECT id, requester, requestee, status, created_at FROM friend_requests "
-        "WHERE requestee = ? ORDER BY created_at DESC";
-
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_TRANSIENT);
-
-    int idx = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW && idx < max_items) {
-        requests[idx].id = sqlite3_column_int(stmt, 0);
-        copy_text(requests[idx].from, sizeof(requests[idx].from), sqlite3_column_text(stmt, 1));
-        copy_text(requests[idx].to, sizeof(requests[idx].to), sqlite3_column_text(stmt, 2));
-        requests[idx].status = sqlite3_column_int(stmt, 3);
-        requests[idx].created_at = (time_t)sqlite3_column_int64(stmt, 4);
-        idx++;
-    }
-
-    sqlite3_finalize(stmt);
-    *out_count = idx;
-    return 0;
+// Rows hold the pair in stored order (user_a_id < user_b_id), like the friendships table
+static int friend_scan_row(void *ctx, uint32_t peer, time_t since) {
+    friend_scan_t *scan = ctx;
+    scan->rel.user_a_id = scan->self < peer ? scan->self : peer;
+    scan->rel.user_b_id = scan->self < peer ? peer : scan->self;
+    scan->rel.user_a = row_user_name(scan->rel.user_a_id);
+    scan->rel.user_b = row_user_name(scan->rel.user_b_id);
+    scan->rel.since = since;
+    return scan->sink->row(scan->sink->ctx, &scan->rel);
 }
 
+/**
+ * @function db_scan_user_friends: Stream a user's friends (FriendRel rows, keyed on the
+ * friend's user id) to a sink. Answered from the friend graph; friendships is only
+ * read at startup.
+ *
+ * @param user_id: User whose friends are listed.
+ * @param page: Keyset page in friend id order, or NULL for every friend, newest
+ * friendship first.
+ * @param sink: Receives the count, then the rows.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int db_scan_user_friends(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+    if (!g_writer.db || !user_id || !sink || (page && page->limit <= 0)) return -1;
+
+    friend_scan_t scan = { .self = user_id, .sink = sink };
+    return friend_graph_scan(user_id, page ? page->after : 0, page ? page->limit : 0, page != NULL,
+                             friend_scan_begin, friend_scan_row, &scan);
+}
 
-int db_check_duplicate_friend_request(const char *from_user, const char *to_user) {
-    if (!g_db || !from_user || !to_user) return -1;
-
-    const char *sql =
-        "SELECT COUNT(*) FROM friend_requests "
-        "WHERE requester = ? AND requestee = ? AND status = 0";
-
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
-
-    sqlite3_bind_text(stmt, 1, from_user, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, to_user, -1, SQLITE_TRANSIENT);
+// Columns: id, requester_id, requestee_id, status, created_at
+static void read_request_row(sqlite3_stmt *stmt, void *row) {
+    FriendRequest *request = row;
+    request->id = sqlite3_column_int(stmt, 0);
+    request->from_id = (uint32_t)sqlite3_column_int64(stmt, 1);
+    request->to_id = (uint32_t)sqlite3_column_int64(stmt, 2);
+    request->from = row_user_name(request->from_id);
+    request->to = row_user_name(request->to_id);
+    request->status = sqlite3_column_int(stmt, 3);
+    request->created_at = (time_t)sqlite3_column_int64(stmt, 4);
+}
 
-    int rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        return -1;
+/**
+ * @function db_scan_user_requests: Stream the friend requests sent to a user
+ * (FriendRequest rows, keyed on id) to a sink.
+ *
+ * @param user_id: Requestee.
+ * @param page: Keyset page in id order, or NULL for every request, newest first.
+ * @param sink: Receives the count, then the rows.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int db_scan_user_requests(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+    if (!g_writer.db || !user_id || !sink || (page && page->limit <= 0)) return -1;
+
+    FriendRequest request;
+    if (!page) {
+        return scan_listing(
+            "SELECT COUNT(*) FROM friend_requests WHERE requestee_id = ?",
+            "SELECT id, requester_id, requestee_id, status, created_at FROM friend_requests "
+            "WHERE requestee_id = ? ORDER BY created_at DESC LIMIT ?",
+            user_id, NULL, read_request_row, &request, sink);
     }
+    return scan_listing(
+        "SELECT COUNT(*) FROM (SELECT 1 FROM friend_requests WHERE requestee_id = ? AND id > ? LIMIT ?)",
+        "SELECT id, requester_id, requestee_id, status, created_at FROM friend_requests "
+        "WHERE requestee_id = ? AND id > ? ORDER BY id LIMIT ?",
+        user_id, page, read_request_row, &request, sink);
+}
 
-    int count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
 
-    return (count > 0) ? 1 : 0;
+// Are a and b friends in the open write transaction? 1 yes, 0 no, -1 on error. The
+// friend graph only follows once a whole group commit lands, so writes check here.
+static int friends_stored(db_conn_t *conn, uint32_t a, uint32_t b) {
+    sqlite3_stmt *stmt = stmt_acquire(conn,
+        "SELECT 1 FROM friendships WHERE user_a_id = MIN(?1, ?2) AND user_b_id = MAX(?1, ?2)");
+    if (!stmt) return -1;
+    sqlite3_bind_int64(stmt, 1, a);
+    sqlite3_bind_int64(stmt, 2, b);
+    int step = sqlite3_step(stmt);
+    stmt_release(conn, stmt);
+    if (step == SQLITE_ROW) return 1;
+    return step == SQLITE_DONE ? 0 : -1;
 }
 
-int db_create_friend_request(const char *from_user, const char *to_user) {
-    if (!g_db || !from_user || !to_user) return -1;
+/**
+ * @function db_send_friend_request: Validate and record a friend request as one write.
+ * The target is resolved from the user directory; the friendship check, the duplicate
+ * check and the insert are a single statement. All of it runs under the writer lock
+ * inside one savepoint, so two concurrent requests for the same pair cannot both get
+ * through, and a friendship accepted earlier in the same group commit is seen.
+ *
+ * @param from_id: Requester.
+ * @param to_name: Username of the requestee, as received.
+ * @param out_to_id: Requestee id when known (may be NULL).
+ *
+ * @return 0 if sent, -2 if there is no such user, -3 if they are already friends,
+ * -4 if a pending request already exists, -5 for a request to oneself, -1 on error.
+ */
+int db_send_friend_request(uint32_t from_id, const char *to_name, uint32_t *out_to_id) {
+    if (!g_writer.db || !from_id || !to_name) return -1;
+
+    uint32_t to_id = 0;
+    int rc = db_user_id(to_name, &to_id);
+    if (rc != 0) return rc;
+    if (out_to_id) *out_to_id = to_id;
+    if (to_id == from_id) return -5;
 
     const char *sql =
-        "INSERT INTO friend_requests(requester, requestee, status, created_at) "
-        "VALUES(?, ?, 0, strftime('%s','now'))";
+        "INSERT INTO friend_requests(requester_id, requestee_id, status, created_at) "
+        "SELECT ?1, ?2, 0, strftime('%s','now') "
+        "WHERE NOT EXISTS (SELECT 1 FROM friend_requests "
+        "WHERE requester_id = ?1 AND requestee_id = ?2 AND status = 0) "
+        "AND NOT EXISTS (SELECT 1 FROM friendships "
+        "WHERE user_a_id = MIN(?1, ?2) AND user_b_id = MAX(?1, ?2))";
+
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
+    sqlite3_bind_int64(stmt, 1, from_id);
+    sqlite3_bind_int64(stmt, 2, to_id);
+    int step = sqlite3_step(stmt);
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
-    sqlite3_bind_text(stmt, 1, from_user, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, to_user, -1, SQLITE_TRANSIENT);
+    if (step != SQLITE_DONE) return write_finish(conn, -1);
+    if (changed) return write_finish(conn, 0);
 
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    if (rc == SQLITE_CONSTRAINT) return -2;
-    return (rc == SQLITE_DONE) ? 0 : -1;
+    int friends = friends_stored(conn, from_id, to_id);
+    return write_finish(conn, friends == 1 ? -3 : friends == 0 ? -4 : -1);
 }
 
-int db_fetch_friend_request_by_id(int request_id, char *username ,FriendRequest *out_request) {
-    if (!g_db || !out_request || request_id <= 0 || !username) return -1;
+int db_fetch_friend_request_by_id(int request_id, uint32_t requestee_id, FriendRequest *out_request) {
+    if (!g_writer.db || !out_request || request_id <= 0 || !requestee_id) return -1;
 
     const char *sql =
-        "SELECT id, requester, requestee, status, created_at FROM friend_requests WHERE id = ? AND requestee = ?";
+        "SELECT id, requester_id, requestee_id, status, created_at FROM friend_requests "
+        "WHERE id = ? AND requestee_id = ?";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return -1;
     sqlite3_bind_int(stmt, 1, request_id);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, requestee_id);
 
     int step = sqlite3_step(stmt);
     if (step != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt_release(conn, stmt);
         return -2;
     }
 
-    out_request->id = sqlite3_column_int(stmt, 0);
-    copy_text(out_request->from, sizeof(out_request->from), sqlite3_column_text(stmt, 1));
-    copy_text(out_request->to, sizeof(out_request->to), sqlite3_column_text(stmt, 2));
-    out_request->status = sqlite3_column_int(stmt, 3);
-    out_request->created_at = (time_t)sqlite3_column_int64(stmt, 4);
+    read_request_row(stmt, out_request);
 
-    sqlite3_finalize(stmt);
+    stmt_release(conn, stmt);
     return 0;
 }
 
-int db_accept_friend_request(int request_id, const char *requestee) {
-    if (!g_db || !requestee || request_id <= 0) return -1;
+int db_accept_friend_request(int request_id, uint32_t requestee_id) {
+    if (!g_writer.db || !requestee_id || request_id <= 0) return -1;
 
-    char *errmsg = NULL;
-    if (sqlite3_exec(g_db, "BEGIN IMMEDIATE", NULL, NULL, &errmsg) != SQLITE_OK) {
-        if (errmsg) sqlite3_free(errmsg);
-        return -1;
-    }
+    // One savepoint in the group commit batch; the writer stays locked until write_finish
+    db_conn_t *conn = write_begin();
 
     const char *select_sql =
-        "SELECT requester, requestee, status FROM friend_requests WHERE id = ?";
+        "SELECT requester_id, requestee_id, status FROM friend_requests WHERE id = ?";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, select_sql, -1, &stmt, NULL) != SQLITE_OK) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -1;
-    }
+    sqlite3_stmt *stmt = stmt_acquire(conn, select_sql);
+    if (!stmt) return write_finish(conn, -1);
 
     sqlite3_bind_int(stmt, 1, request_id);
     int step = sqlite3_step(stmt);
     if (step != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -2;
+        stmt_release(conn, stmt);
+        return write_finish(conn, -2);
     }
 
-    char requester[MAX_NAME_LEN];
-    char requestee_from_db[MAX_NAME_LEN];
-    copy_text(requester, sizeof(requester), sqlite3_column_text(stmt, 0));
-    copy_text(requestee_from_db, sizeof(requestee_from_db), sqlite3_column_text(stmt, 1));
+    uint32_t requester = (uint32_t)sqlite3_column_int64(stmt, 0);
+    uint32_t requestee_from_db = (uint32_t)sqlite3_column_int64(stmt, 1);
     int status = sqlite3_column_int(stmt, 2);
-    sqlite3_finalize(stmt);
+    stmt_release(conn, stmt);
 
-    if (strcmp(requestee_from_db, requestee) != 0) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -4;
-    }
-    if (status != 0) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -3;
-    }
+    if (requestee_from_db != requestee_id) return write_finish(conn, -4);
+    if (status != 0) return write_finish(conn, -3);
+    if (requester == requestee_id) return write_finish(conn, -1);
 
-    char user_a[MAX_NAME_LEN];
-    char user_b[MAX_NAME_LEN];
-    if (strcmp(requester, requestee_from_db) < 0) {
-        strncpy(user_a, requester, sizeof(user_a));
-        strncpy(user_b, requestee_from_db, sizeof(user_b));
-    } else {
-        strncpy(user_a, requestee_from_db, sizeof(user_a));
-        strncpy(user_b, requester, sizeof(user_b));
-    }
-    user_a[sizeof(user_a) - 1] = '\0';
-    user_b[sizeof(user_b) - 1] = '\0';
+    // Stored once per pair, lower id first
+    friendship_change_t change = {
+        requester < requestee_id ? requester : requestee_id,
+        requester < requestee_id ? requestee_id : requester,
+        time(NULL)
+    };
 
     const char *insert_friend_sql =
-        "INSERT OR IGNORE INTO friendships(user_a, user_b, since) "
+        "INSERT OR IGNORE INTO friendships(user_a_id, user_b_id, since) "
         "VALUES(?, ?, strftime('%s','now'))";
 
-    if (sqlite3_prepare_v2(g_db, insert_friend_sql, -1, &stmt, NULL) != SQLITE_OK) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -1;
-    }
-    sqlite3_bind_text(stmt, 1, user_a, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, user_b, -1, SQLITE_TRANSIENT);
+    stmt = stmt_acquire(conn, insert_friend_sql);
+    if (!stmt) return write_finish(conn, -1);
+    sqlite3_bind_int64(stmt, 1, change.user_a);
+    sqlite3_bind_int64(stmt, 2, change.user_b);
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if (rc != SQLITE_DONE) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -1;
-    }
+    stmt_release(conn, stmt);
+    if (rc != SQLITE_DONE) return write_finish(conn, -1);
 
     const char *update_sql = "UPDATE friend_requests SET status = 1 WHERE id = ?";
-    if (sqlite3_prepare_v2(g_db, update_sql, -1, &stmt, NULL) != SQLITE_OK) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -1;
-    }
+    stmt = stmt_acquire(conn, update_sql);
+    if (!stmt) return write_finish(conn, -1);
     sqlite3_bind_int(stmt, 1, request_id);
     rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if (rc != SQLITE_DONE) {
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -1;
-    }
-
-    if (sqlite3_exec(g_db, "COMMIT", NULL, NULL, &errmsg) != SQLITE_OK) {
-        if (errmsg) sqlite3_free(errmsg);
-        sqlite3_exec(g_db, "ROLLBACK", NULL, NULL, NULL);
-        return -1;
-    }
+    stmt_release(conn, stmt);
+    if (rc != SQLITE_DONE) return write_finish(conn, -1);
 
-    return 0;
+    write_on_commit(graph_add_hook, &change);
+    return write_finish(conn, 0);
 }
 
-int db_reject_friend_request(int request_id, const char *requestee) {
-    if (!g_db || !requestee || request_id <= 0) return -1;
+int db_reject_friend_request(int request_id, uint32_t requestee_id) {
+    if (!g_writer.db || !requestee_id || request_id <= 0) return -1;
 
-    const char *sql = "DELETE FROM friend_requests WHERE id = ? AND requestee = ? AND status = 0";
+    const char *sql = "DELETE FROM friend_requests WHERE id = ? AND requestee_id = ? AND status = 0";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
 
     sqlite3_bind_int(stmt, 1, request_id);
-    sqlite3_bind_text(stmt, 2, requestee, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, requestee_id);
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if(rc == SQLITE_CONSTRAINT) return -2;
-    if (rc != SQLITE_DONE) return -1;
-    int changed = sqlite3_changes(g_db);
-    if (changed == 0) return -3;
-    return 0;
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
+    if(rc == SQLITE_CONSTRAINT) return write_finish(conn, -2);
+    if (rc != SQLITE_DONE) return write_finish(conn, -1);
+    if (changed == 0) return write_finish(conn, -3);
+    return write_finish(conn, 0);
 }
 
-int db_remove_friendship(const char *user_a, const char *user_b) {
-    if (!g_db || !user_a || !user_b) return -1;
+int db_remove_friendship(uint32_t user_a_id, uint32_t user_b_id) {
+    if (!g_writer.db || !user_a_id || !user_b_id) return -1;
 
-    const char *sql =
-        "DELETE FROM friendships WHERE "
-        "(user_a = ? AND user_b = ?) OR (user_a = ? AND user_b = ?)";
+    const char *sql = "DELETE FROM friendships WHERE user_a_id = ? AND user_b_id = ?";
+    friendship_change_t change = {
+        user_a_id < user_b_id ? user_a_id : user_b_id,
+        user_a_id < user_b_id ? user_b_id : user_a_id,
+        0
+    };
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
 
-    sqlite3_bind_text(stmt, 1, user_a, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, user_b, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, user_b, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 4, user_a, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 1, change.user_a);
+    sqlite3_bind_int64(stmt, 2, change.user_b);
     int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if (rc != SQLITE_DONE) return -1;
-    if (rc == SQLITE_CONSTRAINT) return -2;
-    int changed = sqlite3_changes(g_db);
-    if (changed == 0) return -3;
-    return 0;
-}
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
+    if (rc != SQLITE_DONE) return write_finish(conn, -1);
+    if (changed == 0) return write_finish(conn, -3);
 
-int db_check_friendship(const char *user_a, const char *user_b) {
-    if (!g_db || !user_a || !user_b) return -1;
+    write_on_commit(graph_remove_hook, &change);
+    return write_finish(conn, 0);
+}
 
-    const char *sql =
-        "SELECT COUNT(*) FROM friendships WHERE "
-        "(user_a = ? AND user_b = ?) OR (user_a = ? AND user_b = ?)";
+int db_check_friendship(uint32_t user_a_id, uint32_t user_b_id) {
+    if (!g_writer.db || !user_a_id || !user_b_id) return -1;
+    return friend_graph_check(user_a_id, user_b_id);
+}
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+// Does owner_id own favorite fav_id? 1 yes, 0 no, -1 on error
+static int favorite_owned(db_conn_t *conn, int fav_id, uint32_t owner_id) {
+    sqlite3_stmt *stmt = stmt_acquire(conn, "SELECT 1 FROM favorites WHERE id = ? AND owner_id = ?");
+    if (!stmt) return -1;
+    sqlite3_bind_int(stmt, 1, fav_id);
+    sqlite3_bind_int64(stmt, 2, owner_id);
+    int step = sqlite3_step(stmt);
+    stmt_release(conn, stmt);
+    if (step == SQLITE_ROW) return 1;
+    return step == SQLITE_DONE ? 0 : -1;
+}
 
-    sqlite3_bind_text(stmt, 1, user_a, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, user_b, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, user_b, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 4, user_a, -1, SQLITE_TRANSIENT);
+/**
+ * @function db_tag_friend: Validate and record a tag as one write. The tagged user is
+ * resolved from the user directory; the ownership check, the friendship check and the
+ * insert are a single INSERT ... SELECT. Only when nothing was inserted are the
+ * favorite and the friendship looked up again, to tell the failures apart.
+ *
+ * @param fav_id: Favorite, which must belong to the tagger.
+ * @param tagger_id: User tagging.
+ * @param tagged_name: Username of the friend being tagged, as received.
+ *
+ * @return 0 if tagged, -2 if the tagger has no such favorite, -3 if there is no such
+ * user, -4 if they are not friends, -5 if the tag already exists, -1 on error.
+ */
+int db_tag_friend(int fav_id, uint32_t tagger_id, const char *tagged_name, uint32_t *out_tagged_id) {
+    if (!g_writer.db || fav_id <= 0 || !tagger_id || !tagged_name) return -1;
+
+    uint32_t tagged_id = 0;
+    int rc = db_user_id(tagged_name, &tagged_id);
+    if (rc == -2) return -3;
+    if (rc != 0) return rc;
+    if (out_tagged_id) *out_tagged_id = tagged_id;
+
+    const char *insert_sql =
+        "INSERT OR IGNORE INTO favorite_tags(fav_id, tagger_id, tagged_id) "
+        "SELECT id, owner_id, ?1 FROM favorites WHERE id = ?2 AND owner_id = ?3 "
+        "AND EXISTS (SELECT 1 FROM friendships "
+        "WHERE user_a_id = MIN(?1, ?3) AND user_b_id = MAX(?1, ?3))";
+
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, insert_sql);
+    if (!stmt) return write_finish(conn, -1);
+    sqlite3_bind_int64(stmt, 1, tagged_id);
+    sqlite3_bind_int(stmt, 2, fav_id);
+    sqlite3_bind_int64(stmt, 3, tagger_id);
     int step = sqlite3_step(stmt);
-    if (step != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        return -1;
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
+    if (step != SQLITE_DONE) return write_finish(conn, -1);
+    if (changed) {
+        favorite_change_t change = { 0, &tagged_id, 1 };
+        write_on_commit(favorite_change_hook, &change);
+        return write_finish(conn, 0);
     }
-    int count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    return (count > 0) ? 1 : 0;
+
+    // Missing favorite first, then missing friendship, as the separate checks reported
+    int owned = favorite_owned(conn, fav_id, tagger_id);
+    if (owned != 1) return write_finish(conn, owned == 0 ? -2 : -1);
+    int friends = friends_stored(conn, tagger_id, tagged_id);
+    return write_finish(conn, friends == 1 ? -5 : friends == 0 ? -4 : -1);
 }
 
-int db_tag_friend_to_favorite(int fav_id, const char *tagger, const char *tagged_users) {
-    if (!g_db || fav_id <= 0 || !tagger || !tagged_users) return -1;
 
-    const char *sql =
-        "INSERT INTO favorite_tags(fav_id, tagger, tagged_users) VALUES(?, ?, ?)";
 
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(g_db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+// NOTIFICATION DATABASE FUNCTIONS
+/**
+ * @function db_create_notifications: Store a batch of notifications as one write, so
+ * a burst of them costs one transaction.
+ *
+ * @param notes: to_id, from_id, fav_id (0 for none) and message of each are stored;
+ * id and created_at are filled in.
+ * @param count: Entries in notes.
+ *
+ * @return 0 if all were stored, -1 on error (none are).
+ */
+int db_create_notifications(Notification notes[], int count) {
+    if (!g_writer.db || !notes || count <= 0) return -1;
 
-    sqlite3_bind_int(stmt, 1, fav_id);
-    sqlite3_bind_text(stmt, 2, tagger, -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, tagged_users, -1, SQLITE_TRANSIENT);
-    int rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    if (rc == SQLITE_CONSTRAINT) return -2;
-    if (rc != SQLITE_DONE) return -1;
-    return 0;
+    const char *sql =
+        "INSERT INTO notifications(recipient_id, actor_id, fav_id, message, seen, created_at, kind) "
+        "VALUES(?, ?, ?, ?, 0, ?, ?)";
+    time_t now = time(NULL);
+
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
+    for (int i = 0; i < count; ++i) {
+        Notification *note = &notes[i];
+        note->created_at = now;
+        note->seen = 0;
+        sqlite3_bind_int64(stmt, 1, note->to_id);
+        sqlite3_bind_int64(stmt, 2, note->from_id);
+        if (note->fav_id > 0) sqlite3_bind_int(stmt, 3, note->fav_id);
+        else sqlite3_bind_null(stmt, 3);
+        sqlite3_bind_text(stmt, 4, note->message, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 5, (sqlite3_int64)now);
+        if (note->kind >= 0) sqlite3_bind_int(stmt, 6, note->kind);
+        else sqlite3_bind_null(stmt, 6);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            stmt_release(conn, stmt);
+            return write_finish(conn, -1);
+        }
+        note->id = (int)sqlite3_last_insert_rowid(conn->db);
+        sqlite3_reset(stmt);
+    }
+    stmt_release(conn, stmt);
+    return write_finish(conn, 0);
 }
 
+/**
+ * @function db_mark_notification_seen: Mark one of a user's notifications as seen.
+ *
+ * @param notif_id: Notification id.
+ * @param recipient_id: User the notification must belong to.
+ *
+ * @return 0 on success, -2 if the user has no such notification, -1 on error.
+ */
+int db_mark_notification_seen(int notif_id, uint32_t recipient_id) {
+    if (!g_writer.db || notif_id <= 0 || !recipient_id) return -1;
+
+    const char *sql = "UPDATE notifications SET seen = 1 WHERE id = ? AND recipient_id = ?";
+    db_conn_t *conn = write_begin();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return write_finish(conn, -1);
+    sqlite3_bind_int(stmt, 1, notif_id);
+    sqlite3_bind_int64(stmt, 2, recipient_id);
 
+    int step = sqlite3_step(stmt);
+    int changed = sqlite3_changes(conn->db);
+    stmt_release(conn, stmt);
+    if (step != SQLITE_DONE) return write_finish(conn, -1);
+    return write_finish(conn, changed ? 0 : -2);
+}
 
-// NOTIFICATION DATABASE FUNCTIONS
-int db_fetch_user_notifications(const char *username, Notification notifications[], int max_items, int *out_count) {
-    // implementation later
+// Columns: id, recipient_id, actor_id, fav_id, message, seen, created_at, kind
+static void read_notification_row(sqlite3_stmt *stmt, void *row) {
+    Notification *note = row;
+    note->id = sqlite3_column_int(stmt, 0);
+    note->to_id = (uint32_t)sqlite3_column_int64(stmt, 1);
+    note->from_id = (uint32_t)sqlite3_column_int64(stmt, 2);
+    note->to = row_user_name(note->to_id);
+    note->from = row_user_name(note->from_id);
+    note->fav_id = sqlite3_column_int(stmt, 3);
+    copy_text(note->message, sizeof(note->message), sqlite3_column_text(stmt, 4));
+    note->seen = sqlite3_column_int(stmt, 5);
+    note->created_at = (time_t)sqlite3_column_int64(stmt, 6);
+    note->kind = sqlite3_column_type(stmt, 7) == SQLITE_NULL ? -1 : sqlite3_column_int(stmt, 7);
+}
+
+/**
+ * @function db_scan_user_notifications: Stream a user's notifications (Notification
+ * rows, keyed on id) to a sink; the backlog of whatever was pushed while offline.
+ *
+ * @param user_id: Recipient.
+ * @param page: Keyset page in id order, or NULL for every notification, newest first.
+ * @param sink: Receives the count, then the rows.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int db_scan_user_notifications(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+    if (!g_writer.db || !user_id || !sink || (page && page->limit <= 0)) return -1;
+
+    Notification note;
+    if (!page) {
+        return scan_listing(
+            "SELECT COUNT(*) FROM notifications WHERE recipient_id = ?",
+            "SELECT id, recipient_id, actor_id, fav_id, message, seen, created_at, kind FROM notifications "
+            "WHERE recipient_id = ? ORDER BY id DESC LIMIT ?",
+            user_id, NULL, read_notification_row, &note, sink);
+    }
+    return scan_listing(
+        "SELECT COUNT(*) FROM (SELECT 1 FROM notifications WHERE recipient_id = ? AND id > ? LIMIT ?)",
+        "SELECT id, recipient_id, actor_id, fav_id, message, seen, created_at, kind FROM notifications "
+        "WHERE recipient_id = ? AND id > ? ORDER BY id LIMIT ?",
+        user_id, page, read_notification_row, &note, sink);
 }
 
+/**
+ * @function db_notification_versions: Newest notification id of each kind a user has,
+ * the starting point of their WATCH versions.
+ *
+ * @param user_id: Recipient.
+ * @param versions: Filled per kind, 0 where the user has none.
+ * @param nkinds: Entries in versions.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int db_notification_versions(uint32_t user_id, uint32_t versions[], int nkinds) {
+    if (!g_writer.db || !user_id || !versions || nkinds <= 0) return -1;
+    memset(versions, 0, sizeof(versions[0]) * (size_t)nkinds);
 
-int db_mark_notification_seen(int notif_id) {
-    // implementation later
+    const char *sql =
+        "SELECT kind, MAX(id) FROM notifications WHERE recipient_id = ? AND kind IS NOT NULL GROUP BY kind";
+    db_conn_t *conn = db_reader();
+    sqlite3_stmt *stmt = stmt_acquire(conn, sql);
+    if (!stmt) return -1;
+    sqlite3_bind_int64(stmt, 1, user_id);
+
+    int step;
+    while ((step = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int kind = sqlite3_column_int(stmt, 0);
+        if (kind >= 0 && kind < nkinds) versions[kind] = (uint32_t)sqlite3_column_int64(stmt, 1);
+    }
+    stmt_release(conn, stmt);
+    return step == SQLITE_DONE ? 0 : -1;
 }
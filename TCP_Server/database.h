@@ -3,39 +3,109 @@
 
 #include <time.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "../entity/entities.h"
+
+#define DEFAULT_DB_READERS 4
+#define DEFAULT_DB_BUSY_TIMEOUT_MS 5000
+#define DEFAULT_DB_BATCH_MS 0
+#define DEFAULT_DB_BATCH_OPS 128
+#define DB_BATCH_FALLBACK_MS 10
+
+/**
+ * @typedef db_sync_t: SQLite synchronous setting, i.e. what an acknowledged write survives.
+ *  - DB_SYNC_FULL: fsync on every commit; acked writes survive power loss
+ *  - DB_SYNC_NORMAL: WAL fsync at checkpoints only; acked writes survive a crash of
+ *    the server but the last commits can be lost on power loss
+ */
+typedef enum db_sync {
+    DB_SYNC_FULL = 0,
+    DB_SYNC_NORMAL
+} db_sync_t;
+
+/**
+ * @typedef db_pool_config_t: SQLite connection pool options.
+ * Fields:
+ *  - readers: read-only connections shared by query threads (0 = everything uses the writer)
+ *  - busy_timeout_ms: how long a connection waits on a locked database before failing
+ *  - batch_ms: how long a group commit waits for more writes (0 = commit as soon as no
+ *    other writer is queued)
+ *  - batch_ops: writes that force a group commit regardless of the window
+ *  - sync: durability of each commit, and therefore of each acknowledged write
+ */
+typedef struct db_pool_config {
+    int readers;
+    int busy_timeout_ms;
+    int batch_ms;
+    int batch_ops;
+    db_sync_t sync;
+} db_pool_config_t;
+
+/**
+ * @typedef db_page_t: Keyset page of a listing.
+ * Fields:
+ *  - after: only rows whose key is greater (0 for the first page)
+ *  - limit: most rows to deliver
+ * A NULL page asks a db_scan_* function for the whole listing in its unpaged order.
+ */
+typedef struct db_page {
+    uint32_t after;
+    int limit;
+} db_page_t;
+
+/**
+ * @typedef db_sink_t: Receiver of a listing streamed by a db_scan_* function.
+ * Fields:
+ *  - begin: called once, before any row, with the number of rows that follow and
+ *    whether the listing continues past the page
+ *  - row: called per row; the row (type given by the scan function) is only valid
+ *    during the call
+ *  - ctx: passed to both
+ * A callback returns non-zero to stop the scan.
+ */
+typedef struct db_sink {
+    int (*begin)(void *ctx, int count, int more);
+    int (*row)(void *ctx, const void *row);
+    void *ctx;
+} db_sink_t;
+
 // Database initialization and shutdown
+void db_configure(const db_pool_config_t *cfg);
 int db_initialize(const char *db_path);
 void db_shutdown(void);
+void db_dump_metrics(FILE *out);
 
 // Account management functions
 int db_fetch_account(const char *username, Account *out_account);
 int db_fetch_accounts(Account accounts[], int max_users, int *out_count);
-int db_create_account(const char *username, const char *password);
+int db_create_account(const char *username, const char *password, uint32_t *out_id);
+int db_user_id(const char *username, uint32_t *out_id);
+const char *db_user_name(uint32_t id);
 
 // Favorite management functions
-int db_fetch_user_favorites(const char *owner, FavoritePlace favs[], int max_items, int *out_count);
-int db_fetch_favorite_by_id(int fav_id, char *username ,FavoritePlace *out_fav);
-int db_create_favorite(const char *owner, const char *name, const char *category, const char *location);
-int db_update_favorite(int fav_id, const char *owner, const char *name, const char *category, const char *location);
-int db_delete_favorite(int fav_id, const char *owner);
-int db_fetch_tagged_favorites(const char *username, FavoritePlaceWithTags favs[], int max_items, int *out_count);
+int db_scan_user_favorites(uint32_t owner_id, const db_page_t *page, const db_sink_t *sink);
+int db_fetch_favorite_by_id(int fav_id, uint32_t owner_id, FavoritePlace *out_fav);
+int db_create_favorite(uint32_t owner_id, const char *name, const char *category, const char *location);
+int db_update_favorite(int fav_id, uint32_t owner_id, const char *name, const char *category, const char *location);
+int db_delete_favorite(int fav_id, uint32_t owner_id);
+int db_scan_tagged_favorites(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
 // Friend management functions
-int db_fetch_user_friends(const char *username, FriendRel friends[], int max_items, int *out_count);
-int db_fetch_user_requests(const char *username, FriendRequest requests[], int max_items, int *out_count);
-int db_fetch_user_notifications(const char *username, Notification notifications[], int max_items, int *out_count);
-int db_create_friend_request(const char *from, const char *to);
-int db_get_friend_request(int request_id, FriendRequest *out_request);
-int db_accept_friend_request(int request_id, const char *requestee);
-int db_reject_friend_request(int request_id, const char *requestee);
-int db_check_friendship(const char *user_a, const char *user_b);
-int db_remove_friendship(const char *user_a, const char *user_b);
-int db_tag_friend_to_favorite(int fav_id, const char *tagger, const char *tagged_users);
+int db_scan_user_friends(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int db_scan_user_requests(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int db_send_friend_request(uint32_t from_id, const char *to_name, uint32_t *out_to_id);
+int db_fetch_friend_request_by_id(int request_id, uint32_t requestee_id, FriendRequest *out_request);
+int db_accept_friend_request(int request_id, uint32_t requestee_id);
+int db_reject_friend_request(int request_id, uint32_t requestee_id);
+int db_check_friendship(uint32_t user_a_id, uint32_t user_b_id);
+int db_remove_friendship(uint32_t user_a_id, uint32_t user_b_id);
+int db_tag_friend(int fav_id, uint32_t tagger_id, const char *tagged_name, uint32_t *out_tagged_id);
 
 // Notification management functions
-int db_mark_notification_seen(int notif_id);
-int db_create_notification(const char *to, const char *from, int fav_id, const char *message);
-int db_fetch_user_notifications(const char *username, Notification notifications[], int max_items, int *out_count);
+int db_mark_notification_seen(int notif_id, uint32_t recipient_id);
+int db_create_notifications(Notification notes[], int count);
+int db_scan_user_notifications(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int db_notification_versions(uint32_t user_id, uint32_t versions[], int nkinds);
 
 #endif /* TCP_SERVER_DATABASE_H */
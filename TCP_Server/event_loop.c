@@ -0,0 +1,237 @@
+#include "event_loop.h"
+#include "session.h"
+#include "ultilities.h"
+#include "listener.h"
+#include "server_config.h"
+#include "admission.h"
+#include "reaper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+#define PAUSE_RECHECK_MS 100
+
+typedef struct event_loop {
+    int index;
+    int epfd;
+    pthread_t tid;
+    listener_shard_t *shard;
+    int accept_paused;
+    reaper_t reaper;
+} event_loop_t;
+
+static event_loop_t *g_loops = NULL;
+static int g_nloops = 0;
+static unsigned int g_next_loop = 0;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * @function handle_readable: Drain the socket until EAGAIN (edge-triggered) and
+ * dispatch complete lines.
+ *
+ * @param session: Session whose socket became readable.
+ *
+ * @return 0 to keep the connection, -1 to close it.
+ */
+static int handle_readable(client_session_t *session) {
+    while (1) {
+        int len = session_read_lines(session);
+        if (len > 0) continue;
+        if (len == 0) return -1;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        if (errno == EINTR) continue;
+        return -1;
+    }
+}
+
+static void close_session(event_loop_t *loop, client_session_t *session) {
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, session->sockfd, NULL);
+    session_close(session);
+    reaper_remove(session);
+    session_release(session);
+}
+
+// Reaper callback, runs on the loop thread from reaper_tick().
+static void evict_session(client_session_t *session, void *ctx) {
+    close_session((event_loop_t *)ctx, session);
+}
+
+// Edge-triggered: adding an fd whose queue is non-empty reports it right away.
+static int watch_listener(event_loop_t *loop) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = loop->shard;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->shard->fd, &ev);
+}
+
+/**
+ * @function handle_acceptable: Accept every pending connection of the loop's shard.
+ * When there is a shard per loop the connection stays on the accepting loop, so
+ * accept and service of a client share one core; otherwise it is spread round robin.
+ */
+static void handle_acceptable(event_loop_t *loop) {
+    int keep_local = listener_count() >= g_nloops;
+    while (1) {
+        if (admission_should_pause()) {
+            // Hard limit: stop watching the listener; the loop re-arms it once load drops.
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->shard->fd, NULL);
+            loop->accept_paused = 1;
+            admission_note_pause();
+            return;
+        }
+
+        struct sockaddr_in clientAddr;
+        int connfd = listener_accept(loop->shard, &clientAddr);
+        if (connfd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        if (!admission_gate(connfd)) continue;
+
+        client_session_t *session = session_create(connfd, &clientAddr, g_config.max_line);
+        if (!session) {
+            perror("malloc");
+            close(connfd);
+            continue;
+        }
+        if (event_loop_add_session(session, keep_local ? loop->index : -1) != 0) {
+            session_close(session);
+            session_release(session);
+        }
+    }
+}
+
+/**
+ * @function loop_thread: Body of one event loop thread.
+ *
+ * @param arg: Pointer to the owning event_loop_t.
+ *
+ * @return NULL
+ */
+static void *loop_thread(void *arg) {
+    event_loop_t *loop = (event_loop_t *)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    int timeout = reaper_tick(&loop->reaper);
+
+    while (1) {
+        if (loop->accept_paused && (timeout < 0 || timeout > PAUSE_RECHECK_MS)) timeout = PAUSE_RECHECK_MS;
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (loop->accept_paused && !admission_should_pause() && watch_listener(loop) == 0) {
+            loop->accept_paused = 0;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (loop->shard && events[i].data.ptr == loop->shard) {
+                handle_acceptable(loop);
+                continue;
+            }
+            client_session_t *session = (client_session_t *)events[i].data.ptr;
+            uint32_t ev = events[i].events;
+            int keep = 0;
+            if (ev & EPOLLOUT) keep = session_flush(session);
+            if (keep == 0 && (ev & EPOLLIN)) keep = handle_readable(session);
+            if (keep != 0 || (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+                close_session(loop, session);
+            }
+        }
+        // After the batch: no event from it refers to a session evicted here.
+        timeout = reaper_tick(&loop->reaper);
+    }
+    return NULL;
+}
+
+/**
+ * @function event_loop_start: Create the epoll instances and start the loop threads.
+ * Listening shard i (if any) is watched by loop i, which accepts on it directly.
+ *
+ * @param nloops: Number of loop threads (at least 1, and not fewer than the shards).
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int event_loop_start(int nloops) {
+    if (nloops <= 0) nloops = 1;
+    g_loops = calloc((size_t)nloops, sizeof(event_loop_t));
+    if (!g_loops) return -1;
+
+    for (int i = 0; i < nloops; ++i) {
+        g_loops[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (g_loops[i].epfd == -1) {
+            perror("epoll_create1");
+            return -1;
+        }
+        g_loops[i].index = i;
+        reaper_init(&g_loops[i].reaper, evict_session, &g_loops[i]);
+        g_loops[i].shard = listener_get(i);
+        if (g_loops[i].shard && watch_listener(&g_loops[i]) == -1) {
+            perror("epoll_ctl");
+            return -1;
+        }
+    }
+
+    // Every epoll set exists before any loop can accept and hand sessions around.
+    g_nloops = nloops;
+    for (int i = 0; i < nloops; ++i) {
+        if (pthread_create(&g_loops[i].tid, NULL, loop_thread, &g_loops[i]) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        pthread_detach(g_loops[i].tid);
+    }
+    return 0;
+}
+
+/**
+ * @function event_loop_add_session: Make the session socket non-blocking, greet the
+ * client and register it with one of the loops and that loop's reaper.
+ *
+ * @param session: Freshly accepted session.
+ * @param loop_hint: Loop index to use, or -1 for round robin.
+ *
+ * @return 0 on success, -1 on failure (the caller still owns the session).
+ */
+int event_loop_add_session(client_session_t *session, int loop_hint) {
+    if (!session || g_nloops == 0) return -1;
+    if (set_nonblocking(session->sockfd) == -1) {
+        perror("fcntl");
+        return -1;
+    }
+
+    send_reply(session, "100 Welcome to the server\r\n");
+
+    event_loop_t *loop;
+    if (loop_hint >= 0 && loop_hint < g_nloops) loop = &g_loops[loop_hint];
+    else loop = &g_loops[__atomic_fetch_add(&g_next_loop, 1, __ATOMIC_RELAXED) % (unsigned)g_nloops];
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    // EPOLLOUT (edge-triggered) resumes flushing replies after a partial write.
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = session;
+    // Armed first: once in the epoll set the loop may close and release the session.
+    if (reaper_add(&loop->reaper, session) != 0) return -1;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, session->sockfd, &ev) == -1) {
+        perror("epoll_ctl");
+        reaper_remove(session);
+        return -1;
+    }
+    return 0;
+}
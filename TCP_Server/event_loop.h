@@ -0,0 +1,10 @@
+#ifndef TCP_SERVER_EVENT_LOOP_H
+#define TCP_SERVER_EVENT_LOOP_H
+
+#include "../entity/entities.h"
+
+// EVENT LOOP (EPOLL REACTOR) FUNCTIONS
+int event_loop_start(int nloops);
+int event_loop_add_session(client_session_t *session, int loop_hint);
+
+#endif
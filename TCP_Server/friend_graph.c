@@ -0,0 +1,260 @@
+#include "friend_graph.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @typedef fg_edge_t: One friend in a user's set; peer 0 marks an empty slot.
+ */
+typedef struct fg_edge {
+    uint32_t peer;
+    int64_t since;
+} fg_edge_t;
+
+/**
+ * @typedef fg_set_t: Open-addressed (linear probing) set of friend ids, at most half full.
+ */
+typedef struct fg_set {
+    fg_edge_t *slots;
+    uint32_t cap;
+    uint32_t count;
+} fg_set_t;
+
+static pthread_rwlock_t g_lock = PTHREAD_RWLOCK_INITIALIZER;
+static fg_set_t *g_adj = NULL;       // indexed by user id
+static uint32_t g_adj_cap = 0;
+static unsigned long g_users = 0;    // users with at least one friend
+static unsigned long g_edges = 0;    // friendships (each stored in both sets)
+static size_t g_set_bytes = 0;
+static unsigned long g_checks;
+static unsigned long g_lists;
+
+static uint32_t peer_slot(uint32_t peer, uint32_t mask) {
+    return (peer * 2654435761u) & mask;
+}
+
+static fg_edge_t *set_find(const fg_set_t *set, uint32_t peer) {
+    if (!set->cap) return NULL;
+    uint32_t mask = set->cap - 1;
+    for (uint32_t i = peer_slot(peer, mask); set->slots[i].peer; i = (i + 1) & mask) {
+        if (set->slots[i].peer == peer) return &set->slots[i];
+    }
+    return NULL;
+}
+
+static void set_place(fg_set_t *set, uint32_t peer, int64_t since) {
+    uint32_t mask = set->cap - 1;
+    uint32_t i = peer_slot(peer, mask);
+    while (set->slots[i].peer) i = (i + 1) & mask;
+    set->slots[i].peer = peer;
+    set->slots[i].since = since;
+    if (set->count++ == 0) g_users++;
+}
+
+static int set_insert(fg_set_t *set, uint32_t peer, int64_t since) {
+    if (set_find(set, peer)) return 0;
+    if ((set->count + 1) * 2 > set->cap) {
+        uint32_t cap = set->cap ? set->cap * 2 : 4;
+        fg_edge_t *slots = calloc(cap, sizeof(*slots));
+        if (!slots) return -1;
+        fg_set_t grown = { slots, cap, 0 };
+        for (uint32_t i = 0; i < set->cap; ++i) {
+            if (set->slots[i].peer) set_place(&grown, set->slots[i].peer, set->slots[i].since);
+        }
+        g_users -= grown.count > 0;     // the old set was already counted
+        g_set_bytes += (size_t)(cap - set->cap) * sizeof(*slots);
+        free(set->slots);
+        *set = grown;
+    }
+    set_place(set, peer, since);
+    return 1;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static int set_erase(fg_set_t *set, uint32_t peer) {
+    fg_edge_t *hit = set_find(set, peer);
+    if (!hit) return 0;
+    uint32_t mask = set->cap - 1;
+    uint32_t i = (uint32_t)(hit - set->slots);
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!set->slots[j].peer) break;
+        uint32_t k = peer_slot(set->slots[j].peer, mask);
+        // Move j back into the hole unless its home slot lies cyclically in (i, j]
+        int stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            set->slots[i] = set->slots[j];
+            i = j;
+        }
+    }
+    set->slots[i].peer = 0;
+    if (--set->count == 0) g_users--;
+    return 1;
+}
+
+// Make sure g_adj covers id; caller holds the write lock
+static int ensure_user(uint32_t id) {
+    if (id < g_adj_cap) return 0;
+    uint32_t cap = g_adj_cap ? g_adj_cap : 1024;
+    while (cap <= id) cap *= 2;
+    fg_set_t *adj = realloc(g_adj, (size_t)cap * sizeof(*adj));
+    if (!adj) return -1;
+    memset(adj + g_adj_cap, 0, (size_t)(cap - g_adj_cap) * sizeof(*adj));
+    g_adj = adj;
+    g_adj_cap = cap;
+    return 0;
+}
+
+/**
+ * @function friend_graph_init: Prepare an empty graph.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int friend_graph_init(void) {
+    pthread_rwlock_wrlock(&g_lock);
+    int rc = ensure_user(0);
+    pthread_rwlock_unlock(&g_lock);
+    return rc;
+}
+
+/**
+ * @function friend_graph_add: Record a friendship (idempotent).
+ *
+ * @param since: Time the friendship was created.
+ *
+ * @return 1 if added, 0 if already present, -1 on allocation failure.
+ */
+int friend_graph_add(uint32_t a, uint32_t b, time_t since) {
+    if (!a || !b || a == b) return -1;
+
+    pthread_rwlock_wrlock(&g_lock);
+    int rc = -1;
+    if (ensure_user(a > b ? a : b) == 0) {
+        rc = set_insert(&g_adj[a], b, (int64_t)since);
+        if (rc == 1 && set_insert(&g_adj[b], a, (int64_t)since) != 1) {
+            set_erase(&g_adj[a], b);
+            rc = -1;
+        }
+        if (rc == 1) g_edges++;
+    }
+    pthread_rwlock_unlock(&g_lock);
+    return rc;
+}
+
+/**
+ * @function friend_graph_remove: Forget a friendship.
+ *
+ * @return 1 if it existed, 0 otherwise.
+ */
+int friend_graph_remove(uint32_t a, uint32_t b) {
+    if (!a || !b) return 0;
+
+    pthread_rwlock_wrlock(&g_lock);
+    int rc = 0;
+    if (a < g_adj_cap && b < g_adj_cap && set_erase(&g_adj[a], b)) {
+        set_erase(&g_adj[b], a);
+        g_edges--;
+        rc = 1;
+    }
+    pthread_rwlock_unlock(&g_lock);
+    return rc;
+}
+
+/**
+ * @function friend_graph_check: Are two users friends?
+ *
+ * @return 1 if they are, 0 if not.
+ */
+int friend_graph_check(uint32_t a, uint32_t b) {
+    __atomic_add_fetch(&g_checks, 1, __ATOMIC_RELAXED);
+    if (!a || !b) return 0;
+
+    pthread_rwlock_rdlock(&g_lock);
+    int found = a < g_adj_cap && set_find(&g_adj[a], b) != NULL;
+    pthread_rwlock_unlock(&g_lock);
+    return found;
+}
+
+static int by_since_desc(const void *x, const void *y) {
+    const fg_edge_t *a = x, *b = y;
+    return (a->since < b->since) - (a->since > b->since);
+}
+
+static int by_peer_asc(const void *x, const void *y) {
+    const fg_edge_t *a = x, *b = y;
+    return (a->peer > b->peer) - (a->peer < b->peer);
+}
+
+/**
+ * @function friend_graph_scan: Stream a user's friends to callbacks. The friend set is
+ * copied out under the read lock (a few bytes per friend) and the callbacks run after
+ * it is released, so they may block.
+ *
+ * @param self: User whose friends are listed.
+ * @param after: With by_id, only friends with a greater id (0 for the first page).
+ * @param limit: Most friends to deliver (0 = all).
+ * @param by_id: 1 for friend id order, 0 for newest friendship first.
+ * @param begin: Called once with the number of friends that follow and whether more
+ * lie past limit.
+ * @param row: Called per friend; non-zero stops the scan, as does non-zero from begin.
+ * @param ctx: Passed to both callbacks.
+ *
+ * @return 0 on success, -1 on allocation failure (before begin is called).
+ */
+int friend_graph_scan(uint32_t self, uint32_t after, int limit, int by_id,
+                      friend_graph_begin_fn begin, friend_graph_row_fn row, void *ctx) {
+    __atomic_add_fetch(&g_lists, 1, __ATOMIC_RELAXED);
+
+    pthread_rwlock_rdlock(&g_lock);
+    fg_set_t *set = self && self < g_adj_cap ? &g_adj[self] : NULL;
+    uint32_t n = set ? set->count : 0;
+    fg_edge_t *edges = n ? malloc((size_t)n * sizeof(*edges)) : NULL;
+    if (n && !edges) {
+        pthread_rwlock_unlock(&g_lock);
+        return -1;
+    }
+    uint32_t k = 0;
+    for (uint32_t i = 0; set && i < set->cap; ++i) {
+        if (set->slots[i].peer && (!by_id || set->slots[i].peer > after)) edges[k++] = set->slots[i];
+    }
+    pthread_rwlock_unlock(&g_lock);
+
+    qsort(edges, k, sizeof(*edges), by_id ? by_peer_asc : by_since_desc);
+    int more = limit > 0 && k > (uint32_t)limit;
+    int count = more ? limit : (int)k;
+    if (begin(ctx, count, more) == 0) {
+        for (int i = 0; i < count; ++i) {
+            if (row(ctx, edges[i].peer, (time_t)edges[i].since) != 0) break;
+        }
+    }
+    free(edges);
+    return 0;
+}
+
+/**
+ * @function friend_graph_stats: Size of the graph.
+ *
+ * @param users: Users with at least one friend.
+ * @param friendships: Friend pairs.
+ * @param bytes: Heap held by the adjacency sets and the per-user index.
+ */
+void friend_graph_stats(unsigned long *users, unsigned long *friendships, size_t *bytes) {
+    pthread_rwlock_rdlock(&g_lock);
+    *users = g_users;
+    *friendships = g_edges;
+    *bytes = g_set_bytes + (size_t)g_adj_cap * sizeof(fg_set_t);
+    pthread_rwlock_unlock(&g_lock);
+}
+
+void friend_graph_dump_metrics(FILE *out) {
+    unsigned long users, friendships;
+    size_t bytes;
+    friend_graph_stats(&users, &friendships, &bytes);
+    fprintf(out, "users=%lu friendships=%lu memory=%zuKB checks=%lu lists=%lu\n",
+            users, friendships, bytes / 1024,
+            __atomic_load_n(&g_checks, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_lists, __ATOMIC_RELAXED));
+}
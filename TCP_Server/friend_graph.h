@@ -0,0 +1,30 @@
+#ifndef TCP_SERVER_FRIEND_GRAPH_H
+#define TCP_SERVER_FRIEND_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Memory-resident copy of the friendships table: every user id has a hash set of
+ * friend ids, so membership is O(1) and LIST_FRIENDS never reaches SQLite.
+ * database.c loads it at startup and applies changes once the transaction that made
+ * them has committed.
+ */
+
+// Callbacks of friend_graph_scan; non-zero stops the scan
+typedef int (*friend_graph_begin_fn)(void *ctx, int count, int more);
+typedef int (*friend_graph_row_fn)(void *ctx, uint32_t peer, time_t since);
+
+// FRIEND GRAPH FUNCTIONS
+int friend_graph_init(void);
+int friend_graph_add(uint32_t a, uint32_t b, time_t since);
+int friend_graph_remove(uint32_t a, uint32_t b);
+int friend_graph_check(uint32_t a, uint32_t b);
+int friend_graph_scan(uint32_t self, uint32_t after, int limit, int by_id,
+                      friend_graph_begin_fn begin, friend_graph_row_fn row, void *ctx);
+void friend_graph_stats(unsigned long *users, unsigned long *friendships, size_t *bytes);
+void friend_graph_dump_metrics(FILE *out);
+
+#endif
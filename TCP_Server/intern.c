@@ -0,0 +1,127 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INITIAL 1024
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Slot holding name's id, or the empty slot where it belongs; caller holds the lock
+static uint32_t *probe(intern_table_t *t, const char *name) {
+    uint32_t i = name_hash(name) & t->mask;
+    while (t->slots[i] && strcmp(t->names[t->slots[i]], name) != 0) i = (i + 1) & t->mask;
+    return &t->slots[i];
+}
+
+// Make names cover id; caller holds the write lock
+static int grow_names(intern_table_t *t, uint32_t id) {
+    if (id < t->cap) return 0;
+    uint32_t cap = t->cap;
+    while (cap <= id) cap *= 2;
+    char **names = realloc(t->names, (size_t)cap * sizeof(*names));
+    if (!names) return -1;
+    memset(names + t->cap, 0, (size_t)(cap - t->cap) * sizeof(*names));
+    t->bytes += (size_t)(cap - t->cap) * sizeof(*names);
+    t->names = names;
+    t->cap = cap;
+    return 0;
+}
+
+// Double the name -> id index; caller holds the write lock
+static int grow_index(intern_table_t *t) {
+    uint32_t nslots = (t->mask + 1) * 2;
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    if (!slots) return -1;
+    free(t->slots);
+    t->slots = slots;
+    t->mask = nslots - 1;
+    for (uint32_t id = 1; id < t->cap; ++id) {
+        if (t->names[id]) *probe(t, t->names[id]) = id;
+    }
+    t->bytes += (size_t)nslots / 2 * sizeof(*slots);
+    return 0;
+}
+
+/**
+ * @function intern_init: Prepare an empty table.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int intern_init(intern_table_t *t) {
+    memset(t, 0, sizeof(*t));
+    pthread_rwlock_init(&t->lock, NULL);
+    t->cap = INTERN_INITIAL;
+    t->names = calloc(t->cap, sizeof(*t->names));
+    t->slots = calloc((size_t)t->cap * 2, sizeof(*t->slots));
+    if (!t->names || !t->slots) return -1;
+    t->mask = t->cap * 2 - 1;
+    t->bytes = (size_t)t->cap * sizeof(*t->names) + (size_t)t->cap * 2 * sizeof(*t->slots);
+    return 0;
+}
+
+/**
+ * @function intern_lookup: Id of a name that has already been interned.
+ *
+ * @return The id, or 0 if the name is unknown.
+ */
+uint32_t intern_lookup(intern_table_t *t, const char *name) {
+    pthread_rwlock_rdlock(&t->lock);
+    uint32_t id = *probe(t, name);
+    pthread_rwlock_unlock(&t->lock);
+    return id;
+}
+
+/**
+ * @function intern_put: Record that name has the given id. Re-adding a known name is a
+ * no-op; a name keeps the first id it was given.
+ *
+ * @return 0 on success, -1 on allocation failure, id 0 or an id already naming someone else.
+ */
+int intern_put(intern_table_t *t, const char *name, uint32_t id) {
+    if (id == 0) return -1;
+    if (intern_lookup(t, name)) return 0;
+
+    pthread_rwlock_wrlock(&t->lock);
+    int rc = 0;
+    if (!*probe(t, name)) {
+        char *copy = NULL;
+        if (grow_names(t, id) != 0 || t->names[id] ||
+            ((t->count + 1) * 2 > t->mask + 1 && grow_index(t) != 0) || !(copy = strdup(name))) {
+            rc = -1;
+        } else {
+            t->names[id] = copy;
+            t->bytes += strlen(copy) + 1;
+            *probe(t, name) = id;
+            t->count++;
+        }
+    }
+    pthread_rwlock_unlock(&t->lock);
+    return rc;
+}
+
+/**
+ * @function intern_name: Name behind an id. The string is never freed or moved.
+ *
+ * @return The name, or NULL for an unknown id.
+ */
+const char *intern_name(intern_table_t *t, uint32_t id) {
+    pthread_rwlock_rdlock(&t->lock);
+    const char *name = (id && id < t->cap) ? t->names[id] : NULL;
+    pthread_rwlock_unlock(&t->lock);
+    return name;
+}
+
+size_t intern_memory(intern_table_t *t) {
+    pthread_rwlock_rdlock(&t->lock);
+    size_t bytes = t->bytes;
+    pthread_rwlock_unlock(&t->lock);
+    return bytes;
+}
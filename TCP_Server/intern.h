@@ -0,0 +1,36 @@
+#ifndef TCP_SERVER_INTERN_H
+#define TCP_SERVER_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @typedef intern_table_t: Thread-safe bidirectional map between names and the small,
+ * mostly dense ids the caller assigns to them (accounts.id; 0 means "no id"). Names are
+ * never removed, so intern_name() pointers stay valid for the life of the process.
+ * Fields:
+ *  - lock: rwlock; lookups share it, new names take it exclusively
+ *  - names: id -> name, NULL where no name has that id
+ *  - count/cap: names held and the size of names (every id is below cap)
+ *  - slots/mask: open-addressed name -> id index, at most half full
+ *  - bytes: heap held by the table
+ */
+typedef struct intern_table {
+    pthread_rwlock_t lock;
+    char **names;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots;
+    uint32_t mask;
+    size_t bytes;
+} intern_table_t;
+
+// INTERN TABLE FUNCTIONS
+int intern_init(intern_table_t *t);
+uint32_t intern_lookup(intern_table_t *t, const char *name);
+int intern_put(intern_table_t *t, const char *name, uint32_t id);
+const char *intern_name(intern_table_t *t, uint32_t id);
+size_t intern_memory(intern_table_t *t);
+
+#endif
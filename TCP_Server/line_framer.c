@@ -0,0 +1,169 @@
+#include "line_framer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long g_lines_total = 0;
+static unsigned long g_oversize_total = 0;
+static unsigned long g_wrapped_total = 0;
+
+/**
+ * @function framer_buffer_size: Ring capacity used for a given line limit. The ring
+ * always keeps room for one maximal line plus "\r\n" and a little spare so a read
+ * can make progress.
+ *
+ * @param max_line: Longest accepted line.
+ *
+ * @return Ring capacity in bytes (power of two).
+ */
+size_t framer_buffer_size(size_t max_line) {
+    size_t cap = 1024;
+    while (cap < max_line + 4) cap <<= 1;
+    return cap;
+}
+
+/**
+ * @function framer_init: Allocate the ring for one connection.
+ *
+ * @param f: Framer to initialize.
+ * @param max_line: Longest accepted line, terminator excluded.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int framer_init(line_framer_t *f, size_t max_line) {
+    memset(f, 0, sizeof(*f));
+    f->max_line = max_line ? max_line : DEFAULT_MAX_LINE;
+    f->cap = framer_buffer_size(f->max_line);
+    f->buf = malloc(f->cap + 1);
+    f->scratch = malloc(f->max_line + 1);
+    if (!f->buf || !f->scratch) {
+        framer_free(f);
+        return -1;
+    }
+    return 0;
+}
+
+void framer_free(line_framer_t *f) {
+    if (!f) return;
+    free(f->buf);
+    free(f->scratch);
+    f->buf = NULL;
+    f->scratch = NULL;
+}
+
+/**
+ * @function framer_write_ptr: Contiguous free region to recv() into.
+ *
+ * The returned size follows recv_response() conventions: at most size - 1 bytes are
+ * read and a NUL is stored after them. When the region runs to the physical end of
+ * the ring that NUL lands on the slack byte; otherwise one byte of the region is
+ * reserved for it.
+ *
+ * @param f: Framer.
+ * @param size: Out parameter, buffer size to pass to recv_response().
+ *
+ * @return Pointer into the ring.
+ */
+char *framer_write_ptr(line_framer_t *f, size_t *size) {
+    size_t mask = f->cap - 1;
+    size_t free_total = f->cap - (f->tail - f->head);
+    size_t pos = f->tail & mask;
+    size_t to_end = f->cap - pos;
+
+    if (to_end <= free_total) *size = to_end + 1;
+    else *size = free_total;
+    return f->buf + pos;
+}
+
+void framer_commit(line_framer_t *f, size_t n) {
+    f->tail += n;
+}
+
+/**
+ * @function emit_line: Hand the line [start, start + len) to the callback. Lines that
+ * sit contiguously in the ring are terminated in place (over the '\r' or '\n');
+ * only lines that wrap around the ring end are copied.
+ */
+static void emit_line(line_framer_t *f, size_t start, size_t len, framer_line_cb cb, void *ctx) {
+    size_t mask = f->cap - 1;
+    size_t pos = start & mask;
+    char *line;
+
+    if (pos + len <= f->cap) {
+        line = f->buf + pos;
+    } else {
+        size_t first = f->cap - pos;
+        memcpy(f->scratch, f->buf + pos, first);
+        memcpy(f->scratch + first, f->buf, len - first);
+        line = f->scratch;
+        __atomic_add_fetch(&g_wrapped_total, 1, __ATOMIC_RELAXED);
+    }
+    line[len] = '\0';
+    __atomic_add_fetch(&g_lines_total, 1, __ATOMIC_RELAXED);
+    cb(ctx, line, len);
+}
+
+/**
+ * @function framer_drain: Deliver every complete line received so far. Only bytes
+ * that arrived since the previous call are scanned; a trailing partial line stays
+ * buffered. Lines longer than max_line are dropped up to their terminator.
+ *
+ * @param f: Framer.
+ * @param cb: Called once per non-empty line.
+ * @param ctx: Passed through to cb.
+ *
+ * @return Number of oversize lines rejected during this call.
+ */
+int framer_drain(line_framer_t *f, framer_line_cb cb, void *ctx) {
+    size_t mask = f->cap - 1;
+    int rejected = 0;
+
+    while (f->scan < f->tail) {
+        size_t pos = f->scan & mask;
+        size_t span = f->tail - f->scan;
+        if (span > f->cap - pos) span = f->cap - pos;
+
+        char *nl = memchr(f->buf + pos, '\n', span);
+        if (!nl) {
+            f->scan += span;
+            continue;
+        }
+
+        size_t nl_off = f->scan + (size_t)(nl - (f->buf + pos));
+        f->scan = nl_off + 1;
+
+        if (f->discarding) {
+            f->discarding = 0;
+            f->head = f->scan;
+            continue;
+        }
+
+        size_t len = nl_off - f->head;
+        if (len > 0 && f->buf[(nl_off - 1) & mask] == '\r') len--;
+        if (len > f->max_line) {
+            rejected++;
+        } else if (len > 0) {
+            emit_line(f, f->head, len, cb, ctx);
+        }
+        f->head = f->scan;
+    }
+
+    // No terminator in sight: drop what we have once it cannot be a valid line.
+    if (f->discarding) {
+        f->head = f->tail;
+    } else if (f->tail - f->head > f->max_line + 1) {
+        f->discarding = 1;
+        f->head = f->tail;
+        rejected++;
+    }
+
+    if (rejected) __atomic_add_fetch(&g_oversize_total, (unsigned long)rejected, __ATOMIC_RELAXED);
+    return rejected;
+}
+
+void framer_dump_metrics(FILE *out) {
+    fprintf(out, "lines_framed=%lu oversize_rejected=%lu wrapped_lines=%lu\n",
+            __atomic_load_n(&g_lines_total, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_oversize_total, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_wrapped_total, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,48 @@
+#ifndef TCP_SERVER_LINE_FRAMER_H
+#define TCP_SERVER_LINE_FRAMER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define DEFAULT_MAX_LINE 8192
+
+/**
+ * @typedef line_framer_t: Per-connection ring buffer that splits the byte stream into
+ * "\r\n"-terminated lines.
+ * Fields:
+ *  - buf: ring storage (cap bytes plus one slack byte for a NUL terminator)
+ *  - cap: ring capacity, a power of two
+ *  - head: logical offset of the first unconsumed byte
+ *  - scan: logical offset up to which bytes are known not to hold a newline
+ *  - tail: logical offset one past the last received byte
+ *  - max_line: longest accepted line, terminator excluded
+ *  - discarding: 1 while skipping the rest of an oversize line
+ *  - scratch: linear copy used only for lines that wrap around the ring end
+ */
+typedef struct line_framer {
+    char *buf;
+    size_t cap;
+    size_t head;
+    size_t scan;
+    size_t tail;
+    size_t max_line;
+    int discarding;
+    char *scratch;
+} line_framer_t;
+
+/**
+ * @typedef framer_line_cb: Receives one complete line. The line is NUL-terminated in
+ * place and only valid until the callback returns.
+ */
+typedef void (*framer_line_cb)(void *ctx, char *line, size_t len);
+
+// LINE FRAMER FUNCTIONS
+int framer_init(line_framer_t *f, size_t max_line);
+void framer_free(line_framer_t *f);
+char *framer_write_ptr(line_framer_t *f, size_t *size);
+void framer_commit(line_framer_t *f, size_t n);
+int framer_drain(line_framer_t *f, framer_line_cb cb, void *ctx);
+size_t framer_buffer_size(size_t max_line);
+void framer_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,208 @@
+#define LOG_TAG "listener"
+
+#include "listener.h"
+#include "log.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static listener_shard_t *g_shards = NULL;
+static int g_nshards = 0;
+static int g_backlog = DEFAULT_BACKLOG;
+static int g_nonblocking = 0;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int open_socket(const char *port, int backlog, int reuseport, int nonblocking) {
+    int type = SOCK_STREAM | SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0);
+    int fd = socket(AF_INET, type, 0);
+    if (fd == -1) {
+        perror("socket() error");
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serverAddr.sin_port = htons(atoi(port));
+
+    if (bind(fd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1) {
+        perror("bind() error");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, backlog) == -1) {
+        perror("listen() error");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @function listener_open: Create the listening sockets.
+ *
+ * @param port: TCP port to bind.
+ * @param nshards: Number of sockets; more than one enables SO_REUSEPORT.
+ * @param backlog: listen() backlog of each socket.
+ * @param nonblocking: 1 for sockets driven by an event loop.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int listener_open(const char *port, int nshards, int backlog, int nonblocking) {
+    if (nshards <= 0) nshards = 1;
+    g_shards = calloc((size_t)nshards, sizeof(listener_shard_t));
+    if (!g_shards) return -1;
+    g_backlog = backlog;
+    g_nonblocking = nonblocking;
+
+    double now = now_seconds();
+    for (int i = 0; i < nshards; ++i) {
+        int fd = open_socket(port, backlog, nshards > 1, nonblocking);
+        if (fd == -1) {
+            listener_close_all();
+            return -1;
+        }
+        g_shards[i].id = i;
+        g_shards[i].fd = fd;
+        g_shards[i].last_report = now;
+        g_nshards++;
+    }
+    return 0;
+}
+
+int listener_count(void) {
+    return g_nshards;
+}
+
+listener_shard_t *listener_get(int index) {
+    if (index < 0 || index >= g_nshards) return NULL;
+    return &g_shards[index];
+}
+
+/**
+ * @function sample_queue: Record the accept queue depth. For a listening socket Linux
+ * reports the current queue length in tcpi_unacked and the backlog in tcpi_sacked.
+ */
+static void sample_queue(listener_shard_t *shard) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(shard->fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) return;
+    unsigned int depth = info.tcpi_unacked;
+    if (depth > __atomic_load_n(&shard->max_queue_len, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&shard->max_queue_len, depth, __ATOMIC_RELAXED);
+    }
+    if (info.tcpi_sacked > 0 && depth >= info.tcpi_sacked) {
+        __atomic_add_fetch(&shard->queue_full_samples, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @function listener_accept: Accept one connection from the shard, set TCP_NODELAY and
+ * make it non-blocking if the listener is.
+ *
+ * @param shard: Listening shard.
+ * @param addr: Out parameter, peer address.
+ *
+ * @return Connected descriptor, or -1 (errno EAGAIN when the queue is empty).
+ */
+int listener_accept(listener_shard_t *shard, struct sockaddr_in *addr) {
+    socklen_t addr_len = sizeof(*addr);
+    int flags = SOCK_CLOEXEC | (g_nonblocking ? SOCK_NONBLOCK : 0);
+
+    int connfd = accept4(shard->fd, (struct sockaddr *)addr, &addr_len, flags);
+    if (connfd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            __atomic_add_fetch(&shard->accept_errors, 1, __ATOMIC_RELAXED);
+        }
+        return -1;
+    }
+    unsigned long n = __atomic_add_fetch(&shard->accepted, 1, __ATOMIC_RELAXED);
+    // Sampling every accept would double the syscalls during a storm.
+    if ((n & 63) == 1) sample_queue(shard);
+
+    int flag = 1;
+    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+    char client_ip[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &addr->sin_addr, client_ip, INET_ADDRSTRLEN) == NULL) {
+        perror("inet_ntop() error");
+    } else {
+        LOG_INFO("Client got a connection from %s:%d (shard %d)", client_ip, ntohs(addr->sin_port), shard->id);
+    }
+    return connfd;
+}
+
+void listener_close_all(void) {
+    for (int i = 0; i < g_nshards; ++i) close(g_shards[i].fd);
+    free(g_shards);
+    g_shards = NULL;
+    g_nshards = 0;
+}
+
+/**
+ * @function read_listen_overflows: System-wide TcpExt ListenOverflows counter. The
+ * kernel does not keep it per socket, so it is reported next to the per-shard
+ * queue samples.
+ */
+static long read_listen_overflows(void) {
+    FILE *f = fopen("/proc/net/netstat", "r");
+    if (!f) return -1;
+    char names[4096], values[4096];
+    long result = -1;
+    while (fgets(names, sizeof(names), f) && fgets(values, sizeof(values), f)) {
+        if (strncmp(names, "TcpExt:", 7) != 0) continue;
+        char *save_n = NULL, *save_v = NULL;
+        char *n = strtok_r(names, " \n", &save_n);
+        char *v = strtok_r(values, " \n", &save_v);
+        while (n && v) {
+            if (strcmp(n, "ListenOverflows") == 0) {
+                result = atol(v);
+                break;
+            }
+            n = strtok_r(NULL, " \n", &save_n);
+            v = strtok_r(NULL, " \n", &save_v);
+        }
+        break;
+    }
+    fclose(f);
+    return result;
+}
+
+void listener_dump_metrics(FILE *out) {
+    double now = now_seconds();
+    for (int i = 0; i < g_nshards; ++i) {
+        listener_shard_t *shard = &g_shards[i];
+        sample_queue(shard);
+        unsigned long accepted = __atomic_load_n(&shard->accepted, __ATOMIC_RELAXED);
+        double elapsed = now - shard->last_report;
+        double rate = elapsed > 0 ? (double)(accepted - shard->last_accepted) / elapsed : 0.0;
+        shard->last_accepted = accepted;
+        shard->last_report = now;
+        fprintf(out, "shard=%d accepted=%lu accept_rate=%.1f/s accept_errors=%lu max_queue=%u/%d queue_full_samples=%lu\n",
+                shard->id, accepted, rate,
+                __atomic_load_n(&shard->accept_errors, __ATOMIC_RELAXED),
+                __atomic_load_n(&shard->max_queue_len, __ATOMIC_RELAXED), g_backlog,
+                __atomic_load_n(&shard->queue_full_samples, __ATOMIC_RELAXED));
+    }
+    fprintf(out, "listen_overflows_system=%ld\n", read_listen_overflows());
+}
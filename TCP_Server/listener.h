@@ -0,0 +1,41 @@
+#ifndef TCP_SERVER_LISTENER_H
+#define TCP_SERVER_LISTENER_H
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+#define DEFAULT_BACKLOG 128
+
+/**
+ * @typedef listener_shard_t: One listening socket. With several shards every socket
+ * is bound to the same port with SO_REUSEPORT and the kernel spreads incoming
+ * connections across them.
+ * Fields:
+ *  - id: shard index
+ *  - fd: listening socket
+ *  - accepted: connections accepted so far
+ *  - accept_errors: accept() failures other than EAGAIN/EINTR
+ *  - queue_full_samples: times the accept queue was found at its backlog limit
+ *  - max_queue_len: deepest accept queue observed
+ *  - last_accepted/last_report: snapshot used to compute the accept rate
+ */
+typedef struct listener_shard {
+    int id;
+    int fd;
+    unsigned long accepted;
+    unsigned long accept_errors;
+    unsigned long queue_full_samples;
+    unsigned int max_queue_len;
+    unsigned long last_accepted;
+    double last_report;
+} listener_shard_t;
+
+// LISTENER FUNCTIONS
+int listener_open(const char *port, int nshards, int backlog, int nonblocking);
+int listener_count(void);
+listener_shard_t *listener_get(int index);
+int listener_accept(listener_shard_t *shard, struct sockaddr_in *addr);
+void listener_close_all(void);
+void listener_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,69 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define LOG_LINE_MAX 1024
+
+int g_log_level = LOG_LEVEL_INFO;
+static int g_configured_level = LOG_LEVEL_INFO;
+
+static const char *const g_level_names[] = {"trace", "debug", "info", "warn", "error", "off"};
+
+/**
+ * @function log_set_level: Set the run-time threshold (levels compiled out stay out).
+ *
+ * @param level: LOG_LEVEL_* value.
+ */
+void log_set_level(int level) {
+    if (level < LOG_LEVEL_TRACE) level = LOG_LEVEL_TRACE;
+    if (level > LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+    g_configured_level = level;
+    __atomic_store_n(&g_log_level, level, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function log_level_from_name: Parse "trace", "debug", "info", "warn", "error" or "off".
+ *
+ * @return LOG_LEVEL_* value, or -1 if the name is unknown.
+ */
+int log_level_from_name(const char *name) {
+    for (int i = LOG_LEVEL_TRACE; i <= LOG_LEVEL_OFF; ++i) {
+        if (strcasecmp(name, g_level_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * @function log_toggle_verbose: Switch between the configured level and the most
+ * verbose level compiled in. Only stores an int, so it is safe in a signal handler.
+ */
+void log_toggle_verbose(void) {
+    int cur = __atomic_load_n(&g_log_level, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_log_level, cur == g_configured_level ? LOG_COMPILE_LEVEL : g_configured_level,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * @function log_emit: Format one message and write it to stdout with a single
+ * write(), so concurrent threads neither interleave nor contend on the stdio lock.
+ */
+void log_emit(int level, const char *tag, const char *fmt, ...) {
+    char line[LOG_LINE_MAX];
+    int off = snprintf(line, sizeof(line), "[%s %s] ", g_level_names[level], tag);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line + off, sizeof(line) - (size_t)off - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    off += n;
+    if (off > (int)sizeof(line) - 2) off = (int)sizeof(line) - 2;
+    line[off++] = '\n';
+
+    ssize_t w = write(STDOUT_FILENO, line, (size_t)off);
+    (void)w;
+}
@@ -0,0 +1,70 @@
+#ifndef TCP_SERVER_LOG_H
+#define TCP_SERVER_LOG_H
+
+/*
+ * Leveled diagnostics. Each .c file may set LOG_TAG before including this header;
+ * messages print as "[level tag] text". Calls below LOG_COMPILE_LEVEL expand to
+ * nothing (their arguments are not even evaluated); the rest are filtered at run
+ * time against the level set with log_set_level().
+ */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+#ifndef LOG_TAG
+#define LOG_TAG "server"
+#endif
+
+extern int g_log_level;
+
+// LOGGING FUNCTIONS
+void log_set_level(int level);
+int log_level_from_name(const char *name);
+void log_toggle_verbose(void);
+void log_emit(int level, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define LOG_AT(level, ...)                                                      \
+    do {                                                                        \
+        if ((level) >= __atomic_load_n(&g_log_level, __ATOMIC_RELAXED))         \
+            log_emit((level), LOG_TAG, __VA_ARGS__);                            \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#endif
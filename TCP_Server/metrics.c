@@ -0,0 +1,101 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_METRIC_SOURCES 32
+
+typedef struct metric_source {
+    const char *name;
+    metrics_dump_fn dump;
+} metric_source_t;
+
+static metric_source_t g_sources[MAX_METRIC_SOURCES];
+static int g_source_count = 0;
+static int g_interval = 0;
+static volatile sig_atomic_t g_dump_requested = 0;
+static pthread_mutex_t g_metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @function metrics_register: Add a named group of counters to the periodic report.
+ *
+ * @param name: Group name printed as a section header.
+ * @param dump: Callback that prints the group's counters.
+ *
+ * @return 0 on success, -1 if the registry is full.
+ */
+int metrics_register(const char *name, metrics_dump_fn dump) {
+    pthread_mutex_lock(&g_metrics_lock);
+    if (g_source_count >= MAX_METRIC_SOURCES) {
+        pthread_mutex_unlock(&g_metrics_lock);
+        return -1;
+    }
+    g_sources[g_source_count].name = name;
+    g_sources[g_source_count].dump = dump;
+    g_source_count++;
+    pthread_mutex_unlock(&g_metrics_lock);
+    return 0;
+}
+
+/**
+ * @function metrics_dump: Print every registered counter group.
+ *
+ * @param out: Destination stream.
+ */
+void metrics_dump(FILE *out) {
+    pthread_mutex_lock(&g_metrics_lock);
+    fprintf(out, "==== metrics @%ld ====\n", (long)time(NULL));
+    for (int i = 0; i < g_source_count; ++i) {
+        fprintf(out, "[%s]\n", g_sources[i].name);
+        g_sources[i].dump(out);
+    }
+    fflush(out);
+    pthread_mutex_unlock(&g_metrics_lock);
+}
+
+static void on_sigusr1(int sig) {
+    (void)sig;
+    g_dump_requested = 1;
+}
+
+static void *reporter_thread(void *arg) {
+    (void)arg;
+    int elapsed = 0;
+    while (1) {
+        sleep(1);
+        elapsed++;
+        if (g_dump_requested || (g_interval > 0 && elapsed >= g_interval)) {
+            g_dump_requested = 0;
+            elapsed = 0;
+            metrics_dump(stdout);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @function metrics_start: Start the reporter thread. Counters are printed to stdout
+ * every interval_sec seconds (0 disables periodic output) and whenever the process
+ * receives SIGUSR1.
+ *
+ * @param interval_sec: Report period in seconds.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int metrics_start(int interval_sec) {
+    g_interval = interval_sec;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigusr1;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, reporter_thread, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef TCP_SERVER_METRICS_H
+#define TCP_SERVER_METRICS_H
+
+#include <stdio.h>
+
+typedef void (*metrics_dump_fn)(FILE *out);
+
+// METRICS REPORTING FUNCTIONS
+int metrics_register(const char *name, metrics_dump_fn dump);
+int metrics_start(int interval_sec);
+void metrics_dump(FILE *out);
+
+#endif
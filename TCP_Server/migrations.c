@@ -0,0 +1,353 @@
+#define LOG_TAG "db"
+
+#include "migrations.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int add_logged_in_column(sqlite3 *db);
+
+/*
+ * Append-only: never edit a step that has shipped, add a new one instead.
+ * Versions must be consecutive starting at 1.
+ */
+static const db_migration_t g_migrations[] = {
+    {1, "base tables",
+        "CREATE TABLE IF NOT EXISTS accounts("
+        "username TEXT PRIMARY KEY,"
+        "password TEXT NOT NULL);"
+
+        "CREATE TABLE IF NOT EXISTS favorites("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "owner TEXT NOT NULL,"
+        "name TEXT NOT NULL,"
+        "category TEXT NOT NULL,"
+        "location TEXT NOT NULL,"
+        "tagged TEXT DEFAULT '',"
+        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now')),"
+        "FOREIGN KEY(owner) REFERENCES accounts(username) ON DELETE CASCADE);"
+
+        "CREATE TABLE IF NOT EXISTS friendships("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "user_a TEXT NOT NULL,"
+        "user_b TEXT NOT NULL,"
+        "since INTEGER NOT NULL DEFAULT (strftime('%s','now')),"
+        "UNIQUE(user_a, user_b),"
+        "FOREIGN KEY(user_a) REFERENCES accounts(username) ON DELETE CASCADE,"
+        "FOREIGN KEY(user_b) REFERENCES accounts(username) ON DELETE CASCADE);"
+
+        "CREATE TABLE IF NOT EXISTS friend_requests("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "requester TEXT NOT NULL,"
+        "requestee TEXT NOT NULL,"
+        "status INTEGER NOT NULL DEFAULT 0,"
+        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now')),"
+        "FOREIGN KEY(requester) REFERENCES accounts(username) ON DELETE CASCADE,"
+        "FOREIGN KEY(requestee) REFERENCES accounts(username) ON DELETE CASCADE);"
+
+        "CREATE TABLE IF NOT EXISTS notifications("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "recipient TEXT NOT NULL,"
+        "actor TEXT NOT NULL,"
+        "fav_id INTEGER,"
+        "message TEXT NOT NULL,"
+        "seen INTEGER NOT NULL DEFAULT 0,"
+        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now')),"
+        "FOREIGN KEY(recipient) REFERENCES accounts(username) ON DELETE CASCADE,"
+        "FOREIGN KEY(actor) REFERENCES accounts(username) ON DELETE CASCADE);"
+
+        "CREATE TABLE IF NOT EXISTS favorite_tags("
+        "fav_id INTEGER NOT NULL,"
+        "tagger TEXT NOT NULL,"
+        "tagged_users TEXT NOT NULL,"
+        "UNIQUE(fav_id, tagged_users),"
+        "FOREIGN KEY(fav_id) REFERENCES favorites(id) ON DELETE CASCADE,"
+        "FOREIGN KEY(tagged_users) REFERENCES accounts(username) ON DELETE CASCADE,"
+        "FOREIGN KEY(tagger) REFERENCES accounts(username) ON DELETE CASCADE);",
+        NULL},
+
+    // Older databases got this column by hand; new ones never had it
+    {2, "accounts.is_logged_in", NULL, add_logged_in_column},
+
+    // Covering indexes: each list query is answered from the index alone
+    {3, "secondary indexes",
+        // LIST_FAVORITES: WHERE owner = ? (index order keeps the old id order)
+        "CREATE INDEX IF NOT EXISTS idx_favorites_owner "
+        "ON favorites(owner, id, name, category, location, created_at);"
+        // LIST_FRIEND_REQUESTS: WHERE requestee = ? ORDER BY created_at DESC
+        "CREATE INDEX IF NOT EXISTS idx_friend_requests_requestee "
+        "ON friend_requests(requestee, created_at, requester, status);"
+        // ADD_FRIEND duplicate check: WHERE requester = ? AND requestee = ? AND status = 0
+        "CREATE INDEX IF NOT EXISTS idx_friend_requests_pair "
+        "ON friend_requests(requester, requestee, status);"
+        // LIST_TAGGED: WHERE tagged_users = ?, joined to favorites by fav_id
+        "CREATE INDEX IF NOT EXISTS idx_favorite_tags_tagged "
+        "ON favorite_tags(tagged_users, fav_id, tagger);"
+        // LIST_FRIENDS: both halves of WHERE user_a = ? OR user_b = ?
+        "CREATE INDEX IF NOT EXISTS idx_friendships_a "
+        "ON friendships(user_a, user_b, since);"
+        "CREATE INDEX IF NOT EXISTS idx_friendships_b "
+        "ON friendships(user_b, user_a, since);",
+        NULL},
+
+    /*
+     * Integer user ids: accounts get an INTEGER PRIMARY KEY and every reference to a
+     * user becomes that id. SQLite cannot change a column's type in place, so each
+     * table is rebuilt (create new, copy through a join on username, drop, rename);
+     * favorites and friend_requests keep their ids, which clients have seen. Rows
+     * pointing at users that no longer exist are dropped on the way. friendships and
+     * favorite_tags are now keyed on their natural key (WITHOUT ROWID), which makes
+     * the old surrogate id and one covering index unnecessary. The unused
+     * favorites.tagged column goes away.
+     */
+    {4, "integer user ids",
+        "CREATE TABLE accounts_new("
+        "id INTEGER PRIMARY KEY,"
+        "username TEXT NOT NULL UNIQUE,"
+        "password TEXT NOT NULL,"
+        "is_logged_in INTEGER NOT NULL DEFAULT 0);"
+        "INSERT INTO accounts_new(username, password, is_logged_in) "
+        "SELECT username, password, is_logged_in FROM accounts ORDER BY rowid;"
+
+        "CREATE TABLE favorites_new("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "owner_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "name TEXT NOT NULL,"
+        "category TEXT NOT NULL,"
+        "location TEXT NOT NULL,"
+        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now')));"
+        "INSERT INTO favorites_new(id, owner_id, name, category, location, created_at) "
+        "SELECT f.id, a.id, f.name, f.category, f.location, f.created_at "
+        "FROM favorites f JOIN accounts_new a ON a.username = f.owner;"
+
+        "CREATE TABLE friendships_new("
+        "user_a_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "user_b_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "since INTEGER NOT NULL DEFAULT (strftime('%s','now')),"
+        "PRIMARY KEY(user_a_id, user_b_id),"
+        "CHECK(user_a_id < user_b_id)) WITHOUT ROWID;"
+        "INSERT OR IGNORE INTO friendships_new(user_a_id, user_b_id, since) "
+        "SELECT MIN(a.id, b.id), MAX(a.id, b.id), f.since FROM friendships f "
+        "JOIN accounts_new a ON a.username = f.user_a "
+        "JOIN accounts_new b ON b.username = f.user_b WHERE a.id <> b.id;"
+
+        "CREATE TABLE friend_requests_new("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "requester_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "requestee_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "status INTEGER NOT NULL DEFAULT 0,"
+        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now')));"
+        "INSERT INTO friend_requests_new(id, requester_id, requestee_id, status, created_at) "
+        "SELECT r.id, a.id, b.id, r.status, r.created_at FROM friend_requests r "
+        "JOIN accounts_new a ON a.username = r.requester "
+        "JOIN accounts_new b ON b.username = r.requestee;"
+
+        "CREATE TABLE notifications_new("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "recipient_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "actor_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "fav_id INTEGER,"
+        "message TEXT NOT NULL,"
+        "seen INTEGER NOT NULL DEFAULT 0,"
+        "created_at INTEGER NOT NULL DEFAULT (strftime('%s','now')));"
+        "INSERT INTO notifications_new(id, recipient_id, actor_id, fav_id, message, seen, created_at) "
+        "SELECT n.id, a.id, b.id, n.fav_id, n.message, n.seen, n.created_at FROM notifications n "
+        "JOIN accounts_new a ON a.username = n.recipient "
+        "JOIN accounts_new b ON b.username = n.actor;"
+
+        "CREATE TABLE favorite_tags_new("
+        "fav_id INTEGER NOT NULL REFERENCES favorites(id) ON DELETE CASCADE,"
+        "tagger_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "tagged_id INTEGER NOT NULL REFERENCES accounts(id) ON DELETE CASCADE,"
+        "PRIMARY KEY(fav_id, tagged_id)) WITHOUT ROWID;"
+        "INSERT OR IGNORE INTO favorite_tags_new(fav_id, tagger_id, tagged_id) "
+        "SELECT t.fav_id, a.id, b.id FROM favorite_tags t "
+        "JOIN favorites_new f ON f.id = t.fav_id "
+        "JOIN accounts_new a ON a.username = t.tagger "
+        "JOIN accounts_new b ON b.username = t.tagged_users;"
+
+        // Keep AUTOINCREMENT counters, which may be past the highest surviving id
+        "DELETE FROM sqlite_sequence WHERE name LIKE '%\\_new' ESCAPE '\\';"
+        "INSERT INTO sqlite_sequence(name, seq) SELECT name || '_new', seq FROM sqlite_sequence "
+        "WHERE name IN ('favorites', 'friend_requests', 'notifications');"
+
+        "DROP TABLE favorite_tags;"
+        "DROP TABLE notifications;"
+        "DROP TABLE friend_requests;"
+        "DROP TABLE friendships;"
+        "DROP TABLE favorites;"
+        "DROP TABLE accounts;"
+        "ALTER TABLE accounts_new RENAME TO accounts;"
+        "ALTER TABLE favorites_new RENAME TO favorites;"
+        "ALTER TABLE friendships_new RENAME TO friendships;"
+        "ALTER TABLE friend_requests_new RENAME TO friend_requests;"
+        "ALTER TABLE notifications_new RENAME TO notifications;"
+        "ALTER TABLE favorite_tags_new RENAME TO favorite_tags;"
+
+        // Same covering indexes as step 3, on the id columns
+        "CREATE INDEX idx_favorites_owner "
+        "ON favorites(owner_id, id, name, category, location, created_at);"
+        "CREATE INDEX idx_friend_requests_requestee "
+        "ON friend_requests(requestee_id, created_at, requester_id, status);"
+        "CREATE INDEX idx_friend_requests_pair "
+        "ON friend_requests(requester_id, requestee_id, status);"
+        "CREATE INDEX idx_favorite_tags_tagged "
+        "ON favorite_tags(tagged_id, fav_id, tagger_id);"
+        // The primary key serves lookups by user_a_id
+        "CREATE INDEX idx_friendships_b "
+        "ON friendships(user_b_id, user_a_id, since);",
+        NULL},
+
+    // Keyset pages of LIST_REQUESTS: WHERE requestee_id = ? AND id > ? ORDER BY id
+    {5, "friend request pages",
+        "CREATE INDEX IF NOT EXISTS idx_friend_requests_requestee_id "
+        "ON friend_requests(requestee_id, id, requester_id, status, created_at);",
+        NULL},
+
+    // LIST_NOTIFICATIONS: WHERE recipient_id = ? AND id > ? ORDER BY id
+    {6, "notification backlog",
+        "CREATE INDEX IF NOT EXISTS idx_notifications_recipient "
+        "ON notifications(recipient_id, id);",
+        NULL},
+
+    // What a notification is about (notify_kind_t), so WATCH can filter by topic
+    {7, "notifications.kind",
+        "ALTER TABLE notifications ADD COLUMN kind INTEGER;",
+        NULL},
+};
+
+#define MIGRATION_COUNT ((int)(sizeof(g_migrations) / sizeof(g_migrations[0])))
+
+static int exec_sql(sqlite3 *db, const char *sql) {
+    char *errmsg = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+        LOG_ERROR("Migration SQL failed: %s", errmsg ? errmsg : sqlite3_errmsg(db));
+        sqlite3_free(errmsg);
+        return -1;
+    }
+    return 0;
+}
+
+// Run a single-row, single-integer query; returns fallback if there is no row
+static int query_int(sqlite3 *db, const char *sql, int fallback) {
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return -1;
+    int value = fallback;
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        value = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+static int add_logged_in_column(sqlite3 *db) {
+    int present = query_int(db,
+        "SELECT COUNT(*) FROM pragma_table_info('accounts') WHERE name = 'is_logged_in'", 0);
+    if (present < 0) return -1;
+    if (present) return 0;
+    return exec_sql(db, "ALTER TABLE accounts ADD COLUMN is_logged_in INTEGER NOT NULL DEFAULT 0");
+}
+
+/**
+ * @function db_schema_latest: Version the schema is at once every migration is applied.
+ *
+ * @return Highest migration version.
+ */
+int db_schema_latest(void) {
+    return g_migrations[MIGRATION_COUNT - 1].version;
+}
+
+/**
+ * @function db_schema_version: Read the schema version without running any DDL.
+ *
+ * @param db: Open connection.
+ *
+ * @return Applied version, 0 for a database without schema_version, -1 on error.
+ */
+int db_schema_version(sqlite3 *db) {
+    int exists = query_int(db,
+        "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'schema_version'", 0);
+    if (exists <= 0) return exists;
+    return query_int(db, "SELECT MAX(version) FROM schema_version", 0);
+}
+
+// Apply one step inside the caller's transaction: 1 applied, 0 already there, -1 failed
+static int apply_step(sqlite3 *db, const db_migration_t *m) {
+    if (exec_sql(db,
+            "CREATE TABLE IF NOT EXISTS schema_version("
+            "version INTEGER PRIMARY KEY,"
+            "name TEXT NOT NULL,"
+            "applied_at INTEGER NOT NULL DEFAULT (strftime('%s','now')))") != 0) return -1;
+
+    // Another server may have migrated between our first read and BEGIN IMMEDIATE
+    int current = query_int(db, "SELECT MAX(version) FROM schema_version", 0);
+    if (current < 0) return -1;
+    if (m->version <= current) return 0;
+
+    if (m->sql && exec_sql(db, m->sql) != 0) return -1;
+    if (m->apply && m->apply(db) != 0) return -1;
+
+    // Enforcement is off while steps run, so check what a rebuild left behind
+    int dangling = query_int(db, "SELECT COUNT(*) FROM pragma_foreign_key_check", 0);
+    if (dangling != 0) {
+        if (dangling > 0) LOG_ERROR("Migration %d left %d dangling foreign key(s)", m->version, dangling);
+        return -1;
+    }
+
+    char record[160];
+    snprintf(record, sizeof(record),
+             "INSERT INTO schema_version(version, name) VALUES(%d, '%s')", m->version, m->name);
+    return exec_sql(db, record) == 0 ? 1 : -1;
+}
+
+// Apply every step above current, each in its own transaction
+static int apply_steps(sqlite3 *db, int current, int *applied) {
+    for (int i = 0; i < MIGRATION_COUNT; ++i) {
+        const db_migration_t *m = &g_migrations[i];
+        if (m->version <= current) continue;
+
+        if (exec_sql(db, "BEGIN IMMEDIATE") != 0) return -1;
+        int rc = apply_step(db, m);
+        if (rc < 0 || exec_sql(db, "COMMIT") != 0) {
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+            LOG_ERROR("Schema migration %d (%s) failed, rolled back", m->version, m->name);
+            return -1;
+        }
+        if (rc > 0) {
+            if (applied) (*applied)++;
+            LOG_INFO("Applied schema migration %d (%s)", m->version, m->name);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @function db_migrate: Bring the schema up to date. Each step runs in its own
+ * BEGIN IMMEDIATE transaction together with its schema_version row, so a failed step
+ * leaves the database at the previous version. Nothing is executed when the schema
+ * is already current. Foreign key enforcement is switched off while steps run (a
+ * table rebuild would otherwise cascade the DROP) and restored afterwards.
+ *
+ * @param db: Read-write connection, with no transaction open.
+ * @param applied: Set to the number of steps applied (may be NULL).
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int db_migrate(sqlite3 *db, int *applied) {
+    if (applied) *applied = 0;
+
+    int current = db_schema_version(db);
+    if (current < 0) return -1;
+    if (current > db_schema_latest()) {
+        LOG_ERROR("Database schema version %d is newer than this server (%d)", current, db_schema_latest());
+        return -1;
+    }
+    if (current == db_schema_latest()) return 0;
+
+    int foreign_keys = query_int(db, "PRAGMA foreign_keys", 0);
+    if (foreign_keys < 0 || exec_sql(db, "PRAGMA foreign_keys = OFF") != 0) return -1;
+    int rc = apply_steps(db, current, applied);
+    if (foreign_keys) exec_sql(db, "PRAGMA foreign_keys = ON");
+    return rc;
+}
@@ -0,0 +1,28 @@
+#ifndef TCP_SERVER_MIGRATIONS_H
+#define TCP_SERVER_MIGRATIONS_H
+
+#include <sqlite3.h>
+
+/**
+ * @typedef db_migration_t: One ordered schema step. Exactly one of sql/apply is set.
+ * Steps must be idempotent: a database created before schema_version existed already
+ * has some of their effects.
+ * Fields:
+ *  - version: schema version reached once the step has been applied
+ *  - name: short description recorded in schema_version
+ *  - sql: statements run with sqlite3_exec
+ *  - apply: custom step for changes SQL alone cannot make conditional
+ */
+typedef struct db_migration {
+    int version;
+    const char *name;
+    const char *sql;
+    int (*apply)(sqlite3 *db);
+} db_migration_t;
+
+// MIGRATION FUNCTIONS
+int db_schema_latest(void);
+int db_schema_version(sqlite3 *db);
+int db_migrate(sqlite3 *db, int *applied);
+
+#endif
@@ -0,0 +1,340 @@
+#define LOG_TAG "notifier"
+
+#include "notifier.h"
+#include "database.h"
+#include "presence.h"
+#include "watch.h"
+#include "session.h"
+#include "activity_log.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NOTIFY_LINE_LEN (MAX_NAME_LEN + MAX_MSG_LEN + 64)
+
+/**
+ * @typedef notify_event_t: Events of one kind from one actor, coalesced.
+ * Fields:
+ *  - next: next event in the inbox, in arrival order
+ *  - from_id/kind: what the events share
+ *  - fav_id: favorite of the latest event (0 for none)
+ *  - count: events folded into this one
+ */
+typedef struct notify_event {
+    struct notify_event *next;
+    uint32_t from_id;
+    notify_kind_t kind;
+    int fav_id;
+    int count;
+} notify_event_t;
+
+/**
+ * @typedef notify_inbox_t: Pending events of one recipient.
+ * Fields:
+ *  - hnext: next inbox in the same hash bucket
+ *  - due_next: next inbox in due order (inboxes open in order, so due order is FIFO)
+ *  - to_id: recipient
+ *  - due_ms: when the coalescing window closes
+ *  - events/events_tail/nevents: coalesced events, one stored notification each
+ */
+typedef struct notify_inbox {
+    struct notify_inbox *hnext;
+    struct notify_inbox *due_next;
+    uint32_t to_id;
+    long long due_ms;
+    notify_event_t *events;
+    notify_event_t *events_tail;
+    int nevents;
+} notify_inbox_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_ready;
+static notify_inbox_t *g_inboxes[NOTIFY_INBOX_BUCKETS];
+static notify_inbox_t *g_due_head = NULL;
+static notify_inbox_t *g_due_tail = NULL;
+static unsigned int g_depth = 0;        // posted events not yet stored
+static unsigned int g_pending = 0;      // open inboxes
+static int g_window_ms = DEFAULT_NOTIFY_WINDOW_MS;
+static int g_running = 0;
+static unsigned long g_posted;
+static unsigned long g_coalesced;
+static unsigned long g_dropped;
+static unsigned long g_stored;
+static unsigned long g_store_errors;
+static unsigned long g_batches;
+static unsigned long g_pushes;
+static unsigned long g_pushed;
+static unsigned long g_push_failures;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static notify_inbox_t **bucket_of(uint32_t to_id) {
+    return &g_inboxes[(to_id * 2654435761u) % NOTIFY_INBOX_BUCKETS];
+}
+
+static void format_message(char *out, size_t size, const notify_event_t *ev, const char *from) {
+    switch (ev->kind) {
+    case NOTIFY_FRIEND_REQUEST:
+        if (ev->count == 1) snprintf(out, size, "%s sent you a friend request", from);
+        else snprintf(out, size, "%s sent you %d friend requests", from, ev->count);
+        break;
+    case NOTIFY_FRIEND_ACCEPTED:
+        if (ev->count == 1) snprintf(out, size, "%s accepted your friend request", from);
+        else snprintf(out, size, "%s accepted %d of your friend requests", from, ev->count);
+        break;
+    case NOTIFY_TAGGED:
+        if (ev->count == 1) snprintf(out, size, "%s tagged you in a favorite place", from);
+        else snprintf(out, size, "%s tagged you in %d places", from, ev->count);
+        break;
+    default:
+        snprintf(out, size, "%s did something", from);
+        break;
+    }
+}
+
+// Queue all of one recipient's new notifications on their session in one push; a
+// client not keeping up with its output loses them (they stay in the database)
+static void push_inbox(const notify_inbox_t *inbox, const Notification *notes) {
+    const char *to = db_user_name(inbox->to_id);
+    client_session_t *session = to ? presence_find(to) : NULL;
+    if (!session) return;
+
+    char *buf = malloc((size_t)inbox->nevents * NOTIFY_LINE_LEN);
+    if (buf && session->logged_in && session->user_id == inbox->to_id) {
+        size_t len = 0;
+        for (int i = 0; i < inbox->nevents; ++i) {
+            const Notification *note = &notes[i];
+            const char *from = db_user_name(note->from_id);
+            int n = snprintf(buf + len, NOTIFY_LINE_LEN, "NOTIFY|%d|%s|%d|%s|%ld\r\n", note->id,
+                             from ? from : "", note->fav_id, note->message, (long)note->created_at);
+            if (n > 0 && n < NOTIFY_LINE_LEN) len += (size_t)n;
+        }
+        if (len > 0 && session_push(session, buf, len) == 0) {
+            activity_log_write(session->id, session->peer, BINLOG_OUT, binlog_opcode_of("NOTIFY"), buf);
+            __atomic_add_fetch(&g_pushes, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&g_pushed, (unsigned long)inbox->nevents, __ATOMIC_RELAXED);
+        } else if (len > 0) {
+            __atomic_add_fetch(&g_push_failures, 1, __ATOMIC_RELAXED);
+        }
+    }
+    free(buf);
+    session_release(session);
+}
+
+// Store a batch of closed inboxes in one transaction, then push each to its recipient
+static void flush_batch(notify_inbox_t *batch, int count) {
+    Notification *notes = calloc((size_t)count, sizeof(*notes));
+    int rc = -1;
+    if (notes) {
+        int i = 0;
+        for (notify_inbox_t *inbox = batch; inbox; inbox = inbox->due_next) {
+            for (notify_event_t *ev = inbox->events; ev; ev = ev->next, ++i) {
+                const char *from = db_user_name(ev->from_id);
+                notes[i].to_id = inbox->to_id;
+                notes[i].from_id = ev->from_id;
+                notes[i].fav_id = ev->fav_id;
+                notes[i].kind = (int)ev->kind;
+                format_message(notes[i].message, sizeof(notes[i].message), ev, from ? from : "Someone");
+            }
+        }
+        rc = db_create_notifications(notes, count);
+    }
+    __atomic_add_fetch(&g_batches, 1, __ATOMIC_RELAXED);
+    if (rc == 0) {
+        __atomic_add_fetch(&g_stored, (unsigned long)count, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&g_store_errors, (unsigned long)count, __ATOMIC_RELAXED);
+        LOG_WARN("Failed to store %d notification(s)", count);
+    }
+
+    int offset = 0;
+    while (batch) {
+        notify_inbox_t *inbox = batch;
+        batch = inbox->due_next;
+        if (rc == 0) {
+            push_inbox(inbox, notes + offset);
+            for (int i = 0; i < inbox->nevents; ++i) {
+                const Notification *note = &notes[offset + i];
+                watch_publish(note->to_id, note->kind, (uint32_t)note->id);
+            }
+        }
+        offset += inbox->nevents;
+        while (inbox->events) {
+            notify_event_t *ev = inbox->events;
+            inbox->events = ev->next;
+            free(ev);
+        }
+        free(inbox);
+    }
+    free(notes);
+}
+
+// Detach the inboxes whose window has closed (about NOTIFY_BATCH_MAX notifications); caller holds g_lock
+static notify_inbox_t *take_due(long long now, int *out_count) {
+    notify_inbox_t *batch = NULL;
+    notify_inbox_t **tail = &batch;
+    int count = 0;
+    while (g_due_head && g_due_head->due_ms <= now && count < NOTIFY_BATCH_MAX) {
+        notify_inbox_t *inbox = g_due_head;
+        g_due_head = inbox->due_next;
+        if (!g_due_head) g_due_tail = NULL;
+
+        notify_inbox_t **link = bucket_of(inbox->to_id);
+        while (*link != inbox) link = &(*link)->hnext;
+        *link = inbox->hnext;
+
+        for (notify_event_t *ev = inbox->events; ev; ev = ev->next) g_depth -= (unsigned int)ev->count;
+        g_pending--;
+        count += inbox->nevents;
+        inbox->due_next = NULL;
+        *tail = inbox;
+        tail = &inbox->due_next;
+    }
+    *out_count = count;
+    return batch;
+}
+
+static void *notifier_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        if (!g_due_head) {
+            pthread_cond_wait(&g_ready, &g_lock);
+            continue;
+        }
+        long long now = now_ms();
+        if (g_due_head->due_ms > now) {
+            long long due = g_due_head->due_ms;
+            struct timespec ts = { (time_t)(due / 1000), (long)(due % 1000) * 1000000L };
+            pthread_cond_timedwait(&g_ready, &g_lock, &ts);
+            continue;
+        }
+        int count = 0;
+        notify_inbox_t *batch = take_due(now, &count);
+        pthread_mutex_unlock(&g_lock);
+        flush_batch(batch, count);
+        pthread_mutex_lock(&g_lock);
+    }
+    return NULL;
+}
+
+/**
+ * @function notifier_start: Start the delivery thread.
+ *
+ * @param window_ms: How long an inbox collects events before it is stored and pushed
+ * (0 = as soon as the thread gets to it).
+ *
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+int notifier_start(int window_ms) {
+    g_window_ms = window_ms > 0 ? window_ms : 0;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_ready, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, notifier_thread, NULL) != 0) return -1;
+    pthread_detach(tid);
+    g_running = 1;
+    return 0;
+}
+
+/**
+ * @function notifier_post: Queue an event for its recipient. Never waits on the
+ * database; the caller's reply goes out first. An event of the same kind from the
+ * same actor already waiting in the inbox absorbs it.
+ *
+ * @param to_id: Recipient.
+ * @param from_id: User whose action caused it.
+ * @param kind: What happened.
+ * @param fav_id: Favorite it refers to, 0 for none.
+ *
+ * @return 0 if queued, -1 if the notifier is not running, out of memory or full.
+ */
+int notifier_post(uint32_t to_id, uint32_t from_id, notify_kind_t kind, int fav_id) {
+    if (!g_running || !to_id || !from_id) return -1;
+    notify_event_t *fresh = calloc(1, sizeof(*fresh));
+    if (!fresh) return -1;
+    fresh->from_id = from_id;
+    fresh->kind = kind;
+    fresh->fav_id = fav_id;
+    fresh->count = 1;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_depth >= NOTIFY_QUEUE_MAX) {
+        pthread_mutex_unlock(&g_lock);
+        free(fresh);
+        __atomic_add_fetch(&g_dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    notify_inbox_t **bucket = bucket_of(to_id);
+    notify_inbox_t *inbox = *bucket;
+    while (inbox && inbox->to_id != to_id) inbox = inbox->hnext;
+    if (!inbox) {
+        inbox = calloc(1, sizeof(*inbox));
+        if (!inbox) {
+            pthread_mutex_unlock(&g_lock);
+            free(fresh);
+            return -1;
+        }
+        inbox->to_id = to_id;
+        inbox->due_ms = now_ms() + g_window_ms;
+        inbox->hnext = *bucket;
+        *bucket = inbox;
+        if (g_due_tail) g_due_tail->due_next = inbox;
+        else g_due_head = inbox;
+        g_due_tail = inbox;
+        g_pending++;
+        pthread_cond_signal(&g_ready);
+    }
+
+    notify_event_t *ev = inbox->events;
+    while (ev && (ev->from_id != from_id || ev->kind != kind)) ev = ev->next;
+    if (ev) {
+        ev->count++;
+        if (fav_id) ev->fav_id = fav_id;
+        g_coalesced++;
+    } else {
+        if (inbox->events_tail) inbox->events_tail->next = fresh;
+        else inbox->events = fresh;
+        inbox->events_tail = fresh;
+        inbox->nevents++;
+        fresh = NULL;
+    }
+    g_depth++;
+    g_posted++;
+    pthread_mutex_unlock(&g_lock);
+    free(fresh);
+    return 0;
+}
+
+void notifier_dump_metrics(FILE *out) {
+    pthread_mutex_lock(&g_lock);
+    unsigned int depth = g_depth;
+    unsigned int pending = g_pending;
+    unsigned long posted = g_posted;
+    unsigned long coalesced = g_coalesced;
+    pthread_mutex_unlock(&g_lock);
+    unsigned long stored = __atomic_load_n(&g_stored, __ATOMIC_RELAXED);
+    unsigned long batches = __atomic_load_n(&g_batches, __ATOMIC_RELAXED);
+    fprintf(out, "posted=%lu queued=%u inboxes=%u coalesced=%lu coalesce_ratio=%.2f dropped=%lu "
+            "stored=%lu batches=%lu avg_batch=%.1f store_errors=%lu pushes=%lu pushed=%lu push_failures=%lu\n",
+            posted, depth, pending, coalesced,
+            posted ? (double)coalesced / (double)posted : 0.0,
+            __atomic_load_n(&g_dropped, __ATOMIC_RELAXED), stored, batches,
+            batches ? (double)stored / (double)batches : 0.0,
+            __atomic_load_n(&g_store_errors, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_pushes, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_pushed, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_push_failures, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,43 @@
+#ifndef TCP_SERVER_NOTIFIER_H
+#define TCP_SERVER_NOTIFIER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Notification delivery. Handlers post an event and return; events wait in a
+ * per-recipient inbox for a short window, so a burst from one user collapses into one
+ * notification ("alice tagged you in 5 places"). A background thread then stores the
+ * due inboxes in one transaction and, for each recipient who is online, writes all of
+ * their notifications to the socket at once as unsolicited lines:
+ *
+ *     NOTIFY|<id>|<from>|<fav_id>|<message>|<created_at>\r\n
+ *
+ * NOTIFY lines may arrive between any two reply lines; clients tell them apart by
+ * the prefix. Users who were offline read the backlog with LIST_NOTIFICATIONS.
+ */
+
+#define DEFAULT_NOTIFY_WINDOW_MS 100
+#define NOTIFY_QUEUE_MAX 65536
+#define NOTIFY_BATCH_MAX 256
+#define NOTIFY_INBOX_BUCKETS 1024
+
+/**
+ * @typedef notify_kind_t: What happened; events coalesce per actor and kind.
+ *  - NOTIFY_FRIEND_REQUEST: the actor sent the recipient a friend request
+ *  - NOTIFY_FRIEND_ACCEPTED: the actor accepted the recipient's friend request
+ *  - NOTIFY_TAGGED: the actor tagged the recipient in one of their favorites
+ */
+typedef enum notify_kind {
+    NOTIFY_FRIEND_REQUEST = 0,
+    NOTIFY_FRIEND_ACCEPTED,
+    NOTIFY_TAGGED,
+    NOTIFY_KINDS
+} notify_kind_t;
+
+// NOTIFIER FUNCTIONS
+int notifier_start(int window_ms);
+int notifier_post(uint32_t to_id, uint32_t from_id, notify_kind_t kind, int fav_id);
+void notifier_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,159 @@
+#include "out_buffer.h"
+#include "admission.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+static unsigned long g_commands = 0;
+static unsigned long g_read_calls = 0;
+static unsigned long g_write_calls = 0;
+static unsigned long g_bytes_written = 0;
+static unsigned long g_partial_writes = 0;
+static unsigned long g_would_block = 0;
+
+void outbuf_init(out_buffer_t *ob) {
+    memset(ob, 0, sizeof(*ob));
+}
+
+void outbuf_free(out_buffer_t *ob) {
+    out_chunk_t *c = ob->head;
+    while (c) {
+        out_chunk_t *next = c->next;
+        free(c);
+        admission_charge(-(long)sizeof(out_chunk_t));
+        c = next;
+    }
+    memset(ob, 0, sizeof(*ob));
+}
+
+/**
+ * @function outbuf_append: Copy bytes to the end of the chain.
+ *
+ * @return 0 on success, -1 if a chunk could not be allocated.
+ */
+int outbuf_append(out_buffer_t *ob, const char *data, size_t len) {
+    while (len > 0) {
+        out_chunk_t *c = ob->tail;
+        if (!c || c->end == OUT_CHUNK_SIZE) {
+            c = malloc(sizeof(out_chunk_t));
+            if (!c) return -1;
+            admission_charge((long)sizeof(out_chunk_t));
+            c->next = NULL;
+            c->start = c->end = 0;
+            if (ob->tail) ob->tail->next = c;
+            else ob->head = c;
+            ob->tail = c;
+        }
+        size_t n = OUT_CHUNK_SIZE - c->end;
+        if (n > len) n = len;
+        memcpy(c->data + c->end, data, n);
+        c->end += n;
+        ob->pending += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Drop the first n written bytes from the chain.
+static void outbuf_consume(out_buffer_t *ob, size_t n) {
+    ob->pending -= n;
+    while (n > 0 && ob->head) {
+        out_chunk_t *c = ob->head;
+        size_t avail = c->end - c->start;
+        if (n < avail) {
+            c->start += n;
+            return;
+        }
+        n -= avail;
+        ob->head = c->next;
+        if (!ob->head) ob->tail = NULL;
+        free(c);
+        admission_charge(-(long)sizeof(out_chunk_t));
+    }
+}
+
+// Write the chain until it is empty or the socket would block; nowait never blocks,
+// even on a blocking socket
+static int flush_chain(out_buffer_t *ob, int fd, int nowait) {
+    while (ob->head) {
+        struct iovec iov[OUT_MAX_IOV];
+        int cnt = 0;
+        size_t want = 0;
+        for (out_chunk_t *c = ob->head; c && cnt < OUT_MAX_IOV; c = c->next) {
+            iov[cnt].iov_base = c->data + c->start;
+            iov[cnt].iov_len = c->end - c->start;
+            want += iov[cnt].iov_len;
+            cnt++;
+        }
+
+        ssize_t w;
+        if (nowait) {
+            struct msghdr msg = { .msg_iov = iov, .msg_iovlen = (size_t)cnt };
+            w = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else {
+            w = writev(fd, iov, cnt);
+        }
+        __atomic_add_fetch(&g_write_calls, 1, __ATOMIC_RELAXED);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                __atomic_add_fetch(&g_would_block, 1, __ATOMIC_RELAXED);
+                return 1;
+            }
+            return -1;
+        }
+        if ((size_t)w < want) __atomic_add_fetch(&g_partial_writes, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_bytes_written, (unsigned long)w, __ATOMIC_RELAXED);
+        outbuf_consume(ob, (size_t)w);
+    }
+    return 0;
+}
+
+/**
+ * @function outbuf_flush: Write pending bytes with writev(), resuming after partial
+ * writes, until the chain is empty or the socket would block.
+ *
+ * @param ob: Output buffer.
+ * @param fd: Socket to write to.
+ *
+ * @return 0 when everything was written, 1 if data remains because the socket is
+ * full (non-blocking mode), -1 on a write error.
+ */
+int outbuf_flush(out_buffer_t *ob, int fd) {
+    return flush_chain(ob, fd, 0);
+}
+
+/**
+ * @function outbuf_flush_nowait: Like outbuf_flush(), but returns 1 instead of
+ * blocking when the socket is full, whatever the socket's own mode.
+ */
+int outbuf_flush_nowait(out_buffer_t *ob, int fd) {
+    return flush_chain(ob, fd, 1);
+}
+
+void io_count_command(void) {
+    __atomic_add_fetch(&g_commands, 1, __ATOMIC_RELAXED);
+}
+
+void io_count_read(void) {
+    __atomic_add_fetch(&g_read_calls, 1, __ATOMIC_RELAXED);
+}
+
+void io_dump_metrics(FILE *out) {
+    unsigned long cmds = __atomic_load_n(&g_commands, __ATOMIC_RELAXED);
+    unsigned long reads = __atomic_load_n(&g_read_calls, __ATOMIC_RELAXED);
+    unsigned long writes = __atomic_load_n(&g_write_calls, __ATOMIC_RELAXED);
+    fprintf(out, "commands=%lu read_syscalls=%lu write_syscalls=%lu bytes_written=%lu partial_writes=%lu would_block=%lu\n",
+            cmds, reads, writes,
+            __atomic_load_n(&g_bytes_written, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_partial_writes, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_would_block, __ATOMIC_RELAXED));
+    if (cmds > 0) {
+        fprintf(out, "syscalls_per_command=%.3f (read %.3f, write %.3f)\n",
+                (double)(reads + writes) / cmds, (double)reads / cmds, (double)writes / cmds);
+    }
+}
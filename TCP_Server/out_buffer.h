@@ -0,0 +1,43 @@
+#ifndef TCP_SERVER_OUT_BUFFER_H
+#define TCP_SERVER_OUT_BUFFER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define OUT_CHUNK_SIZE 8192
+#define OUT_MAX_IOV 64
+#define DEFAULT_FLUSH_THRESHOLD (64 * 1024)
+
+typedef struct out_chunk {
+    struct out_chunk *next;
+    size_t start;
+    size_t end;
+    char data[OUT_CHUNK_SIZE];
+} out_chunk_t;
+
+/**
+ * @typedef out_buffer_t: Pending reply bytes of one connection, kept as a chain of
+ * fixed-size chunks so a flush can hand them all to one writev() call.
+ * Fields:
+ *  - head/tail: first and last chunk in the chain
+ *  - pending: bytes not yet written to the socket
+ */
+typedef struct out_buffer {
+    out_chunk_t *head;
+    out_chunk_t *tail;
+    size_t pending;
+} out_buffer_t;
+
+// OUTPUT BUFFER FUNCTIONS
+void outbuf_init(out_buffer_t *ob);
+void outbuf_free(out_buffer_t *ob);
+int outbuf_append(out_buffer_t *ob, const char *data, size_t len);
+int outbuf_flush(out_buffer_t *ob, int fd);
+int outbuf_flush_nowait(out_buffer_t *ob, int fd);
+
+// I/O SYSCALL ACCOUNTING
+void io_count_command(void);
+void io_count_read(void);
+void io_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,186 @@
+#define LOG_TAG "presence"
+
+#include "presence.h"
+#include "session.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @typedef presence_slot_t: One online account; session NULL marks an empty slot.
+ * Fields:
+ *  - hash: full hash of the username
+ *  - username: account name (the session's copy may be cleared before release)
+ *  - session: connection the account is logged in on (not a counted reference)
+ */
+typedef struct presence_slot {
+    unsigned int hash;
+    char username[MAX_NAME_LEN];
+    client_session_t *session;
+} presence_slot_t;
+
+// Serializes every login and logout against each other; held only for a probe.
+extern pthread_mutex_t account_lock;
+
+static presence_slot_t *g_slots = NULL;  // open-addressed (linear probing), at most half full
+static unsigned int g_mask = 0;
+static unsigned int g_online = 0;
+static unsigned int g_peak = 0;
+static unsigned long g_claims;
+static unsigned long g_conflicts;
+static unsigned long g_full;
+
+static unsigned int name_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Slot holding username, or the empty slot ending its probe chain
+static presence_slot_t *probe(unsigned int hash, const char *username) {
+    unsigned int i = hash & g_mask;
+    while (g_slots[i].session &&
+           (g_slots[i].hash != hash || strcmp(g_slots[i].username, username) != 0)) {
+        i = (i + 1) & g_mask;
+    }
+    return &g_slots[i];
+}
+
+// Empty slot i and pull later members of the chain back so probes never stop early
+static void erase_at(unsigned int i) {
+    unsigned int j = i;
+    for (;;) {
+        g_slots[i].session = NULL;
+        for (;;) {
+            j = (j + 1) & g_mask;
+            if (!g_slots[j].session) return;
+            unsigned int home = g_slots[j].hash & g_mask;
+            // Move j into the hole unless its home lies cyclically in (i, j]
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+            break;
+        }
+        g_slots[i] = g_slots[j];
+        i = j;
+    }
+}
+
+/**
+ * @function presence_init: Size the registry for the most sessions the server keeps.
+ *
+ * @param max_sessions: Upper bound of concurrent sessions (the admission hard limit).
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int presence_init(size_t max_sessions) {
+    size_t cap = 16;
+    while (cap < max_sessions * 2) cap <<= 1;
+    g_slots = calloc(cap, sizeof(*g_slots));
+    if (!g_slots) return -1;
+    g_mask = (unsigned int)cap - 1;
+    return 0;
+}
+
+/**
+ * @function presence_claim: Mark an account online on this session, unless another
+ * session already has it.
+ *
+ * @param session: Session logging in.
+ * @param username: Account being logged into.
+ *
+ * @return 0 on success, -2 if the account is online elsewhere, -1 if the registry is full.
+ */
+int presence_claim(client_session_t *session, const char *username) {
+    if (!g_slots || !session || !username) return -1;
+    unsigned int hash = name_hash(username);
+    int rc = 0;
+    unsigned int online;
+
+    pthread_mutex_lock(&account_lock);
+    presence_slot_t *slot = probe(hash, username);
+    if (slot->session) {
+        rc = -2;
+        g_conflicts++;
+    } else if ((g_online + 1) * 2 > g_mask + 1) {
+        rc = -1;
+        g_full++;
+    } else {
+        slot->hash = hash;
+        strncpy(slot->username, username, sizeof(slot->username) - 1);
+        slot->username[sizeof(slot->username) - 1] = '\0';
+        slot->session = session;
+        if (++g_online > g_peak) g_peak = g_online;
+        g_claims++;
+    }
+    online = g_online;
+    pthread_mutex_unlock(&account_lock);
+
+    if (rc == -1) LOG_WARN("Registry full (%u online), refusing login of %s", online, username);
+    return rc;
+}
+
+/**
+ * @function presence_release: Take the session's account offline. Does nothing when
+ * the session is not logged in or the entry belongs to another session.
+ *
+ * @param session: Session logging out or being freed.
+ */
+void presence_release(client_session_t *session) {
+    if (!g_slots || !session || !session->logged_in) return;
+    unsigned int hash = name_hash(session->username);
+
+    pthread_mutex_lock(&account_lock);
+    presence_slot_t *slot = probe(hash, session->username);
+    if (slot->session == session) {
+        erase_at((unsigned int)(slot - g_slots));
+        g_online--;
+    }
+    pthread_mutex_unlock(&account_lock);
+}
+
+/**
+ * @function presence_is_online: Check whether an account is logged in anywhere.
+ *
+ * @param username: Account name.
+ *
+ * @return 1 if online, 0 otherwise.
+ */
+int presence_is_online(const char *username) {
+    if (!g_slots || !username) return 0;
+    unsigned int hash = name_hash(username);
+    pthread_mutex_lock(&account_lock);
+    int online = probe(hash, username)->session != NULL;
+    pthread_mutex_unlock(&account_lock);
+    return online;
+}
+
+/**
+ * @function presence_find: Session an account is logged in on.
+ *
+ * @param username: Account name.
+ *
+ * @return Session with an extra reference (drop it with session_release()), or NULL
+ * if the account is offline or its connection is already being freed.
+ */
+client_session_t *presence_find(const char *username) {
+    if (!g_slots || !username) return NULL;
+    unsigned int hash = name_hash(username);
+    pthread_mutex_lock(&account_lock);
+    client_session_t *session = probe(hash, username)->session;
+    if (session && !session_try_retain(session)) session = NULL;
+    pthread_mutex_unlock(&account_lock);
+    return session;
+}
+
+void presence_dump_metrics(FILE *out) {
+    pthread_mutex_lock(&account_lock);
+    unsigned int online = g_online;
+    unsigned int peak = g_peak;
+    pthread_mutex_unlock(&account_lock);
+    fprintf(out, "online=%u peak=%u slots=%u logins=%lu conflicts=%lu full=%lu\n",
+            online, peak, g_slots ? g_mask + 1 : 0, g_claims, g_conflicts, g_full);
+}
@@ -0,0 +1,22 @@
+#ifndef TCP_SERVER_PRESENCE_H
+#define TCP_SERVER_PRESENCE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "../entity/entities.h"
+
+/*
+ * Registry of the accounts logged in right now: username -> live session. Login,
+ * logout and the "already logged in" check never reach SQLite, and a connection
+ * that dies simply drops out when its session is freed.
+ */
+
+// PRESENCE FUNCTIONS
+int presence_init(size_t max_sessions);
+int presence_claim(client_session_t *session, const char *username);
+void presence_release(client_session_t *session);
+int presence_is_online(const char *username);
+client_session_t *presence_find(const char *username);
+void presence_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,247 @@
+#include "reaper.h"
+#include "session.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @typedef session_timers_t: The three deadlines of one session.
+ */
+typedef struct session_timers {
+    timer_node_t node[REAP_REASONS];
+    client_session_t *session;
+    int evicting;
+} session_timers_t;
+
+static long long g_timeout_ms[REAP_REASONS];
+static unsigned long g_evicted[REAP_REASONS];
+static const char *g_reason_names[REAP_REASONS] = {"idle", "login", "write_stall"};
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t to_tick(long long ms) {
+    return (uint64_t)((ms + REAPER_TICK_MS - 1) / REAPER_TICK_MS);
+}
+
+/**
+ * @function reaper_configure: Set the deadlines, in seconds; 0 disables a deadline.
+ */
+void reaper_configure(int idle_sec, int login_sec, int write_sec) {
+    g_timeout_ms[REAP_IDLE] = (long long)idle_sec * 1000;
+    g_timeout_ms[REAP_LOGIN] = (long long)login_sec * 1000;
+    g_timeout_ms[REAP_WRITE_STALL] = (long long)write_sec * 1000;
+}
+
+void reaper_init(reaper_t *r, reaper_evict_fn evict, void *ctx) {
+    pthread_mutex_init(&r->lock, NULL);
+    tw_init(&r->wheel, to_tick(now_ms()));
+    r->evict = evict;
+    r->ctx = ctx;
+}
+
+/**
+ * @function reaper_add: Start watching a session. The reaper keeps a reference until
+ * reaper_remove().
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int reaper_add(reaper_t *r, client_session_t *session) {
+    session_timers_t *st = calloc(1, sizeof(session_timers_t));
+    if (!st) return -1;
+    st->session = session;
+    for (int k = 0; k < REAP_REASONS; ++k) st->node[k].kind = k;
+
+    long long now = now_ms();
+    __atomic_store_n(&session->last_activity_ms, now, __ATOMIC_RELAXED);
+    session_retain(session);
+
+    pthread_mutex_lock(&r->lock);
+    session->reaper = r;
+    session->timers = st;
+    if (g_timeout_ms[REAP_IDLE] > 0) tw_schedule(&r->wheel, &st->node[REAP_IDLE], to_tick(now + g_timeout_ms[REAP_IDLE]));
+    if (g_timeout_ms[REAP_LOGIN] > 0) tw_schedule(&r->wheel, &st->node[REAP_LOGIN], to_tick(now + g_timeout_ms[REAP_LOGIN]));
+    pthread_mutex_unlock(&r->lock);
+    return 0;
+}
+
+/**
+ * @function reaper_remove: Stop watching a session that is being closed.
+ */
+void reaper_remove(client_session_t *session) {
+    reaper_t *r = session->reaper;
+    if (!r) return;
+
+    pthread_mutex_lock(&r->lock);
+    session_timers_t *st = session->timers;
+    session->timers = NULL;
+    if (st) {
+        for (int k = 0; k < REAP_REASONS; ++k) tw_cancel(&r->wheel, &st->node[k]);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    if (st) {
+        free(st);
+        session_release(session);
+    }
+}
+
+/**
+ * @function reaper_touch: Record client activity. This is only a timestamp store; the
+ * idle timer re-checks it when it fires and re-arms itself if needed.
+ */
+void reaper_touch(client_session_t *session) {
+    __atomic_store_n(&session->last_activity_ms, now_ms(), __ATOMIC_RELAXED);
+}
+
+/**
+ * @function reaper_write_pending: Replies are left in the output buffer because the
+ * socket is full. Starts the write-stall clock, or restarts it if some bytes went out.
+ * Called with the session send lock held.
+ *
+ * @param session: Session with pending output.
+ * @param progressed: 1 if the last flush wrote at least one byte.
+ */
+void reaper_write_pending(client_session_t *session, int progressed) {
+    reaper_t *r = session->reaper;
+    if (!r || g_timeout_ms[REAP_WRITE_STALL] <= 0) return;
+
+    long long now = now_ms();
+    long long since = __atomic_load_n(&session->write_stall_ms, __ATOMIC_RELAXED);
+    if (since != 0) {
+        if (progressed) __atomic_store_n(&session->write_stall_ms, now, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_store_n(&session->write_stall_ms, now, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&r->lock);
+    session_timers_t *st = session->timers;
+    if (st && !tw_armed(&st->node[REAP_WRITE_STALL])) {
+        tw_schedule(&r->wheel, &st->node[REAP_WRITE_STALL], to_tick(now + g_timeout_ms[REAP_WRITE_STALL]));
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+void reaper_write_done(client_session_t *session) {
+    __atomic_store_n(&session->write_stall_ms, 0, __ATOMIC_RELAXED);
+}
+
+typedef struct expired_list {
+    client_session_t **items;
+    size_t count;
+    size_t cap;
+    long long now;
+} expired_list_t;
+
+/**
+ * @function on_fire: Runs under the reaper lock. Re-arms timers whose deadline moved
+ * (activity or write progress since they were set) and collects the sessions that
+ * really expired.
+ */
+static void on_fire(timer_node_t *node, void *ctx) {
+    expired_list_t *expired = (expired_list_t *)ctx;
+    int kind = node->kind;
+    session_timers_t *st = (session_timers_t *)((char *)(node - kind) - offsetof(session_timers_t, node));
+    client_session_t *session = st->session;
+    reaper_t *r = session->reaper;
+    long long deadline = 0;
+
+    switch (kind) {
+    case REAP_IDLE:
+        deadline = __atomic_load_n(&session->last_activity_ms, __ATOMIC_RELAXED) + g_timeout_ms[REAP_IDLE];
+        break;
+    case REAP_LOGIN:
+        if (__atomic_load_n(&session->logged_in, __ATOMIC_RELAXED)) return;
+        break;
+    case REAP_WRITE_STALL: {
+        long long since = __atomic_load_n(&session->write_stall_ms, __ATOMIC_RELAXED);
+        if (since == 0) return;
+        deadline = since + g_timeout_ms[REAP_WRITE_STALL];
+        break;
+    }
+    default:
+        return;
+    }
+
+    if (deadline > expired->now) {
+        tw_schedule(&r->wheel, node, to_tick(deadline));
+        return;
+    }
+    if (st->evicting) return;
+
+    if (expired->count == expired->cap) {
+        size_t cap = expired->cap ? expired->cap * 2 : 16;
+        client_session_t **items = realloc(expired->items, cap * sizeof(*items));
+        if (!items) {
+            // Try again on the next tick.
+            tw_schedule(&r->wheel, node, r->wheel.now + 1);
+            return;
+        }
+        expired->items = items;
+        expired->cap = cap;
+    }
+    st->evicting = 1;
+    session_retain(session);
+    expired->items[expired->count++] = session;
+    __atomic_add_fetch(&g_evicted[kind], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function reaper_tick: Advance the wheel to the current time and evict expired
+ * sessions.
+ *
+ * @return Milliseconds until the next tick, or -1 when every deadline is disabled.
+ * The tick is kept even with no timer armed, because another thread may add a
+ * session to this reaper while its owner sleeps in epoll_wait().
+ */
+int reaper_tick(reaper_t *r) {
+    expired_list_t expired = {NULL, 0, 0, now_ms()};
+
+    pthread_mutex_lock(&r->lock);
+    tw_advance(&r->wheel, expired.now / REAPER_TICK_MS, on_fire, &expired);
+    pthread_mutex_unlock(&r->lock);
+
+    for (size_t i = 0; i < expired.count; ++i) {
+        r->evict(expired.items[i], r->ctx);
+        session_release(expired.items[i]);
+    }
+    free(expired.items);
+    int enabled = 0;
+    for (int k = 0; k < REAP_REASONS; ++k) enabled |= g_timeout_ms[k] > 0;
+    return enabled ? REAPER_TICK_MS : -1;
+}
+
+static void *reaper_thread(void *arg) {
+    reaper_t *r = (reaper_t *)arg;
+    while (1) {
+        usleep(REAPER_TICK_MS * 1000);
+        reaper_tick(r);
+    }
+    return NULL;
+}
+
+/**
+ * @function reaper_start_thread: Drive a reaper from a dedicated thread (thread mode,
+ * where no event loop is there to tick it).
+ */
+int reaper_start_thread(reaper_t *r) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, reaper_thread, r) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+void reaper_dump_metrics(FILE *out) {
+    for (int k = 0; k < REAP_REASONS; ++k) {
+        fprintf(out, "%sevicted_%s=%lu", k ? " " : "", g_reason_names[k],
+                __atomic_load_n(&g_evicted[k], __ATOMIC_RELAXED));
+    }
+    fprintf(out, "\ntimeouts_ms: idle=%lld login=%lld write_stall=%lld\n",
+            g_timeout_ms[REAP_IDLE], g_timeout_ms[REAP_LOGIN], g_timeout_ms[REAP_WRITE_STALL]);
+}
@@ -0,0 +1,57 @@
+#ifndef TCP_SERVER_REAPER_H
+#define TCP_SERVER_REAPER_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include "timer_wheel.h"
+#include "../entity/entities.h"
+
+#define REAPER_TICK_MS 100
+#define DEFAULT_IDLE_TIMEOUT 300
+#define DEFAULT_LOGIN_TIMEOUT 60
+#define DEFAULT_WRITE_TIMEOUT 30
+
+/**
+ * @typedef reap_reason_t: Deadline that can expire a session.
+ *  - REAP_IDLE: nothing received from the client for idle_timeout
+ *  - REAP_LOGIN: not logged in within login_timeout of connecting
+ *  - REAP_WRITE_STALL: replies pending with no write progress for write_timeout
+ */
+typedef enum reap_reason {
+    REAP_IDLE = 0,
+    REAP_LOGIN,
+    REAP_WRITE_STALL,
+    REAP_REASONS
+} reap_reason_t;
+
+typedef void (*reaper_evict_fn)(client_session_t *session, void *ctx);
+
+/**
+ * @typedef reaper_t: Timer wheel plus the sessions it watches. Each event loop owns one;
+ * thread mode uses a single reaper driven by its own thread.
+ * Fields:
+ *  - lock: serializes wheel access between the owner and threads that report writes
+ *  - wheel: deadlines of the watched sessions
+ *  - evict: called without the lock for every expired session
+ *  - ctx: passed through to evict
+ */
+typedef struct reaper {
+    pthread_mutex_t lock;
+    timer_wheel_t wheel;
+    reaper_evict_fn evict;
+    void *ctx;
+} reaper_t;
+
+// REAPER FUNCTIONS
+void reaper_configure(int idle_sec, int login_sec, int write_sec);
+void reaper_init(reaper_t *r, reaper_evict_fn evict, void *ctx);
+int reaper_start_thread(reaper_t *r);
+int reaper_add(reaper_t *r, client_session_t *session);
+void reaper_remove(client_session_t *session);
+void reaper_touch(client_session_t *session);
+void reaper_write_pending(client_session_t *session, int progressed);
+void reaper_write_done(client_session_t *session);
+int reaper_tick(reaper_t *r);
+void reaper_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,306 @@
+#define LOG_TAG "replies"
+
+#include "reply_cache.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @struct reply_entry: One cached reply.
+ * Fields:
+ *  - hnext: next entry in the same hash bucket
+ *  - prev/next: stripe LRU list, most recently used first
+ *  - user_id/list/after/limit: key (after = limit = 0 for the unpaged listing)
+ *  - version: version of (user_id, list) the reply was built under
+ *  - refs: the cache's own reference while linked, plus one per reply being sent
+ *  - charge: bytes counted against the stripe budget
+ *  - len/data: the reply, NUL-terminated
+ */
+struct reply_entry {
+    struct reply_entry *hnext;
+    struct reply_entry *prev;
+    struct reply_entry *next;
+    uint32_t user_id;
+    int list;
+    uint32_t after;
+    int limit;
+    uint32_t version;
+    int refs;
+    size_t charge;
+    size_t len;
+    char data[];
+};
+
+/**
+ * @typedef reply_stripe_t: Independently locked slice of the cache (by user).
+ * Fields:
+ *  - lock: guards everything below
+ *  - buckets/mask: chained hash table
+ *  - head/tail: LRU list ends
+ *  - count/used/cap: entries held, bytes they are charged and the stripe budget
+ */
+typedef struct reply_stripe {
+    pthread_mutex_t lock;
+    reply_entry_t **buckets;
+    unsigned int mask;
+    reply_entry_t *head;
+    reply_entry_t *tail;
+    size_t count;
+    size_t used;
+    size_t cap;
+} reply_stripe_t;
+
+static reply_stripe_t g_stripes[REPLY_CACHE_STRIPES];
+static uint32_t g_versions[REPLY_CACHE_VERSION_SLOTS];
+static int g_enabled = 0;
+static size_t g_capacity = 0;
+static size_t g_max_entry = 0;
+static unsigned long g_hits;
+static unsigned long g_misses;
+static unsigned long g_stale;
+static unsigned long g_evictions;
+static unsigned long g_raced_fills;
+static unsigned long g_too_big;
+static unsigned long g_bumps;
+
+static unsigned int key_hash(uint32_t user_id, int list, uint32_t after, int limit) {
+    unsigned int h = user_id * 2654435761u;
+    h ^= ((unsigned int)list + 1) * 0x9e3779b9u;
+    h ^= after * 0x85ebca6bu;
+    h ^= (unsigned int)limit * 0xc2b2ae35u;
+    return h ^ (h >> 15);
+}
+
+static uint32_t *version_slot(uint32_t user_id, reply_list_t list) {
+    unsigned int h = (user_id * REPLY_LISTS + (unsigned int)list) * 2654435761u;
+    return &g_versions[(h >> 16) % REPLY_CACHE_VERSION_SLOTS];
+}
+
+static reply_stripe_t *stripe_of(uint32_t user_id) {
+    return &g_stripes[user_id % REPLY_CACHE_STRIPES];
+}
+
+static reply_entry_t **bucket_of(reply_stripe_t *st, unsigned int hash) {
+    return &st->buckets[hash & st->mask];
+}
+
+static void lru_unlink(reply_stripe_t *st, reply_entry_t *e) {
+    if (e->prev) e->prev->next = e->next;
+    else st->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else st->tail = e->prev;
+}
+
+static void lru_push_front(reply_stripe_t *st, reply_entry_t *e) {
+    e->prev = NULL;
+    e->next = st->head;
+    if (st->head) st->head->prev = e;
+    else st->tail = e;
+    st->head = e;
+}
+
+static reply_entry_t *find(reply_stripe_t *st, unsigned int hash, uint32_t user_id, int list,
+                           uint32_t after, int limit) {
+    for (reply_entry_t *e = *bucket_of(st, hash); e; e = e->hnext) {
+        if (e->user_id == user_id && e->list == list && e->after == after && e->limit == limit) return e;
+    }
+    return NULL;
+}
+
+static void entry_unref(reply_entry_t *e) {
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0) free(e);
+}
+
+// Take an entry out of the stripe; replies still being sent keep it alive
+static void drop(reply_stripe_t *st, reply_entry_t *e) {
+    reply_entry_t **pp = bucket_of(st, key_hash(e->user_id, e->list, e->after, e->limit));
+    while (*pp != e) pp = &(*pp)->hnext;
+    *pp = e->hnext;
+    lru_unlink(st, e);
+    st->count--;
+    st->used -= e->charge;
+    entry_unref(e);
+}
+
+/**
+ * @function reply_cache_init: Size the cache. Must run before any worker thread.
+ *
+ * @param capacity_bytes: Budget for cached replies; 0 disables the cache and every
+ * listing is built from scratch.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int reply_cache_init(size_t capacity_bytes) {
+    g_capacity = capacity_bytes;
+    if (capacity_bytes == 0) return 0;
+
+    size_t per_stripe = capacity_bytes / REPLY_CACHE_STRIPES;
+    // One reply may take at most a quarter of its stripe, so a few big lists cannot
+    // flush everyone else's
+    g_max_entry = per_stripe / 4;
+    unsigned int nbuckets = 8;
+    while (nbuckets < per_stripe / 1024) nbuckets <<= 1;
+
+    for (int i = 0; i < REPLY_CACHE_STRIPES; ++i) {
+        reply_stripe_t *st = &g_stripes[i];
+        pthread_mutex_init(&st->lock, NULL);
+        st->buckets = calloc(nbuckets, sizeof(*st->buckets));
+        if (!st->buckets) return -1;
+        st->mask = nbuckets - 1;
+        st->cap = per_stripe;
+    }
+    g_enabled = 1;
+    return 0;
+}
+
+/**
+ * @function reply_cache_max_entry: Longest reply worth capturing for the cache.
+ *
+ * @return Bytes, 0 if the cache is disabled.
+ */
+size_t reply_cache_max_entry(void) {
+    if (!g_enabled || g_max_entry <= sizeof(reply_entry_t) + 1) return 0;
+    return g_max_entry - sizeof(reply_entry_t) - 1;
+}
+
+/**
+ * @function reply_cache_get: Look up a reply built under the list's current version.
+ *
+ * @param user_id: User the listing belongs to.
+ * @param list: Which listing.
+ * @param page: Page asked for, NULL for the whole listing.
+ * @param out_version: Current version, to pass to reply_cache_put() after a miss.
+ *
+ * @return The entry, which the caller must hand back with reply_cache_release(), or
+ * NULL on a miss.
+ */
+reply_entry_t *reply_cache_get(uint32_t user_id, reply_list_t list, const db_page_t *page,
+                               uint32_t *out_version) {
+    uint32_t version = __atomic_load_n(version_slot(user_id, list), __ATOMIC_ACQUIRE);
+    if (out_version) *out_version = version;
+    if (!g_enabled) return NULL;
+
+    uint32_t after = page ? page->after : 0;
+    int limit = page ? page->limit : 0;
+    unsigned int hash = key_hash(user_id, (int)list, after, limit);
+    reply_stripe_t *st = stripe_of(user_id);
+
+    pthread_mutex_lock(&st->lock);
+    reply_entry_t *e = find(st, hash, user_id, (int)list, after, limit);
+    if (e && e->version != version) {
+        drop(st, e);
+        e = NULL;
+        __atomic_add_fetch(&g_stale, 1, __ATOMIC_RELAXED);
+    }
+    if (e) {
+        lru_unlink(st, e);
+        lru_push_front(st, e);
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&st->lock);
+
+    __atomic_add_fetch(e ? &g_hits : &g_misses, 1, __ATOMIC_RELAXED);
+    return e;
+}
+
+const char *reply_entry_data(const reply_entry_t *entry) {
+    return entry->data;
+}
+
+void reply_cache_release(reply_entry_t *entry) {
+    if (entry) entry_unref(entry);
+}
+
+/**
+ * @function reply_cache_put: Store a reply built after a miss. It is discarded when
+ * the list's version moved while the reply was being built, since it may predate
+ * that write.
+ *
+ * @param user_id/list/page: Same as the reply_cache_get() that missed.
+ * @param version: Version that reply_cache_get() reported.
+ * @param data/len: The complete reply.
+ */
+void reply_cache_put(uint32_t user_id, reply_list_t list, const db_page_t *page, uint32_t version,
+                     const char *data, size_t len) {
+    if (!g_enabled || !data) return;
+    if (len > reply_cache_max_entry()) {
+        __atomic_add_fetch(&g_too_big, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    reply_entry_t *e = malloc(sizeof(*e) + len + 1);
+    if (!e) return;
+    memset(e, 0, sizeof(*e));
+    e->user_id = user_id;
+    e->list = (int)list;
+    e->after = page ? page->after : 0;
+    e->limit = page ? page->limit : 0;
+    e->version = version;
+    e->refs = 1;
+    e->charge = sizeof(*e) + len + 1;
+    e->len = len;
+    memcpy(e->data, data, len);
+    e->data[len] = '\0';
+
+    unsigned int hash = key_hash(user_id, e->list, e->after, e->limit);
+    reply_stripe_t *st = stripe_of(user_id);
+    pthread_mutex_lock(&st->lock);
+    if (__atomic_load_n(version_slot(user_id, list), __ATOMIC_ACQUIRE) != version) {
+        pthread_mutex_unlock(&st->lock);
+        free(e);
+        __atomic_add_fetch(&g_raced_fills, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    reply_entry_t *old = find(st, hash, user_id, e->list, e->after, e->limit);
+    if (old) drop(st, old);
+    while (st->tail && st->used + e->charge > st->cap) {
+        drop(st, st->tail);
+        __atomic_add_fetch(&g_evictions, 1, __ATOMIC_RELAXED);
+    }
+    reply_entry_t **bucket = bucket_of(st, hash);
+    e->hnext = *bucket;
+    *bucket = e;
+    lru_push_front(st, e);
+    st->count++;
+    st->used += e->charge;
+    pthread_mutex_unlock(&st->lock);
+}
+
+/**
+ * @function reply_cache_bump: Invalidate every cached page of a user's listing.
+ * Called once a write that changes it has committed.
+ *
+ * @param user_id: User whose listing changed.
+ * @param list: Which listing.
+ */
+void reply_cache_bump(uint32_t user_id, reply_list_t list) {
+    __atomic_add_fetch(version_slot(user_id, list), 1, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&g_bumps, 1, __ATOMIC_RELAXED);
+}
+
+void reply_cache_dump_metrics(FILE *out) {
+    if (!g_enabled) {
+        fprintf(out, "disabled\n");
+        return;
+    }
+    size_t entries = 0, used = 0;
+    for (int i = 0; i < REPLY_CACHE_STRIPES; ++i) {
+        pthread_mutex_lock(&g_stripes[i].lock);
+        entries += g_stripes[i].count;
+        used += g_stripes[i].used;
+        pthread_mutex_unlock(&g_stripes[i].lock);
+    }
+    unsigned long hits = __atomic_load_n(&g_hits, __ATOMIC_RELAXED);
+    unsigned long misses = __atomic_load_n(&g_misses, __ATOMIC_RELAXED);
+    unsigned long total = hits + misses;
+    fprintf(out, "hits=%lu misses=%lu hit_rate=%.1f%% stale=%lu evictions=%lu raced_fills=%lu too_big=%lu bumps=%lu\n",
+            hits, misses, total ? 100.0 * (double)hits / (double)total : 0.0,
+            __atomic_load_n(&g_stale, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_evictions, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_raced_fills, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_too_big, __ATOMIC_RELAXED),
+            __atomic_load_n(&g_bumps, __ATOMIC_RELAXED));
+    fprintf(out, "entries=%zu memory=%zuKB capacity=%zuKB\n", entries, used / 1024, g_capacity / 1024);
+}
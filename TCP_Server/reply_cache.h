@@ -0,0 +1,49 @@
+#ifndef TCP_SERVER_REPLY_CACHE_H
+#define TCP_SERVER_REPLY_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "database.h"
+
+/*
+ * Finished LIST_FAVORITES, LIST_FRIENDS and LIST_TAGGED_FAVORITES replies, kept as
+ * the bytes that went on the wire and keyed on (user, list, page). Each (user, list)
+ * has a version that the database bumps once a write touching that list commits; an
+ * entry stored under an older version is never served again. Memory is bounded by
+ * a byte budget with least recently used eviction.
+ */
+
+#define DEFAULT_REPLY_CACHE_KB 16384
+#define REPLY_CACHE_STRIPES 16
+// Versions live in a fixed table; two lists sharing a slot only cost extra misses
+#define REPLY_CACHE_VERSION_SLOTS 65536
+
+/**
+ * @typedef reply_list_t: Listing a cached reply answers.
+ *  - REPLY_LIST_FAVORITES: LIST_FAVORITES, the user's own favorites
+ *  - REPLY_LIST_FRIENDS: LIST_FRIENDS
+ *  - REPLY_LIST_TAGGED: LIST_TAGGED_FAVORITES, favorites the user was tagged in
+ */
+typedef enum reply_list {
+    REPLY_LIST_FAVORITES = 0,
+    REPLY_LIST_FRIENDS,
+    REPLY_LIST_TAGGED,
+    REPLY_LISTS
+} reply_list_t;
+
+typedef struct reply_entry reply_entry_t;
+
+// REPLY CACHE FUNCTIONS
+int reply_cache_init(size_t capacity_bytes);
+size_t reply_cache_max_entry(void);
+reply_entry_t *reply_cache_get(uint32_t user_id, reply_list_t list, const db_page_t *page,
+                               uint32_t *out_version);
+const char *reply_entry_data(const reply_entry_t *entry);
+void reply_cache_release(reply_entry_t *entry);
+void reply_cache_put(uint32_t user_id, reply_list_t list, const db_page_t *page, uint32_t version,
+                     const char *data, size_t len);
+void reply_cache_bump(uint32_t user_id, reply_list_t list);
+void reply_cache_dump_metrics(FILE *out);
+
+#endif
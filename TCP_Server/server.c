@@ -15,16 +15,45 @@
 #include <strings.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
+#include <getopt.h>
 #include "ultilities.h"
 #include "command_handlers.h"
+#include "server_config.h"
+#include "session.h"
+#include "event_loop.h"
+#include "worker_pool.h"
+#include "line_framer.h"
+#include "metrics.h"
+#include "out_buffer.h"
+#include "listener.h"
+#include "admission.h"
+#include "reaper.h"
+#include "activity_log.h"
+#include "account_cache.h"
+#include "reply_cache.h"
+#include "friend_graph.h"
+#include "presence.h"
+#include "notifier.h"
+#include "watch.h"
+#include "log.h"
 #define BUFF_SIZE 4096
-#define BACKLOG 2
 #define MAX_FAVS 128
 #define MAX_FRIENDS 128
 #define MAX_REQUESTS 128
 #define MAX_NOTIFS 128
+#define DEFAULT_WORKERS 4
+#define DEFAULT_QUEUE_DEPTH 1024
+#define PAUSE_RECHECK_US 100000
 
 pthread_mutex_t account_lock = PTHREAD_MUTEX_INITIALIZER;
+server_config_t g_config;
+static reaper_t g_thread_reaper;
+
+// Thread mode: shutting the socket down wakes the blocked handle_client thread.
+static void evict_thread_session(client_session_t *session, void *ctx) {
+    (void)ctx;
+    session_close(session);
+}
 
 /**
  * @function handle_client: Handle communication with a connected client.
@@ -34,132 +63,493 @@ pthread_mutex_t account_lock = PTHREAD_MUTEX_INITIALIZER;
  * @return NULL
  */
 void *handle_client(void *arg) {
-    char buff[BUFF_SIZE];
-    char *message = malloc(BUFF_SIZE * 4);
-
     client_session_t *session = (client_session_t *)arg;
-    message[0] = '\0';
     
     pthread_detach(pthread_self());
     
-    send_request(session->sockfd, "100 Welcome to the server\r\n");
+    send_reply(session, "100 Welcome to the server\r\n");
+    reaper_add(&g_thread_reaper, session);
 
     while (1) {
-        memset(buff, 0, sizeof(buff));
-        int len = recv_response(session->sockfd, buff, sizeof(buff));
+        int len = session_read_lines(session);
+        if (len < 0 && errno == EINTR) continue;
         if (len <= 0) break;
+    }
+
+    session_close(session);
+    reaper_remove(session);
+    session_release(session);
+    return NULL;
+}
+
+
+static void on_sigusr2(int sig) {
+    (void)sig;
+    log_toggle_verbose();
+}
 
-        buff[len] = '\0';
-        printf("\n Raw recv: '%s'\n", buff);
+// Long-only options.
+enum {
+    OPT_SOFT_SESSIONS = 256,
+    OPT_HARD_SESSIONS,
+    OPT_SOFT_MEM,
+    OPT_HARD_MEM,
+    OPT_IDLE_TIMEOUT,
+    OPT_LOGIN_TIMEOUT,
+    OPT_WRITE_TIMEOUT,
+    OPT_LOG_RING,
+    OPT_LOG_FULL,
+    OPT_LOG_FORMAT,
+    OPT_LOG_PAYLOAD,
+    OPT_LOG_SEGMENT,
+    OPT_LOG_LEVEL,
+    OPT_DB_READERS,
+    OPT_DB_BUSY_TIMEOUT,
+    OPT_DB_BATCH_MS,
+    OPT_DB_BATCH_OPS,
+    OPT_DB_SYNC,
+    OPT_ACCOUNT_CACHE,
+    OPT_REPLY_CACHE,
+    OPT_NOTIFY_WINDOW
+};
 
-        strcat(message, buff);
+/**
+ * @function print_usage: Print command line help.
+ *
+ * @param prog: Program name (argv[0]).
+ */
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] <Port_Number>\n", prog);
+    printf("Options:\n");
+    printf("  -m, --io-mode=epoll|thread   socket servicing model (default: epoll)\n");
+    printf("  -l, --loops=N                event loop threads in epoll mode (default: CPU count)\n");
+    printf("  -w, --workers=N              command worker threads, 0 = run inline (default: %d)\n", DEFAULT_WORKERS);
+    printf("  -q, --queue-depth=N          max queued commands across sessions (default: %d)\n", DEFAULT_QUEUE_DEPTH);
+    printf("  -o, --overflow=reject|block  full queue policy (default: reject with 503)\n");
+    printf("  -L, --max-line=BYTES         longest accepted command line (default: %d)\n", DEFAULT_MAX_LINE);
+    printf("  -f, --flush-threshold=BYTES  flush buffered replies early past this size (default: %d)\n", DEFAULT_FLUSH_THRESHOLD);
+    printf("  -n, --no-coalesce            write every reply immediately (for comparison)\n");
+    printf("  -s, --shards=N               SO_REUSEPORT listening sockets, one per acceptor (default: 1)\n");
+    printf("  -b, --backlog=N              listen() backlog per shard (default: %d)\n", DEFAULT_BACKLOG);
+    printf("      --soft-sessions=N        shed new clients with 503 past N sessions (default: %d)\n", MAX_SESSION);
+    printf("      --hard-sessions=N        stop accepting past N sessions (default: %d)\n", MAX_SESSION + MAX_SESSION / 10);
+    printf("      --soft-mem=MB            shed new clients past MB of session memory (default: %d)\n", DEFAULT_SOFT_MEM_MB);
+    printf("      --hard-mem=MB            stop accepting past MB of session memory (default: %d)\n", DEFAULT_HARD_MEM_MB);
+    printf("      --idle-timeout=SEC       close clients silent for SEC seconds, 0 = never (default: %d)\n", DEFAULT_IDLE_TIMEOUT);
+    printf("      --login-timeout=SEC      close clients not logged in after SEC seconds, 0 = never (default: %d)\n", DEFAULT_LOGIN_TIMEOUT);
+    printf("      --write-timeout=SEC      close clients not reading replies for SEC seconds, 0 = never (default: %d)\n", DEFAULT_WRITE_TIMEOUT);
+    printf("      --log-ring=N             activity log ring slots (default: %d)\n", DEFAULT_LOG_RING);
+    printf("      --log-full=block|drop    full log ring policy (default: block)\n");
+    printf("      --log-format=text|binary activity log format (default: text; read binary with mmt-logcat)\n");
+    printf("      --log-payload=BYTES      payload kept per binary log record (default: %d)\n", DEFAULT_LOG_PAYLOAD);
+    printf("      --log-segment=MB         preallocated binary log segment size (default: %d)\n", DEFAULT_LOG_SEGMENT_MB);
+    printf("      --log-level=LEVEL        trace|debug|info|warn|error|off (default: info; SIGUSR2 toggles\n");
+    printf("                               the most verbose level compiled in, see LOG_COMPILE_LEVEL)\n");
+    printf("      --db-readers=N           read-only SQLite connections, 0 = share the writer (default: %d)\n", DEFAULT_DB_READERS);
+    printf("      --db-busy-timeout=MS     wait on a locked database before failing (default: %d)\n", DEFAULT_DB_BUSY_TIMEOUT_MS);
+    printf("      --db-batch-ms=MS         group commit window for writes, 0 = commit once no writer\n");
+    printf("                               is waiting (default: %d)\n", DEFAULT_DB_BATCH_MS);
+    printf("      --db-batch-ops=N         writes that close a group commit early (default: %d)\n", DEFAULT_DB_BATCH_OPS);
+    printf("      --db-sync=full|normal    full: acked writes survive power loss; normal: only a\n");
+    printf("                               server crash (default: full)\n");
+    printf("      --account-cache=N        accounts cached in memory, 0 = always ask the database\n");
+    printf("                               (default: %d)\n", DEFAULT_ACCOUNT_CACHE);
+    printf("      --reply-cache=KB         memory for cached list replies, 0 = always rebuild them\n");
+    printf("                               (default: %d)\n", DEFAULT_REPLY_CACHE_KB);
+    printf("      --notify-window=MS       hold notifications to a user this long to merge bursts,\n");
+    printf("                               0 = deliver at once (default: %d)\n", DEFAULT_NOTIFY_WINDOW_MS);
+    printf("  -S, --stats-interval=SEC     print counters every SEC seconds, 0 = only on SIGUSR1\n");
+}
+
+/**
+ * @function parse_args: Fill g_config from the command line.
+ *
+ * @return Index of the first positional argument, or -1 on error.
+ */
+static int parse_args(int argc, char *argv[]) {
+    static const struct option long_opts[] = {
+        {"io-mode", required_argument, NULL, 'm'},
+        {"loops", required_argument, NULL, 'l'},
+        {"workers", required_argument, NULL, 'w'},
+        {"queue-depth", required_argument, NULL, 'q'},
+        {"overflow", required_argument, NULL, 'o'},
+        {"max-line", required_argument, NULL, 'L'},
+        {"stats-interval", required_argument, NULL, 'S'},
+        {"flush-threshold", required_argument, NULL, 'f'},
+        {"no-coalesce", no_argument, NULL, 'n'},
+        {"shards", required_argument, NULL, 's'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"soft-sessions", required_argument, NULL, OPT_SOFT_SESSIONS},
+        {"hard-sessions", required_argument, NULL, OPT_HARD_SESSIONS},
+        {"soft-mem", required_argument, NULL, OPT_SOFT_MEM},
+        {"hard-mem", required_argument, NULL, OPT_HARD_MEM},
+        {"idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT},
+        {"login-timeout", required_argument, NULL, OPT_LOGIN_TIMEOUT},
+        {"write-timeout", required_argument, NULL, OPT_WRITE_TIMEOUT},
+        {"log-ring", required_argument, NULL, OPT_LOG_RING},
+        {"log-full", required_argument, NULL, OPT_LOG_FULL},
+        {"log-format", required_argument, NULL, OPT_LOG_FORMAT},
+        {"log-payload", required_argument, NULL, OPT_LOG_PAYLOAD},
+        {"log-segment", required_argument, NULL, OPT_LOG_SEGMENT},
+        {"log-level", required_argument, NULL, OPT_LOG_LEVEL},
+        {"db-readers", required_argument, NULL, OPT_DB_READERS},
+        {"db-busy-timeout", required_argument, NULL, OPT_DB_BUSY_TIMEOUT},
+        {"db-batch-ms", required_argument, NULL, OPT_DB_BATCH_MS},
+        {"db-batch-ops", required_argument, NULL, OPT_DB_BATCH_OPS},
+        {"db-sync", required_argument, NULL, OPT_DB_SYNC},
+        {"account-cache", required_argument, NULL, OPT_ACCOUNT_CACHE},
+        {"reply-cache", required_argument, NULL, OPT_REPLY_CACHE},
+        {"notify-window", required_argument, NULL, OPT_NOTIFY_WINDOW},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
 
-        if (strstr(message, "\r\n") == NULL) continue;
-        char *line = strtok(message, "\r\n");
-        while (line != NULL) {
-            printf("Handle command: '%s'\n", line);
-            dispatch_command(session, line);
-            line = strtok(NULL, "\r\n");
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    g_config.io_mode = IO_MODE_EPOLL;
+    g_config.io_loops = ncpu > 0 ? (int)ncpu : 1;
+    g_config.workers = DEFAULT_WORKERS;
+    g_config.queue_depth = DEFAULT_QUEUE_DEPTH;
+    g_config.overflow = POOL_OVERFLOW_REJECT;
+    g_config.max_line = DEFAULT_MAX_LINE;
+    g_config.stats_interval = 0;
+    g_config.coalesce = 1;
+    g_config.flush_threshold = DEFAULT_FLUSH_THRESHOLD;
+    g_config.shards = 1;
+    g_config.backlog = DEFAULT_BACKLOG;
+    g_config.admission.soft_sessions = MAX_SESSION;
+    g_config.admission.hard_sessions = MAX_SESSION + MAX_SESSION / 10;
+    g_config.admission.soft_bytes = (size_t)DEFAULT_SOFT_MEM_MB << 20;
+    g_config.admission.hard_bytes = (size_t)DEFAULT_HARD_MEM_MB << 20;
+    g_config.idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    g_config.login_timeout = DEFAULT_LOGIN_TIMEOUT;
+    g_config.write_timeout = DEFAULT_WRITE_TIMEOUT;
+    g_config.log.ring_slots = DEFAULT_LOG_RING;
+    g_config.log.full = LOG_FULL_BLOCK;
+    g_config.log.format = LOG_FORMAT_TEXT;
+    g_config.log.payload_max = DEFAULT_LOG_PAYLOAD;
+    g_config.log.segment_bytes = (size_t)DEFAULT_LOG_SEGMENT_MB << 20;
+    g_config.db.readers = DEFAULT_DB_READERS;
+    g_config.db.busy_timeout_ms = DEFAULT_DB_BUSY_TIMEOUT_MS;
+    g_config.db.batch_ms = DEFAULT_DB_BATCH_MS;
+    g_config.db.batch_ops = DEFAULT_DB_BATCH_OPS;
+    g_config.db.sync = DB_SYNC_FULL;
+    g_config.account_cache = DEFAULT_ACCOUNT_CACHE;
+    g_config.reply_cache_kb = DEFAULT_REPLY_CACHE_KB;
+    g_config.notify_window_ms = DEFAULT_NOTIFY_WINDOW_MS;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:l:w:q:o:L:S:f:ns:b:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "epoll") == 0) g_config.io_mode = IO_MODE_EPOLL;
+            else if (strcmp(optarg, "thread") == 0) g_config.io_mode = IO_MODE_THREAD;
+            else return -1;
+            break;
+        case 'l':
+            g_config.io_loops = atoi(optarg);
+            if (g_config.io_loops <= 0) return -1;
+            break;
+        case 'w':
+            g_config.workers = atoi(optarg);
+            if (g_config.workers < 0) return -1;
+            break;
+        case 'q':
+            g_config.queue_depth = atoi(optarg);
+            if (g_config.queue_depth <= 0) return -1;
+            break;
+        case 'o':
+            if (strcmp(optarg, "reject") == 0) g_config.overflow = POOL_OVERFLOW_REJECT;
+            else if (strcmp(optarg, "block") == 0) g_config.overflow = POOL_OVERFLOW_BLOCK;
+            else return -1;
+            break;
+        case 'L':
+            g_config.max_line = (size_t)atol(optarg);
+            if (g_config.max_line == 0) return -1;
+            break;
+        case 'f':
+            g_config.flush_threshold = (size_t)atol(optarg);
+            if (g_config.flush_threshold == 0) return -1;
+            break;
+        case 'n':
+            g_config.coalesce = 0;
+            break;
+        case 's':
+            g_config.shards = atoi(optarg);
+            if (g_config.shards <= 0) return -1;
+            break;
+        case 'b':
+            g_config.backlog = atoi(optarg);
+            if (g_config.backlog <= 0) return -1;
+            break;
+        case OPT_SOFT_SESSIONS:
+            g_config.admission.soft_sessions = atol(optarg);
+            if (g_config.admission.soft_sessions <= 0) return -1;
+            break;
+        case OPT_HARD_SESSIONS:
+            g_config.admission.hard_sessions = atol(optarg);
+            if (g_config.admission.hard_sessions <= 0) return -1;
+            break;
+        case OPT_SOFT_MEM:
+            g_config.admission.soft_bytes = (size_t)atol(optarg) << 20;
+            if (g_config.admission.soft_bytes == 0) return -1;
+            break;
+        case OPT_HARD_MEM:
+            g_config.admission.hard_bytes = (size_t)atol(optarg) << 20;
+            if (g_config.admission.hard_bytes == 0) return -1;
+            break;
+        case OPT_IDLE_TIMEOUT:
+            g_config.idle_timeout = atoi(optarg);
+            if (g_config.idle_timeout < 0) return -1;
+            break;
+        case OPT_LOGIN_TIMEOUT:
+            g_config.login_timeout = atoi(optarg);
+            if (g_config.login_timeout < 0) return -1;
+            break;
+        case OPT_WRITE_TIMEOUT:
+            g_config.write_timeout = atoi(optarg);
+            if (g_config.write_timeout < 0) return -1;
+            break;
+        case OPT_LOG_RING:
+            g_config.log.ring_slots = (size_t)atol(optarg);
+            if (g_config.log.ring_slots == 0) return -1;
+            break;
+        case OPT_LOG_FULL:
+            if (strcmp(optarg, "block") == 0) g_config.log.full = LOG_FULL_BLOCK;
+            else if (strcmp(optarg, "drop") == 0) g_config.log.full = LOG_FULL_DROP;
+            else return -1;
+            break;
+        case OPT_LOG_FORMAT:
+            if (strcmp(optarg, "text") == 0) g_config.log.format = LOG_FORMAT_TEXT;
+            else if (strcmp(optarg, "binary") == 0) g_config.log.format = LOG_FORMAT_BINARY;
+            else return -1;
+            break;
+        case OPT_LOG_PAYLOAD:
+            if (atol(optarg) < 0) return -1;
+            g_config.log.payload_max = (size_t)atol(optarg);
+            break;
+        case OPT_LOG_SEGMENT:
+            g_config.log.segment_bytes = (size_t)atol(optarg) << 20;
+            if (g_config.log.segment_bytes == 0) return -1;
+            break;
+        case OPT_LOG_LEVEL: {
+            int level = log_level_from_name(optarg);
+            if (level < 0) return -1;
+            log_set_level(level);
+            break;
+        }
+        case OPT_DB_READERS:
+            g_config.db.readers = atoi(optarg);
+            if (g_config.db.readers < 0) return -1;
+            break;
+        case OPT_DB_BUSY_TIMEOUT:
+            g_config.db.busy_timeout_ms = atoi(optarg);
+            if (g_config.db.busy_timeout_ms < 0) return -1;
+            break;
+        case OPT_DB_BATCH_MS:
+            g_config.db.batch_ms = atoi(optarg);
+            if (g_config.db.batch_ms < 0) return -1;
+            break;
+        case OPT_DB_BATCH_OPS:
+            g_config.db.batch_ops = atoi(optarg);
+            if (g_config.db.batch_ops <= 0) return -1;
+            break;
+        case OPT_DB_SYNC:
+            if (strcmp(optarg, "full") == 0) g_config.db.sync = DB_SYNC_FULL;
+            else if (strcmp(optarg, "normal") == 0) g_config.db.sync = DB_SYNC_NORMAL;
+            else return -1;
+            break;
+        case OPT_ACCOUNT_CACHE:
+            if (atol(optarg) < 0) return -1;
+            g_config.account_cache = (size_t)atol(optarg);
+            break;
+        case OPT_REPLY_CACHE:
+            if (atol(optarg) < 0) return -1;
+            g_config.reply_cache_kb = (size_t)atol(optarg);
+            break;
+        case OPT_NOTIFY_WINDOW:
+            g_config.notify_window_ms = atoi(optarg);
+            if (g_config.notify_window_ms < 0) return -1;
+            break;
+        case 'S':
+            g_config.stats_interval = atoi(optarg);
+            if (g_config.stats_interval < 0) return -1;
+            break;
+        default:
+            return -1;
         }
-        message[0] = '\0';
     }
+    // Shedding starts at the soft limits, so they cannot exceed the hard ones
+    if (g_config.admission.soft_sessions > g_config.admission.hard_sessions ||
+        g_config.admission.soft_bytes > g_config.admission.hard_bytes) {
+        fprintf(stderr, "Soft session and memory limits must not exceed the hard limits.\n");
+        return -1;
+    }
+    return optind;
+}
+
+/**
+ * @function acceptor_thread: Accept loop for one listening shard in thread mode; every
+ * connection gets its own handle_client thread.
+ *
+ * @param arg: Pointer to the listener_shard_t to serve.
+ *
+ * @return NULL
+ */
+static void *acceptor_thread(void *arg) {
+    listener_shard_t *shard = (listener_shard_t *)arg;
+
+    while(1){                
+        if (admission_should_pause()) {
+            admission_note_pause();
+            while (admission_should_pause()) usleep(PAUSE_RECHECK_US);
+        }
+
+        struct sockaddr_in clientAddr;
+        int connfd = listener_accept(shard, &clientAddr);
+        if (connfd == -1) {
+            if (errno == EINTR) 
+                continue;
+            // EMFILE/ENOBUFS during a storm: back off briefly instead of exiting.
+            perror("accept");
+            usleep(10000);
+            continue;
+        }
+        if (!admission_gate(connfd)) continue;
+
+        client_session_t *session = session_create(connfd, &clientAddr, g_config.max_line);
+        if (!session) {
+            perror("malloc");
+            close(connfd);
+            continue;
+        }
 
-    free(message);
-    close(session->sockfd);
-    free(session);
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, handle_client, (void *)session) != 0) {
+            perror("pthread_create");
+            session_release(session);
+            continue;
+        }
+    }
     return NULL;
 }
 
-
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <Port_Number>\n", argv[0]);
+    int argi = parse_args(argc, argv);
+    if (argi < 0 || argc - argi != 1) {
+        print_usage(argv[0]);
         return 1;
     }
 
-    char *port = argv[1];
+    char *port = argv[argi];
+
+    if (activity_log_start(LOG_BASENAME, &g_config.log) != 0) {
+        fprintf(stderr, "Failed to start activity log.\n");
+        return 1;
+    }
 
+    db_configure(&g_config.db);
     if (init_data_store(NULL) != 0) {
         fprintf(stderr, "Failed to initialize data store.\n");
         return 1;
     }
 
-    int listenfd, connfd;
-    struct sockaddr_in serverAddr, clientAddr;
+    if (account_cache_init(g_config.account_cache) != 0) {
+        fprintf(stderr, "Failed to allocate account cache.\n");
+        shutdown_data_store();
+        return 1;
+    }
 
-    if((listenfd = socket(AF_INET, SOCK_STREAM, 0)) == -1){
-        perror("Error: ");
+    if (reply_cache_init(g_config.reply_cache_kb << 10) != 0) {
+        fprintf(stderr, "Failed to allocate reply cache.\n");
         shutdown_data_store();
-        return 0;
+        return 1;
     }
 
-    memset(&serverAddr, 0, sizeof(serverAddr));
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serverAddr.sin_port = htons(atoi(port));
+    if (presence_init(g_config.admission.hard_sessions) != 0) {
+        fprintf(stderr, "Failed to allocate online registry.\n");
+        shutdown_data_store();
+        return 1;
+    }
 
-    if(bind(listenfd, (struct sockaddr *) &serverAddr,sizeof(serverAddr) ) == -1){
-        perror("Error: ");
+    if (notifier_start(g_config.notify_window_ms) != 0) {
+        fprintf(stderr, "Failed to start notifier.\n");
         shutdown_data_store();
-        return 0;
+        return 1;
     }
 
-    if(listen(listenfd, BACKLOG) == -1){
-        perror("listen() error.");
+    if (watch_start() != 0) {
+        fprintf(stderr, "Failed to start watch timer.\n");
         shutdown_data_store();
-        return 0;
+        return 1;
     }
-    printf("Server started at port %s\n", port);
-   
-    while(1){                
-        connfd = (int *)malloc(sizeof(int));
-        if (!connfd) {
-            perror("malloc");
-            continue;
-        }
-        socklen_t clientAddrLen = sizeof(clientAddr);
 
-        if((connfd = accept(listenfd, (struct sockaddr *) &clientAddr, &clientAddrLen)) == -1){
-            if (errno == EINTR) 
-                continue;
-            else {
-                perror("accept");
-                exit(EXIT_FAILURE);
-            }
-        } else {
-            int flag = 1;
-            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
-            char client_ip[INET_ADDRSTRLEN];
-            if(inet_ntop(AF_INET, &(clientAddr.sin_addr), client_ip, INET_ADDRSTRLEN) == NULL) {
-                perror("inet_ntop() error");
-            }
-            else{
-                int client_port = ntohs(clientAddr.sin_port);
-                printf("Client got a connection from %s:%d\n", client_ip, client_port);
-            }
+    if (listener_open(port, g_config.shards, g_config.backlog, g_config.io_mode == IO_MODE_EPOLL) != 0) {
+        shutdown_data_store();
+        return 1;
+    }
 
-            client_session_t *session = malloc(sizeof(client_session_t));
-            if (!session) {
-                perror("malloc");
-                close(connfd);
-                continue;
-            }
-            session->sockfd = connfd;
-            session->logged_in = 0;
-            memcpy(&session->client_addr, &clientAddr, sizeof(clientAddr));
-            session->username[0] = '\0';
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR2, on_sigusr2);
+    metrics_register("framer", framer_dump_metrics);
+    metrics_register("io", io_dump_metrics);
+    metrics_register("listener", listener_dump_metrics);
+    metrics_register("admission", admission_dump_metrics);
+    metrics_register("reaper", reaper_dump_metrics);
+    metrics_register("log", activity_log_dump_metrics);
+    metrics_register("db", db_dump_metrics);
+    metrics_register("accounts", account_cache_dump_metrics);
+    metrics_register("replies", reply_cache_dump_metrics);
+    metrics_register("friends", friend_graph_dump_metrics);
+    metrics_register("presence", presence_dump_metrics);
+    metrics_register("notifier", notifier_dump_metrics);
+    metrics_register("watch", watch_dump_metrics);
+    admission_configure(&g_config.admission);
+    reaper_configure(g_config.idle_timeout, g_config.login_timeout, g_config.write_timeout);
+    metrics_start(g_config.stats_interval);
 
+    if (worker_pool_start(g_config.workers, g_config.queue_depth, g_config.overflow) != 0) {
+        fprintf(stderr, "Failed to start worker pool.\n");
+        shutdown_data_store();
+        return 1;
+    }
+
+    if (g_config.io_mode == IO_MODE_EPOLL) {
+        // Each shard needs a loop of its own to accept on.
+        if (g_config.io_loops < g_config.shards) g_config.io_loops = g_config.shards;
+        if (event_loop_start(g_config.io_loops) != 0) {
+            fprintf(stderr, "Failed to start event loops.\n");
+            shutdown_data_store();
+            return 1;
+        }
+    } else {
+        reaper_init(&g_thread_reaper, evict_thread_session, NULL);
+        if (g_config.idle_timeout || g_config.login_timeout || g_config.write_timeout) {
+            if (reaper_start_thread(&g_thread_reaper) != 0) {
+                fprintf(stderr, "Failed to start reaper.\n");
+                shutdown_data_store();
+                return 1;
+            }
+        }
+        for (int i = 1; i < listener_count(); ++i) {
             pthread_t tid;
-            if (pthread_create(&tid, NULL, handle_client, (void *)session) != 0) {
+            if (pthread_create(&tid, NULL, acceptor_thread, listener_get(i)) != 0) {
                 perror("pthread_create");
-                close(connfd);
-                free(session);
-                continue;
+                shutdown_data_store();
+                return 1;
             }
+            pthread_detach(tid);
         }
+    }
+    LOG_INFO("Server started at port %s (%s mode, %d shard(s), backlog %d)", port,
+           g_config.io_mode == IO_MODE_EPOLL ? "epoll" : "thread",
+           listener_count(), g_config.backlog);
 
+    if (g_config.io_mode == IO_MODE_EPOLL) {
+        while (1) pause();
     }
-    close(listenfd);
+    acceptor_thread(listener_get(0));
+
+    listener_close_all();
     shutdown_data_store();
     return 0;
 
@@ -0,0 +1,69 @@
+#ifndef TCP_SERVER_SERVER_CONFIG_H
+#define TCP_SERVER_SERVER_CONFIG_H
+
+#include <stddef.h>
+#include "worker_pool.h"
+#include "admission.h"
+#include "activity_log.h"
+#include "database.h"
+#include "notifier.h"
+#include "reply_cache.h"
+
+/**
+ * @typedef io_mode_t: How client sockets are serviced.
+ *  - IO_MODE_EPOLL: non-blocking sockets multiplexed on a few event loop threads
+ *  - IO_MODE_THREAD: legacy blocking thread-per-connection model
+ */
+typedef enum io_mode {
+    IO_MODE_EPOLL = 0,
+    IO_MODE_THREAD
+} io_mode_t;
+
+/**
+ * @typedef server_config_t: Runtime options parsed from the command line.
+ * Fields:
+ *  - io_mode: socket servicing model
+ *  - io_loops: number of event loop threads (epoll mode only)
+ *  - workers: command worker threads (0 dispatches inline on the I/O thread)
+ *  - queue_depth: maximum queued command lines waiting for a worker
+ *  - overflow: what to do with a command when the queue is full
+ *  - max_line: longest accepted command line in bytes
+ *  - stats_interval: seconds between counter reports (0 = only on SIGUSR1)
+ *  - coalesce: 1 to hold replies until the end of a command batch
+ *  - flush_threshold: buffered reply bytes that force an early flush
+ *  - shards: number of SO_REUSEPORT listening sockets / acceptors
+ *  - backlog: listen() backlog of each shard
+ *  - admission: soft/hard load limits for new connections
+ *  - idle_timeout/login_timeout/write_timeout: reaper deadlines in seconds (0 = off)
+ *  - log: activity log ring, full ring policy and output format
+ *  - db: SQLite reader pool, busy timeout, group commit and durability
+ *  - account_cache: accounts kept in memory for LOGIN and user checks (0 = off)
+ *  - reply_cache_kb: memory for cached LIST_FAVORITES/FRIENDS/TAGGED replies (0 = off)
+ *  - notify_window_ms: how long notifications to one user are held to merge bursts
+ */
+typedef struct server_config {
+    io_mode_t io_mode;
+    int io_loops;
+    int workers;
+    int queue_depth;
+    pool_overflow_t overflow;
+    size_t max_line;
+    int stats_interval;
+    int coalesce;
+    size_t flush_threshold;
+    int shards;
+    int backlog;
+    admission_limits_t admission;
+    int idle_timeout;
+    int login_timeout;
+    int write_timeout;
+    log_config_t log;
+    db_pool_config_t db;
+    size_t account_cache;
+    size_t reply_cache_kb;
+    int notify_window_ms;
+} server_config_t;
+
+extern server_config_t g_config;
+
+#endif
@@ -0,0 +1,357 @@
+#define LOG_TAG "session"
+
+#include "session.h"
+#include "line_framer.h"
+#include "out_buffer.h"
+#include "server_config.h"
+#include "admission.h"
+#include "activity_log.h"
+#include "reaper.h"
+#include "presence.h"
+#include "watch.h"
+#include "log.h"
+#include "ultilities.h"
+#include "worker_pool.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static unsigned int g_next_session_id = 0;
+
+static void format_peer(client_session_t *session) {
+    char ip[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &session->client_addr.sin_addr, ip, sizeof(ip))) {
+        snprintf(session->peer, sizeof(session->peer), "%s:%d", ip, ntohs(session->client_addr.sin_port));
+    } else {
+        snprintf(session->peer, sizeof(session->peer), "UNKNOWN");
+    }
+}
+
+/**
+ * @function session_create: Allocate and initialize a session for an accepted socket.
+ * The caller owns the initial reference.
+ *
+ * @param sockfd: Connected socket descriptor.
+ * @param addr: Peer address returned by accept().
+ * @param max_line: Longest command line accepted from this client.
+ *
+ * @return Pointer to the new session, or NULL on allocation failure.
+ */
+client_session_t *session_create(int sockfd, const struct sockaddr_in *addr, size_t max_line) {
+    client_session_t *session = calloc(1, sizeof(client_session_t));
+    if (!session) return NULL;
+
+    session->framer = malloc(sizeof(line_framer_t));
+    session->out = malloc(sizeof(out_buffer_t));
+    if (!session->framer || !session->out || framer_init(session->framer, max_line) != 0) {
+        free(session->framer);
+        free(session->out);
+        free(session);
+        return NULL;
+    }
+    outbuf_init(session->out);
+    session->sockfd = sockfd;
+    session->logged_in = 0;
+    session->user_id = 0;
+    session->username[0] = '\0';
+    session->refcount = 1;
+    pthread_mutex_init(&session->lock, NULL);
+    pthread_mutex_init(&session->send_lock, NULL);
+    pthread_mutex_init(&session->push_lock, NULL);
+    if (addr) memcpy(&session->client_addr, addr, sizeof(*addr));
+    format_peer(session);
+    session->id = __atomic_add_fetch(&g_next_session_id, 1, __ATOMIC_RELAXED);
+    activity_log_meta(session->id, BINLOG_OPEN, session->peer);
+    session->mem_bytes = sizeof(client_session_t) + sizeof(line_framer_t) + sizeof(out_buffer_t) +
+                         session->framer->cap + 1 + session->framer->max_line + 1;
+    admission_session_opened(session->mem_bytes);
+    return session;
+}
+
+/**
+ * @function session_retain: Take an extra reference on the session.
+ *
+ * @param session: Session to retain.
+ */
+void session_retain(client_session_t *session) {
+    __atomic_add_fetch(&session->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @function session_try_retain: Take an extra reference unless the last one is already
+ * gone (the session is being freed).
+ *
+ * @param session: Session to retain.
+ *
+ * @return 1 if a reference was taken, 0 otherwise.
+ */
+int session_try_retain(client_session_t *session) {
+    int refs = __atomic_load_n(&session->refcount, __ATOMIC_RELAXED);
+    while (refs > 0) {
+        if (__atomic_compare_exchange_n(&session->refcount, &refs, refs + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @function session_release: Drop a reference. The socket is closed and the memory
+ * freed with the last reference, so a worker still replying never writes to a
+ * descriptor number that was reused by a newer connection.
+ *
+ * @param session: Session to release (may be NULL).
+ */
+void session_release(client_session_t *session) {
+    if (!session) return;
+    if (__atomic_sub_fetch(&session->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    if (session->sockfd >= 0) close(session->sockfd);
+    watch_cancel(session);
+    // Whatever ended the connection (quit, error, reaper), the account is no longer online.
+    presence_release(session);
+    admission_session_closed(session->mem_bytes);
+    pthread_mutex_destroy(&session->lock);
+    pthread_mutex_destroy(&session->send_lock);
+    pthread_mutex_destroy(&session->push_lock);
+    free(session->push_buf);
+    outbuf_free(session->out);
+    free(session->out);
+    framer_free(session->framer);
+    free(session->framer);
+    free(session);
+}
+
+/**
+ * @function session_close: Mark the connection as finished and shut the socket down
+ * so pending replies fail fast. Memory is reclaimed by session_release().
+ *
+ * @param session: Session to close.
+ */
+void session_close(client_session_t *session) {
+    pthread_mutex_lock(&session->lock);
+    int was_closed = session->closed;
+    session->closed = 1;
+    pthread_mutex_unlock(&session->lock);
+    if (!was_closed) shutdown(session->sockfd, SHUT_RDWR);
+}
+
+static void on_line(void *ctx, char *line, size_t len) {
+    client_session_t *session = (client_session_t *)ctx;
+    LOG_TRACE("Handle command: '%s'", line);
+    io_count_command();
+    worker_pool_dispatch(session, line, len);
+}
+
+/**
+ * @function session_read_lines: Receive once straight into the session ring buffer
+ * and dispatch every line it completes.
+ *
+ * @param session: Session whose socket is readable.
+ *
+ * @return Bytes received, 0 when the peer closed, -1 on error (errno set; EAGAIN
+ * means a non-blocking socket is drained).
+ */
+int session_read_lines(client_session_t *session) {
+    size_t size = 0;
+    char *dst = framer_write_ptr(session->framer, &size);
+    int len = recv_response(session->sockfd, dst, size);
+    if (len <= 0) return len;
+
+    reaper_touch(session);
+    writeLog(session, dst, BINLOG_IN);
+    framer_commit(session->framer, (size_t)len);
+    // Inline dispatch: replies to every line of this read leave in one flush.
+    int inline_batch = !worker_pool_enabled();
+    if (inline_batch) session_begin_batch(session);
+    int rejected = framer_drain(session->framer, on_line, session);
+    while (rejected-- > 0) worker_pool_reply(session, "400 Line too long\r\n");
+    if (inline_batch) session_end_batch(session);
+    return len;
+}
+
+// Move queued pushes behind the replies already in out. Caller holds session->send_lock.
+static void take_pushes_locked(client_session_t *session) {
+    pthread_mutex_lock(&session->push_lock);
+    if (session->push_len > 0 && outbuf_append(session->out, session->push_buf, session->push_len) == 0) {
+        session->push_len = 0;
+    }
+    __atomic_store_n(&session->push_pending, session->push_len > 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&session->push_lock);
+}
+
+// Caller holds session->send_lock. nowait: never block, even on a blocking socket.
+static int write_out_locked(client_session_t *session, int nowait) {
+    take_pushes_locked(session);
+    size_t before = session->out->pending;
+    int rc = nowait ? outbuf_flush_nowait(session->out, session->sockfd)
+                    : outbuf_flush(session->out, session->sockfd);
+    if (rc < 0) {
+        // The peer is gone; the read side will notice and tear the session down.
+        outbuf_free(session->out);
+        reaper_write_done(session);
+        return -1;
+    }
+    if (rc == 1) reaper_write_pending(session, session->out->pending < before);
+    else reaper_write_done(session);
+    return 0;
+}
+
+static int flush_locked(client_session_t *session) {
+    return write_out_locked(session, 0);
+}
+
+/*
+ * Deliver pushes queued while another thread held send_lock. Pushers only ever
+ * trylock, so they never wait behind a blocked writer; whoever releases send_lock
+ * afterwards sees push_pending and picks the lines up.
+ */
+static void deliver_pushes(client_session_t *session) {
+    while (__atomic_load_n(&session->push_pending, __ATOMIC_SEQ_CST) &&
+           pthread_mutex_trylock(&session->send_lock) == 0) {
+        // An open batch takes them along when it ends
+        int batched = session->batch_depth > 0;
+        if (!batched) write_out_locked(session, 1);
+        pthread_mutex_unlock(&session->send_lock);
+        if (batched) break;
+    }
+}
+
+static void send_unlock(client_session_t *session) {
+    pthread_mutex_unlock(&session->send_lock);
+    deliver_pushes(session);
+}
+
+// Caller holds session->send_lock.
+static int has_output_locked(client_session_t *session) {
+    return session->out->pending > 0 || __atomic_load_n(&session->push_pending, __ATOMIC_SEQ_CST);
+}
+
+// Caller holds session->send_lock.
+static int should_flush_locked(client_session_t *session) {
+    return session->batch_depth == 0 || !g_config.coalesce ||
+           session->out->pending >= g_config.flush_threshold;
+}
+
+/**
+ * @function session_send: Queue reply bytes on the session. They are written right
+ * away unless a batch is open, in which case they wait for session_end_batch() or
+ * until the buffered amount reaches the flush threshold. Inside a no-wait region the
+ * write never blocks: what the socket does not take waits for session_end_nowait().
+ *
+ * @param session: Target session.
+ * @param buf: Bytes to send.
+ * @param len: Number of bytes.
+ *
+ * @return 0 on success, -1 on allocation or write failure.
+ */
+int session_send(client_session_t *session, const char *buf, size_t len) {
+    pthread_mutex_lock(&session->send_lock);
+    int rc = outbuf_append(session->out, buf, len);
+    if (rc == 0 && should_flush_locked(session)) {
+        rc = write_out_locked(session, session->nowait_depth > 0);
+    }
+    send_unlock(session);
+    return rc;
+}
+
+/**
+ * @function session_push: Queue unsolicited lines (NOTIFY) for a session without
+ * ever blocking the caller: the bytes are written with a non-blocking send, or left
+ * for whichever thread holds the session's output to pick up.
+ *
+ * @param session: Target session.
+ * @param buf: Whole lines to send.
+ * @param len: Number of bytes.
+ *
+ * @return 0 if queued, -1 if the client is not keeping up with its output (or on
+ * allocation failure); the lines are dropped then.
+ */
+int session_push(client_session_t *session, const char *buf, size_t len) {
+    pthread_mutex_lock(&session->push_lock);
+    size_t need = session->push_len + len;
+    if (need > g_config.flush_threshold ||
+        __atomic_load_n(&session->out->pending, __ATOMIC_RELAXED) >= g_config.flush_threshold) {
+        pthread_mutex_unlock(&session->push_lock);
+        return -1;
+    }
+    if (need > session->push_cap) {
+        char *grown = realloc(session->push_buf, need);
+        if (!grown) {
+            pthread_mutex_unlock(&session->push_lock);
+            return -1;
+        }
+        session->push_buf = grown;
+        session->push_cap = need;
+    }
+    memcpy(session->push_buf + session->push_len, buf, len);
+    session->push_len = need;
+    __atomic_store_n(&session->push_pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&session->push_lock);
+
+    deliver_pushes(session);
+    return 0;
+}
+
+/**
+ * @function session_flush: Push out whatever is pending, e.g. when the event loop
+ * reports the socket writable again after a partial write.
+ *
+ * @return 0 on success (data may remain if the socket is still full), -1 on error.
+ */
+int session_flush(client_session_t *session) {
+    pthread_mutex_lock(&session->send_lock);
+    int rc = has_output_locked(session) ? flush_locked(session) : 0;
+    send_unlock(session);
+    return rc;
+}
+
+void session_begin_batch(client_session_t *session) {
+    pthread_mutex_lock(&session->send_lock);
+    session->batch_depth++;
+    send_unlock(session);
+}
+
+int session_end_batch(client_session_t *session) {
+    pthread_mutex_lock(&session->send_lock);
+    int rc = 0;
+    if (--session->batch_depth == 0 && has_output_locked(session)) {
+        rc = flush_locked(session);
+    }
+    send_unlock(session);
+    return rc;
+}
+
+/**
+ * @function session_begin_nowait: Open a region where replies are written only as far
+ * as the socket takes them without blocking. Used while a database connection is
+ * held, so a slow reader cannot stall the connection; output keeps draining, so the
+ * buffer only grows while the socket is full.
+ *
+ * @param session: Target session.
+ */
+void session_begin_nowait(client_session_t *session) {
+    pthread_mutex_lock(&session->send_lock);
+    session->nowait_depth++;
+    send_unlock(session);
+}
+
+/**
+ * @function session_end_nowait: Close a no-wait region and write what the socket did
+ * not take, blocking again if need be (unless a batch still holds it).
+ *
+ * @return 0 on success, -1 on write failure.
+ */
+int session_end_nowait(client_session_t *session) {
+    pthread_mutex_lock(&session->send_lock);
+    int rc = 0;
+    if (--session->nowait_depth == 0 && has_output_locked(session) && should_flush_locked(session)) {
+        rc = flush_locked(session);
+    }
+    send_unlock(session);
+    return rc;
+}
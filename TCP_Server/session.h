@@ -0,0 +1,26 @@
+#ifndef TCP_SERVER_SESSION_H
+#define TCP_SERVER_SESSION_H
+
+#include <stddef.h>
+#include "../entity/entities.h"
+
+// SESSION LIFECYCLE FUNCTIONS
+client_session_t *session_create(int sockfd, const struct sockaddr_in *addr, size_t max_line);
+void session_retain(client_session_t *session);
+int session_try_retain(client_session_t *session);
+void session_release(client_session_t *session);
+void session_close(client_session_t *session);
+
+// SESSION INPUT FUNCTIONS
+int session_read_lines(client_session_t *session);
+
+// SESSION OUTPUT FUNCTIONS
+int session_send(client_session_t *session, const char *buf, size_t len);
+int session_push(client_session_t *session, const char *buf, size_t len);
+int session_flush(client_session_t *session);
+void session_begin_batch(client_session_t *session);
+int session_end_batch(client_session_t *session);
+void session_begin_nowait(client_session_t *session);
+int session_end_nowait(client_session_t *session);
+
+#endif
@@ -0,0 +1,114 @@
+#include "timer_wheel.h"
+
+static void list_init(timer_node_t *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_add_tail(timer_node_t *head, timer_node_t *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void list_unlink(timer_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = NULL;
+    node->prev = NULL;
+}
+
+void tw_init(timer_wheel_t *tw, uint64_t now) {
+    tw->now = now;
+    tw->count = 0;
+    for (int l = 0; l < TW_LEVELS; ++l) {
+        for (int s = 0; s < TW_SLOTS; ++s) list_init(&tw->slots[l][s]);
+    }
+}
+
+// File a node in the level whose span covers its distance from now.
+static void place(timer_wheel_t *tw, timer_node_t *node) {
+    uint64_t delta = node->expires - tw->now;
+    for (int l = 0; l < TW_LEVELS; ++l) {
+        if (delta < ((uint64_t)1 << (TW_BITS * (l + 1))) || l == TW_LEVELS - 1) {
+            int slot = (int)((node->expires >> (TW_BITS * l)) & (TW_SLOTS - 1));
+            list_add_tail(&tw->slots[l][slot], node);
+            return;
+        }
+    }
+}
+
+/**
+ * @function tw_schedule: Arm (or re-arm) a timer. Deadlines in the past fire on the
+ * next tick; deadlines beyond the wheel span are clamped to its last tick and
+ * simply fire early, so callers re-check the real deadline when a timer fires.
+ *
+ * @param tw: Wheel.
+ * @param node: Timer to arm.
+ * @param expires: Absolute expiry tick.
+ */
+void tw_schedule(timer_wheel_t *tw, timer_node_t *node, uint64_t expires) {
+    uint64_t max_delta = ((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1;
+    if (tw_armed(node)) tw_cancel(tw, node);
+    if (expires <= tw->now) expires = tw->now + 1;
+    if (expires - tw->now > max_delta) expires = tw->now + max_delta;
+    node->expires = expires;
+    place(tw, node);
+    tw->count++;
+}
+
+void tw_cancel(timer_wheel_t *tw, timer_node_t *node) {
+    if (!tw_armed(node)) return;
+    list_unlink(node);
+    tw->count--;
+}
+
+// Move every node of one upper-level slot down to where it now belongs.
+static void cascade(timer_wheel_t *tw, int level, int slot) {
+    timer_node_t *head = &tw->slots[level][slot];
+    while (head->next != head) {
+        timer_node_t *node = head->next;
+        list_unlink(node);
+        place(tw, node);
+    }
+}
+
+/**
+ * @function tw_advance: Move the wheel forward to tick now, calling fire for every
+ * timer that expires on the way. The node is disarmed before fire runs, so the
+ * callback may re-schedule it.
+ *
+ * @param tw: Wheel.
+ * @param now: Current tick.
+ * @param fire: Expiry callback.
+ * @param ctx: Passed through to fire.
+ */
+void tw_advance(timer_wheel_t *tw, uint64_t now, timer_fire_fn fire, void *ctx) {
+    while (tw->now < now) {
+        tw->now++;
+        if (tw->count == 0) {
+            // Nothing armed: jump straight to the target tick.
+            tw->now = now;
+            break;
+        }
+
+        uint64_t t = tw->now;
+        if ((t & (TW_SLOTS - 1)) == 0) {
+            // Cascade from the highest level whose index rolled over downwards.
+            int top = 1;
+            while (top < TW_LEVELS - 1 && ((t >> (TW_BITS * top)) & (TW_SLOTS - 1)) == 0) top++;
+            for (int l = top; l >= 1; --l) {
+                cascade(tw, l, (int)((t >> (TW_BITS * l)) & (TW_SLOTS - 1)));
+            }
+        }
+
+        timer_node_t *head = &tw->slots[0][t & (TW_SLOTS - 1)];
+        while (head->next != head) {
+            timer_node_t *node = head->next;
+            list_unlink(node);
+            tw->count--;
+            fire(node, ctx);
+        }
+    }
+}
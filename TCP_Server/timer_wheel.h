@@ -0,0 +1,48 @@
+#ifndef TCP_SERVER_TIMER_WHEEL_H
+#define TCP_SERVER_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_LEVELS 4
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+
+/**
+ * @typedef timer_node_t: Intrusive timer, embedded in the object it times out.
+ * Fields:
+ *  - next/prev: slot list links (next is NULL while the timer is not armed)
+ *  - expires: absolute expiry tick
+ *  - kind: caller-defined tag telling the fire callback what the timer is for
+ */
+typedef struct timer_node {
+    struct timer_node *next;
+    struct timer_node *prev;
+    uint64_t expires;
+    int kind;
+} timer_node_t;
+
+/**
+ * @typedef timer_wheel_t: Hierarchical timing wheel (TW_LEVELS levels of TW_SLOTS
+ * slots). Schedule and cancel are O(1); a node is re-filed at most once per level on
+ * its way down. Not thread-safe: the owner serializes access.
+ */
+typedef struct timer_wheel {
+    uint64_t now;
+    size_t count;
+    timer_node_t slots[TW_LEVELS][TW_SLOTS];
+} timer_wheel_t;
+
+typedef void (*timer_fire_fn)(timer_node_t *node, void *ctx);
+
+// TIMER WHEEL FUNCTIONS
+void tw_init(timer_wheel_t *tw, uint64_t now);
+void tw_schedule(timer_wheel_t *tw, timer_node_t *node, uint64_t expires);
+void tw_cancel(timer_wheel_t *tw, timer_node_t *node);
+void tw_advance(timer_wheel_t *tw, uint64_t now, timer_fire_fn fire, void *ctx);
+
+static inline int tw_armed(const timer_node_t *node) {
+    return node->next != NULL;
+}
+
+#endif
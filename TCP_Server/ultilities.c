@@ -1,5 +1,9 @@
 #include "ultilities.h"
 #include "database.h"
+#include "account_cache.h"
+#include "session.h"
+#include "out_buffer.h"
+#include "activity_log.h"
 
 #include <errno.h>
 #include <pthread.h>
@@ -10,50 +14,17 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
-
 extern pthread_mutex_t account_lock;
 /**
- * @function writeLog: Write request and response information into log file.
+ * @function writeLog: Queue request and response information for the log file. The
+ * line is written by the activity log thread; callers never touch the file.
  *
- * @param client_addr: Client IP:Port address
- * @param request: Request received from client
- * @param result: Result of processing
+ * @param session: Client session (peer address, session id, current command)
+ * @param buff: Data sent or received
+ * @param dir: BINLOG_OUT for replies ("REQUEST"), BINLOG_IN for received data ("RESPONSE")
  */
-void writeLog(int sockfd, const char *buff, const char *type) {
-    char filename[64];
-    snprintf(filename, sizeof(filename), "log_%s.txt", MSSV);
-
-    FILE *f = fopen(filename, "a");
-    if (!f) {
-        perror("Cannot open log file");
-        return;
-    }
-	char ip[INET_ADDRSTRLEN];
-	struct sockaddr_in addr;
-	socklen_t addr_len = sizeof(addr);
-	char client_addr[32] = "UNKNOWN";
-
-	if (getpeername(sockfd, (struct sockaddr*)&addr, &addr_len) == 0) {
-		inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
-		int port = ntohs(addr.sin_port);
-		snprintf(client_addr, sizeof(client_addr), "%s:%d", ip, port);
-	}
-
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-
-    fprintf(f, "[%02d/%02d/%04d %02d:%02d:%02d]$%s$%s$%s\n",
-            t->tm_mday,
-            t->tm_mon + 1,
-            t->tm_year + 1900,
-            t->tm_hour,
-            t->tm_min,
-            t->tm_sec,
-            client_addr ? client_addr : "",
-            type ? type : "",
-            buff ? buff : "");
-
-    fclose(f);
+void writeLog(const client_session_t *session, const char *buff, binlog_dir_t dir) {
+    activity_log_write(session->id, session->peer, dir, session->cur_opcode, buff);
 }
 
 
@@ -69,36 +40,40 @@ void shutdown_data_store(void) {
 }
 
 // NETWORK COMMUNICATION FUNCTIONS
-int send_request(int sockfd, const char *buf) {
-	if (!buf) {
-		errno = EINVAL;
-		return -1;
-	}
-	ssize_t s = send(sockfd, buf, strlen(buf), 0);
-	if (s == -1) {
-		perror("send() error");
-		return -1;
-	}
-	writeLog(sockfd, buf, "REQUEST");
-	//usleep(2000);
-	return (int)s;
-}
-
 int recv_response(int sockfd, char *buff, size_t size) {
 	if (!buff || size == 0) {
 		errno = EINVAL;
 		return -1;
 	}
 	ssize_t r = recv(sockfd, buff, size - 1, 0);
+	io_count_read();
 	if (r <= 0) {
-		if (r < 0) perror("recv() error");
+		if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) perror("recv() error");
 		return (int)r;
 	}
 	buff[r] = '\0';
-	writeLog(sockfd, buff, "RESPONSE");
 	return (int)r;
 }
 
+/**
+ * @function send_reply: Queue a reply on the client session. Replies produced while a
+ * batch of pipelined commands is dispatched are coalesced into one writev().
+ *
+ * @param session: Target session.
+ * @param buf: NUL-terminated reply.
+ *
+ * @return Number of bytes queued, or -1 on error.
+ */
+int send_reply(client_session_t *session, const char *buf) {
+	if (!session || !buf) {
+		errno = EINVAL;
+		return -1;
+	}
+	size_t len = strlen(buf);
+	if (session_send(session, buf, len) != 0) return -1;
+	writeLog(session, buf, BINLOG_OUT);
+	return (int)len;
+}
 
 // ACCOUNT MANAGEMENT FUNCTIONS
 int get_accounts(Account accounts_buffer[], int max_users, int *out_count) {
@@ -108,13 +83,34 @@ int get_accounts(Account accounts_buffer[], int max_users, int *out_count) {
 
 int get_account(const char *username, Account *out_account) {
 	if (!username || !out_account) return -1;
-	return db_fetch_account(username, out_account);
+	return account_cache_get(username, out_account);
 }
 
 int create_account(const char *username, const char *password) {
 	if (!username || !password) return -1;
 
-	return db_create_account(username, password);
+	Account acc;
+	memset(&acc, 0, sizeof(acc));
+	int rc = db_create_account(username, password, &acc.id);
+	if (rc == 0) {
+		strncpy(acc.username, username, sizeof(acc.username) - 1);
+		strncpy(acc.password, password, sizeof(acc.password) - 1);
+		account_cache_put(&acc);
+	}
+	return rc;
+}
+
+/**
+ * @function get_user_id: Translate a username received from a client to its account id.
+ *
+ * @param username: Name from the request.
+ * @param out_id: Filled on success.
+ *
+ * @return 0 if found, -2 if there is no such user, -1 on error.
+ */
+int get_user_id(const char *username, uint32_t *out_id) {
+	if (!username || !out_id) return -1;
+	return db_user_id(username, out_id);
 }
 
 
@@ -122,116 +118,107 @@ int create_account(const char *username, const char *password) {
 
 
 // FAVORITE MANAGEMENT FUNCTIONS
-int get_user_favorites(const char *username, FavoritePlace favs[], int max, int *out_count) {
-	if (!username || !out_count || max <= 0) return -1;
-	if (!favs) {
-		*out_count = 0;
-		return 0;
-	}
-	return db_fetch_user_favorites(username, favs, max, out_count);
+int scan_user_favorites(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+	if (!user_id || !sink) return -1;
+	return db_scan_user_favorites(user_id, page, sink);
 }
 
-int create_favorite(const char *owner, const char *name, const char *category, const char *location) {
-	if (!owner || !name || !category || !location) return -1;
-	return db_create_favorite(owner, name, category, location);
+int create_favorite(uint32_t owner_id, const char *name, const char *category, const char *location) {
+	if (!owner_id || !name || !category || !location) return -1;
+	return db_create_favorite(owner_id, name, category, location);
 }
 
-int update_favorite(int fav_id, const char *owner, const char *name, const char *category, const char *location) {
-	if (fav_id <= 0 || !owner || !name || !category || !location) return -1;
-	return db_update_favorite(fav_id, owner, name, category, location);
+int update_favorite(int fav_id, uint32_t owner_id, const char *name, const char *category, const char *location) {
+	if (fav_id <= 0 || !owner_id || !name || !category || !location) return -1;
+	return db_update_favorite(fav_id, owner_id, name, category, location);
 }
 
-int delete_favorite(int fav_id, const char *owner) {
-	if(fav_id <= 0 || !owner) return -1;
-	return db_delete_favorite(fav_id, owner);
+int delete_favorite(int fav_id, uint32_t owner_id) {
+	if(fav_id <= 0 || !owner_id) return -1;
+	return db_delete_favorite(fav_id, owner_id);
 }
 
-int get_favorite_by_id(int fav_id,char *username, FavoritePlace *out_fav) {
-	if (fav_id <= 0 || !out_fav || !username) return -1;
-	return db_fetch_favorite_by_id(fav_id, username,out_fav);
+int get_favorite_by_id(int fav_id, uint32_t owner_id, FavoritePlace *out_fav) {
+	if (fav_id <= 0 || !out_fav || !owner_id) return -1;
+	return db_fetch_favorite_by_id(fav_id, owner_id, out_fav);
 }
 
-int get_tagged_favorites(const char *username, FavoritePlaceWithTags favs[], int max, int *out_count) {
-	if (!username || !out_count || max <= 0) return -1;
-	if (!favs) {
-		*out_count = 0;
-		return 0;
-	}
-	return db_fetch_tagged_favorites(username, favs, max, out_count);
+int scan_tagged_favorites(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+	if (!user_id || !sink) return -1;
+	return db_scan_tagged_favorites(user_id, page, sink);
 }
 
 // FRIEND MANAGEMENT FUNCTIONS
-int get_user_friends(const char *username, FriendRel frs[], int max, int *out_count) {
-	if (!username || !out_count || max <= 0) return -1;
-	if (!frs) {
-		*out_count = 0;
-		return 0;
-	}
-	return db_fetch_user_friends(username, frs, max, out_count);
+int scan_user_friends(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+	if (!user_id || !sink) return -1;
+	return db_scan_user_friends(user_id, page, sink);
 }
 
-int get_user_requests(const char *username, FriendRequest reqs[], int max, int *out_count) {
-	if (!username || !out_count || max <= 0) return -1;
-	if (!reqs) {
-		*out_count = 0;
-		return 0;
-	}
-	return db_fetch_user_requests(username, reqs, max, out_count);
+int scan_user_requests(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+	if (!user_id || !sink) return -1;
+	return db_scan_user_requests(user_id, page, sink);
 }
 
-int create_friend_request(const char *from, const char *to) {
-	if (!from || !to) return -1;
-	return db_create_friend_request(from, to);
+int send_friend_request(uint32_t from_id, const char *to_name, uint32_t *out_to_id) {
+	if (!from_id || !to_name) return -1;
+	return db_send_friend_request(from_id, to_name, out_to_id);
 }
 
-int get_friend_request_by_id(int request_id, char *username, FriendRequest *out_request) {
-	if (!out_request || request_id <= 0 || !username) return -1;
-	return db_fetch_friend_request_by_id(request_id, username, out_request);
-	return 0;
+int get_friend_request_by_id(int request_id, uint32_t user_id, FriendRequest *out_request) {
+	if (!out_request || request_id <= 0 || !user_id) return -1;
+	return db_fetch_friend_request_by_id(request_id, user_id, out_request);
 }
 
-int accept_friend_request(int request_id, const char *requestee) {
-	if (!requestee || request_id <= 0) return -1;
-	return db_accept_friend_request(request_id, requestee);
+int accept_friend_request(int request_id, uint32_t requestee_id) {
+	if (!requestee_id || request_id <= 0) return -1;
+	return db_accept_friend_request(request_id, requestee_id);
 }
 
-int reject_friend_request(int request_id, const char *requestee) {
-	if (!requestee || request_id <= 0) return -1;
-	return db_reject_friend_request(request_id, requestee);
+int reject_friend_request(int request_id, uint32_t requestee_id) {
+	if (!requestee_id || request_id <= 0) return -1;
+	return db_reject_friend_request(request_id, requestee_id);
 }
 
-int remove_friendship(const char *user_a, const char *user_b) {
-	if (!user_a || !user_b) return -1;
-	return db_remove_friendship(user_a, user_b);
+int remove_friendship(uint32_t user_a_id, uint32_t user_b_id) {
+	if (!user_a_id || !user_b_id) return -1;
+	return db_remove_friendship(user_a_id, user_b_id);
 }
 
-int check_friendship(const char *user_a, const char *user_b) {
-	if (!user_a || !user_b) return -1;
-	return db_check_friendship(user_a, user_b);
+int check_friendship(uint32_t user_a_id, uint32_t user_b_id) {
+	if (!user_a_id || !user_b_id) return -1;
+	return db_check_friendship(user_a_id, user_b_id);
 }
 
-int tag_favorite(int fav_id, const char *tagger, const char *tagged_users) {
-	if (fav_id <= 0 || !tagger || !tagged_users) return -1;
-	return db_tag_friend_to_favorite(fav_id, tagger, tagged_users);
+int tag_favorite(int fav_id, uint32_t tagger_id, const char *tagged_name, uint32_t *out_tagged_id) {
+	if (fav_id <= 0 || !tagger_id || !tagged_name) return -1;
+	return db_tag_friend(fav_id, tagger_id, tagged_name, out_tagged_id);
 }
 
 
 // NOTIFICATION MANAGEMENT FUNCTIONS
-int get_user_notifications(const char *username, Notification notifs[], int max, int *out_count) {
-	if (!username || !out_count || max <= 0) return -1;
-	if (!notifs) {
-		*out_count = 0;
-		return 0;
-	}
-	return db_fetch_user_notifications(username, notifs, max, out_count);
+int scan_user_notifications(uint32_t user_id, const db_page_t *page, const db_sink_t *sink) {
+	if (!user_id || !sink) return -1;
+	return db_scan_user_notifications(user_id, page, sink);
 }
 
-int mark_notification_seen(int notif_id) {
-	// implement later
-	return 0;
+int mark_notification_seen(int notif_id, uint32_t user_id) {
+	if (notif_id <= 0 || !user_id) return -1;
+	return db_mark_notification_seen(notif_id, user_id);
 }
 
-int create_notification(const char *to, const char *from, int fav_id, const char *message) {
-	// implement later
-	return 0;
+/**
+ * @function create_notification: Notify a user of something another user did. The
+ * notification is stored and pushed by the notifier thread after this returns,
+ * merged with similar ones that arrive within the coalescing window.
+ *
+ * @param to_id: Recipient.
+ * @param from_id: Acting user.
+ * @param kind: What the acting user did.
+ * @param fav_id: Favorite it concerns, 0 for none.
+ *
+ * @return 0 if queued, -1 otherwise.
+ */
+int create_notification(uint32_t to_id, uint32_t from_id, notify_kind_t kind, int fav_id) {
+	if (!to_id || !from_id || to_id == from_id) return -1;
+	return notifier_post(to_id, from_id, kind, fav_id);
 }
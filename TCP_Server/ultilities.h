@@ -3,46 +3,57 @@
 
 #include <stddef.h>
 #include "../entity/entities.h"
+#include "binlog.h"
+#include "database.h"
+#include "notifier.h"
 #define MSSV "20225690"
+#define LOG_BASENAME "log_" MSSV
 #define MAX_USER 3000
 #define MAX_SESSION 3000
 #define MAX_FAVS 128
 #define MAX_FRIENDS 128
 #define MAX_REQUESTS 128
 #define MAX_NOTIFS 128
+// Rows per page of a LIST_* command given after=/limit=
+#define PAGE_DEFAULT_LIMIT 50
+#define PAGE_MAX_LIMIT 128
+// LIST_* replies reach the session in pieces of at most this many bytes
+#define LIST_CHUNK_SIZE 4096
 // DATA STORE MANAGEMENT FUNCTIONS
 int init_data_store(const char *db_path);
 void shutdown_data_store(void);
 // NETWORK COMMUNICATION FUNCTIONS
-int send_request(int sockfd, const char *buf);
 int recv_response(int sockfd, char *buff, size_t size);
+int send_reply(client_session_t *session, const char *buf);
+void writeLog(const client_session_t *session, const char *buff, binlog_dir_t dir);
 // ACCOUNT MANAGEMENT FUNCTIONS
 int get_accounts(Account accounts[], int max_users, int *out_count);
 int get_account(const char *username, Account *out_account);
 int create_account(const char *username, const char *password);
+int get_user_id(const char *username, uint32_t *out_id);
 
 // FAVORITE MANAGEMENT FUNCTIONS
-int get_user_favorites(const char *username, FavoritePlace favs[], int max, int *out_count);
-int create_favorite(const char *owner, const char *name, const char *category, const char *location);
-int update_favorite(int fav_id, const char *owner, const char *name, const char *category, const char *location);
-int delete_favorite(int fav_id, const char *owner);
-int get_favorite_by_id(int fav_id, char *username ,FavoritePlace *out_fav);
-int get_tagged_favorites(const char *username, FavoritePlaceWithTags favs[], int max, int *out_count);
+int scan_user_favorites(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int create_favorite(uint32_t owner_id, const char *name, const char *category, const char *location);
+int update_favorite(int fav_id, uint32_t owner_id, const char *name, const char *category, const char *location);
+int delete_favorite(int fav_id, uint32_t owner_id);
+int get_favorite_by_id(int fav_id, uint32_t owner_id, FavoritePlace *out_fav);
+int scan_tagged_favorites(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
 
 // FRIEND MANAGEMENT FUNCTIONS
-int get_user_friends(const char *username, FriendRel frs[], int max, int *out_count);
-int get_user_requests(const char *username, FriendRequest reqs[], int max, int *out_count);
-int create_friend_request(const char *from, const char *to);
-int get_friend_request_by_id(int request_id, char * username ,FriendRequest *out_request);
-int accept_friend_request(int request_id, const char *username);
-int reject_friend_request(int request_id, const char *username);
-int check_friendship(const char *user_a, const char *user_b);
-int remove_friendship(const char *user_a, const char *user_b);
-int tag_favorite(int fav_id, const char *tagger, const char *tagged_users);
+int scan_user_friends(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int scan_user_requests(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int send_friend_request(uint32_t from_id, const char *to_name, uint32_t *out_to_id);
+int get_friend_request_by_id(int request_id, uint32_t user_id, FriendRequest *out_request);
+int accept_friend_request(int request_id, uint32_t requestee_id);
+int reject_friend_request(int request_id, uint32_t requestee_id);
+int check_friendship(uint32_t user_a_id, uint32_t user_b_id);
+int remove_friendship(uint32_t user_a_id, uint32_t user_b_id);
+int tag_favorite(int fav_id, uint32_t tagger_id, const char *tagged_name, uint32_t *out_tagged_id);
 
 // NOTIFICATION MANAGEMENT FUNCTIONS
-int get_user_notifications(const char *username, Notification notifs[], int max, int *out_count);
-int mark_notification_as_seen(int notif_id);
-int create_notification(const char *to, const char *from, int fav_id, const char *message);
+int scan_user_notifications(uint32_t user_id, const db_page_t *page, const db_sink_t *sink);
+int mark_notification_seen(int notif_id, uint32_t user_id);
+int create_notification(uint32_t to_id, uint32_t from_id, notify_kind_t kind, int fav_id);
 
 #endif 
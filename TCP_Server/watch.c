@@ -0,0 +1,331 @@
+#define LOG_TAG "watch"
+
+#include "watch.h"
+#include "notifier.h"
+#include "database.h"
+#include "session.h"
+#include "worker_pool.h"
+#include "timer_wheel.h"
+#include "log.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @typedef watch_user_t: Versions and parked watchers of one user. Entries live for
+ * the whole run (one per user who was ever watched or notified).
+ * Fields:
+ *  - hnext: next user in the same hash bucket
+ *  - loaded: versions include what was already in the database at first use
+ *  - version: newest notification id per kind
+ *  - waiters: parked WATCH commands of this user
+ */
+typedef struct watch_user {
+    struct watch_user *hnext;
+    uint32_t user_id;
+    int loaded;
+    uint32_t version[NOTIFY_KINDS];
+    struct watch_waiter *waiters;
+} watch_user_t;
+
+/**
+ * @typedef watch_waiter_t: One parked WATCH.
+ * Fields:
+ *  - timer: timeout; first member, so a fired timer node is its waiter
+ *  - next/pprev: links in the user's waiter list
+ *  - user: whose versions are watched
+ *  - session: connection to answer (not a counted reference; watch_cancel() drops
+ *    the waiter before the session is freed)
+ *  - topics: bit per notify_kind_t
+ *  - since: version the client already has
+ *  - retained: a reference was taken on session when the waiter was detached
+ *  - line: command dispatched again to produce the answer
+ */
+typedef struct watch_waiter {
+    timer_node_t timer;
+    struct watch_waiter *next;
+    struct watch_waiter **pprev;
+    watch_user_t *user;
+    client_session_t *session;
+    unsigned int topics;
+    uint32_t since;
+    int retained;
+    char line[WATCH_LINE_LEN];
+} watch_waiter_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static watch_user_t *g_users[WATCH_USER_BUCKETS];
+static timer_wheel_t g_wheel;
+static unsigned int g_parked = 0;
+static unsigned long g_users_count;
+static unsigned long g_loads;
+static unsigned long g_parks;
+static unsigned long g_wakeups;
+static unsigned long g_timeouts;
+static unsigned long g_replaced;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t to_tick(long long ms) {
+    return (uint64_t)((ms + WATCH_TICK_MS - 1) / WATCH_TICK_MS);
+}
+
+// Find (or create) a user's entry; caller holds g_lock
+static watch_user_t *find_user(uint32_t user_id, int create) {
+    watch_user_t **bucket = &g_users[(user_id * 2654435761u) % WATCH_USER_BUCKETS];
+    for (watch_user_t *u = *bucket; u; u = u->hnext) {
+        if (u->user_id == user_id) return u;
+    }
+    if (!create) return NULL;
+    watch_user_t *u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->user_id = user_id;
+    u->hnext = *bucket;
+    *bucket = u;
+    g_users_count++;
+    return u;
+}
+
+static uint32_t version_of(const watch_user_t *u, unsigned int topics) {
+    uint32_t v = 0;
+    for (int k = 0; k < NOTIFY_KINDS; ++k) {
+        if ((topics & (1u << k)) && u->version[k] > v) v = u->version[k];
+    }
+    return v;
+}
+
+/*
+ * Return the user's entry with g_lock held, reading their versions from the database
+ * the first time. Bumps published while the query runs are kept: the entry takes the
+ * larger of both.
+ */
+static watch_user_t *lock_user(uint32_t user_id) {
+    pthread_mutex_lock(&g_lock);
+    watch_user_t *u = find_user(user_id, 1);
+    if (!u || u->loaded) {
+        if (!u) pthread_mutex_unlock(&g_lock);
+        return u;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    uint32_t stored[NOTIFY_KINDS];
+    int rc = db_notification_versions(user_id, stored, NOTIFY_KINDS);
+    __atomic_add_fetch(&g_loads, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&g_lock);
+    if (rc != 0) {
+        pthread_mutex_unlock(&g_lock);
+        return NULL;
+    }
+    if (!u->loaded) {
+        for (int k = 0; k < NOTIFY_KINDS; ++k) {
+            if (stored[k] > u->version[k]) u->version[k] = stored[k];
+        }
+        u->loaded = 1;
+    }
+    return u;
+}
+
+// Take a waiter out of every structure and pin its session for the answer; caller holds g_lock
+static void detach(watch_waiter_t *w) {
+    if ((*w->pprev = w->next) != NULL) w->next->pprev = w->pprev;
+    if (tw_armed(&w->timer)) tw_cancel(&g_wheel, &w->timer);
+    w->session->watch = NULL;
+    w->retained = session_try_retain(w->session);
+    g_parked--;
+}
+
+// Hand detached waiters' commands back to the worker pool and free them. Never run
+// them inline (no workers): this thread is not the session's own.
+static void redispatch(watch_waiter_t *list) {
+    while (list) {
+        watch_waiter_t *w = list;
+        list = w->next;
+        if (w->retained) {
+            if (worker_pool_enabled() && w->session->logged_in &&
+                w->session->user_id == w->user->user_id) {
+                worker_pool_dispatch(w->session, w->line, strlen(w->line));
+            }
+            session_release(w->session);
+        }
+        free(w);
+    }
+}
+
+static void on_timeout(timer_node_t *node, void *ctx) {
+    watch_waiter_t **expired = ctx;
+    watch_waiter_t *w = (watch_waiter_t *)node;
+    detach(w);
+    w->next = *expired;
+    *expired = w;
+    g_timeouts++;
+}
+
+static void *watch_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        usleep(WATCH_TICK_MS * 1000);
+        watch_waiter_t *expired = NULL;
+        pthread_mutex_lock(&g_lock);
+        tw_advance(&g_wheel, to_tick(now_ms()), on_timeout, &expired);
+        pthread_mutex_unlock(&g_lock);
+        redispatch(expired);
+    }
+    return NULL;
+}
+
+/**
+ * @function watch_start: Start the thread that times out parked watchers.
+ *
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+int watch_start(void) {
+    tw_init(&g_wheel, to_tick(now_ms()));
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watch_thread, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+/**
+ * @function watch_version: Current version of a user's topics.
+ *
+ * @param user_id: Watching user.
+ * @param topics: Bit per notify_kind_t.
+ * @param out_version: Newest notification id among those topics (0 if none).
+ *
+ * @return 0 on success, -1 on error.
+ */
+int watch_version(uint32_t user_id, unsigned int topics, uint32_t *out_version) {
+    watch_user_t *u = lock_user(user_id);
+    if (!u) return -1;
+    *out_version = version_of(u, topics);
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+/**
+ * @function watch_park: Park a WATCH until its topics move past since or the timeout
+ * fires; either way retry_line is dispatched for the session then. A WATCH already
+ * parked on the session is answered at once, the client having given up on it.
+ *
+ * @param session: Logged-in session issuing the WATCH.
+ * @param topics: Bit per notify_kind_t.
+ * @param since: Version the client already has.
+ * @param timeout_ms: Longest wait.
+ * @param retry_line: Command that answers the WATCH without parking again.
+ *
+ * @return 0 if parked, 1 if the topics already moved (answer now), -1 on error.
+ */
+int watch_park(client_session_t *session, unsigned int topics, uint32_t since, int timeout_ms,
+               const char *retry_line) {
+    watch_waiter_t *w = calloc(1, sizeof(*w));
+    if (!w) return -1;
+    w->session = session;
+    w->topics = topics;
+    w->since = since;
+    strncpy(w->line, retry_line, sizeof(w->line) - 1);
+
+    watch_user_t *u = lock_user(session->user_id);
+    if (!u) {
+        free(w);
+        return -1;
+    }
+    if (version_of(u, topics) > since) {
+        pthread_mutex_unlock(&g_lock);
+        free(w);
+        return 1;
+    }
+
+    watch_waiter_t *previous = session->watch;
+    if (previous) {
+        detach(previous);
+        previous->next = NULL;
+        g_replaced++;
+    }
+    w->user = u;
+    w->next = u->waiters;
+    if (w->next) w->next->pprev = &w->next;
+    w->pprev = &u->waiters;
+    u->waiters = w;
+    session->watch = w;
+    tw_schedule(&g_wheel, &w->timer, to_tick(now_ms() + timeout_ms));
+    g_parked++;
+    g_parks++;
+    pthread_mutex_unlock(&g_lock);
+
+    redispatch(previous);
+    return 0;
+}
+
+/**
+ * @function watch_publish: Record a new notification and wake the watchers it
+ * concerns. Called by the notifier once the notification is stored.
+ *
+ * @param user_id: Recipient.
+ * @param kind: notify_kind_t of the notification.
+ * @param version: Its id.
+ */
+void watch_publish(uint32_t user_id, int kind, uint32_t version) {
+    if (kind < 0 || kind >= NOTIFY_KINDS) return;
+    watch_waiter_t *woken = NULL;
+
+    pthread_mutex_lock(&g_lock);
+    watch_user_t *u = find_user(user_id, 1);
+    if (u) {
+        if (version > u->version[kind]) u->version[kind] = version;
+        watch_waiter_t *w = u->waiters;
+        while (w) {
+            watch_waiter_t *next = w->next;
+            if ((w->topics & (1u << kind)) && version > w->since) {
+                detach(w);
+                w->next = woken;
+                woken = w;
+                g_wakeups++;
+            }
+            w = next;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    redispatch(woken);
+}
+
+/**
+ * @function watch_cancel: Drop the session's parked WATCH without answering it (the
+ * session is being freed).
+ *
+ * @param session: Session being released.
+ */
+void watch_cancel(client_session_t *session) {
+    pthread_mutex_lock(&g_lock);
+    watch_waiter_t *w = session->watch;
+    if (w) {
+        if ((*w->pprev = w->next) != NULL) w->next->pprev = w->pprev;
+        if (tw_armed(&w->timer)) tw_cancel(&g_wheel, &w->timer);
+        session->watch = NULL;
+        g_parked--;
+    }
+    pthread_mutex_unlock(&g_lock);
+    free(w);
+}
+
+void watch_dump_metrics(FILE *out) {
+    pthread_mutex_lock(&g_lock);
+    unsigned int parked = g_parked;
+    unsigned long users = g_users_count;
+    unsigned long parks = g_parks;
+    unsigned long wakeups = g_wakeups;
+    unsigned long timeouts = g_timeouts;
+    unsigned long replaced = g_replaced;
+    pthread_mutex_unlock(&g_lock);
+    fprintf(out, "parked=%u users=%lu version_loads=%lu parks=%lu wakeups=%lu timeouts=%lu replaced=%lu\n",
+            parked, users, __atomic_load_n(&g_loads, __ATOMIC_RELAXED), parks, wakeups, timeouts, replaced);
+}
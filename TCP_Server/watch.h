@@ -0,0 +1,32 @@
+#ifndef TCP_SERVER_WATCH_H
+#define TCP_SERVER_WATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../entity/entities.h"
+
+/*
+ * Long-poll support for WATCH. Every user has one version per notification kind,
+ * the id of their newest notification of that kind, kept in memory and bumped by
+ * the notifier after each store. A WATCH with nothing newer than since_version parks
+ * the session here, holding no thread; the next matching notification or the
+ * timeout hands its command line back to the worker pool, which answers it with the
+ * delta.
+ */
+
+#define WATCH_TICK_MS 100
+#define WATCH_USER_BUCKETS 1024
+#define WATCH_LINE_LEN 64
+#define WATCH_DEFAULT_TIMEOUT_SEC 30
+#define WATCH_MAX_TIMEOUT_SEC 120
+
+// WATCH FUNCTIONS
+int watch_start(void);
+int watch_version(uint32_t user_id, unsigned int topics, uint32_t *out_version);
+int watch_park(client_session_t *session, unsigned int topics, uint32_t since, int timeout_ms,
+               const char *retry_line);
+void watch_publish(uint32_t user_id, int kind, uint32_t version);
+void watch_cancel(client_session_t *session);
+void watch_dump_metrics(FILE *out);
+
+#endif
@@ -0,0 +1,222 @@
+#include "worker_pool.h"
+#include "session.h"
+#include "ultilities.h"
+#include "command_handlers.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORKER_BATCH 16
+
+/**
+ * @typedef pool_job_t: One framed command line (or a canned reply) waiting for a worker.
+ * Fields:
+ *  - next: next job of the same session
+ *  - is_reply: 1 if line is a ready-made reply to send instead of a command
+ *  - line: NUL-terminated command text or reply
+ */
+typedef struct pool_job {
+    struct pool_job *next;
+    int is_reply;
+    char line[];
+} pool_job_t;
+
+typedef struct worker_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t has_room;
+    client_session_t *run_head;
+    client_session_t *run_tail;
+    int depth;
+    int max_queue;
+    pool_overflow_t overflow;
+    int nworkers;
+} worker_pool_t;
+
+static worker_pool_t g_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .has_work = PTHREAD_COND_INITIALIZER,
+    .has_room = PTHREAD_COND_INITIALIZER,
+};
+
+// Caller holds g_pool.lock.
+static void run_queue_push(client_session_t *session) {
+    session->run_next = NULL;
+    if (g_pool.run_tail) g_pool.run_tail->run_next = session;
+    else g_pool.run_head = session;
+    g_pool.run_tail = session;
+    pthread_cond_signal(&g_pool.has_work);
+}
+
+/**
+ * @function enqueue_job: Append a job to the session FIFO and schedule the session if
+ * no worker owns it yet. Takes a session reference on behalf of the run queue.
+ */
+static void enqueue_job(client_session_t *session, pool_job_t *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&session->lock);
+    if (session->job_tail) session->job_tail->next = job;
+    else session->job_head = job;
+    session->job_tail = job;
+    int need_schedule = !session->scheduled;
+    session->scheduled = 1;
+    pthread_mutex_unlock(&session->lock);
+
+    if (need_schedule) {
+        session_retain(session);
+        pthread_mutex_lock(&g_pool.lock);
+        run_queue_push(session);
+        pthread_mutex_unlock(&g_pool.lock);
+    }
+}
+
+static pool_job_t *make_job(const char *text, size_t len, int is_reply) {
+    pool_job_t *job = malloc(sizeof(pool_job_t) + len + 1);
+    if (!job) return NULL;
+    job->is_reply = is_reply;
+    memcpy(job->line, text, len);
+    job->line[len] = '\0';
+    return job;
+}
+
+/**
+ * @function worker_thread: Serve sessions from the run queue. A session is owned by at
+ * most one worker, so its commands run in order and handlers can touch session state
+ * without extra locking. Up to WORKER_BATCH queued commands of a session are handled
+ * in one go and their replies flushed together.
+ */
+static void *worker_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&g_pool.lock);
+        while (!g_pool.run_head) pthread_cond_wait(&g_pool.has_work, &g_pool.lock);
+        client_session_t *session = g_pool.run_head;
+        g_pool.run_head = session->run_next;
+        if (!g_pool.run_head) g_pool.run_tail = NULL;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        session_begin_batch(session);
+        for (int n = 0; n < WORKER_BATCH; ++n) {
+            pthread_mutex_lock(&session->lock);
+            pool_job_t *job = session->job_head;
+            if (job) {
+                session->job_head = job->next;
+                if (!session->job_head) session->job_tail = NULL;
+            }
+            int closed = session->closed;
+            pthread_mutex_unlock(&session->lock);
+            if (!job) break;
+
+            if (!closed) {
+                if (job->is_reply) send_reply(session, job->line);
+                else dispatch_command(session, job->line);
+            }
+            if (!job->is_reply) {
+                pthread_mutex_lock(&g_pool.lock);
+                g_pool.depth--;
+                pthread_cond_signal(&g_pool.has_room);
+                pthread_mutex_unlock(&g_pool.lock);
+            }
+            free(job);
+        }
+        session_end_batch(session);
+
+        pthread_mutex_lock(&session->lock);
+        int more = session->job_head != NULL;
+        if (!more) session->scheduled = 0;
+        pthread_mutex_unlock(&session->lock);
+
+        if (more) {
+            // Requeue at the tail so one chatty client cannot starve the others.
+            pthread_mutex_lock(&g_pool.lock);
+            run_queue_push(session);
+            pthread_mutex_unlock(&g_pool.lock);
+        } else {
+            session_release(session);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @function worker_pool_start: Start the worker threads.
+ *
+ * @param nworkers: Number of worker threads; 0 keeps dispatch inline on the I/O thread.
+ * @param max_queue: Maximum number of queued command lines across all sessions.
+ * @param overflow: Policy applied when max_queue is reached.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int worker_pool_start(int nworkers, int max_queue, pool_overflow_t overflow) {
+    g_pool.max_queue = max_queue > 0 ? max_queue : 1;
+    g_pool.overflow = overflow;
+    for (int i = 0; i < nworkers; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_thread, NULL) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        pthread_detach(tid);
+        g_pool.nworkers++;
+    }
+    return 0;
+}
+
+int worker_pool_enabled(void) {
+    return g_pool.nworkers > 0;
+}
+
+/**
+ * @function worker_pool_dispatch: Hand a framed command line to the workers, or run it
+ * inline when the pool is disabled.
+ *
+ * @param session: Session the line was read from.
+ * @param line: Command text (need not be NUL-terminated).
+ * @param len: Length of line in bytes.
+ */
+void worker_pool_dispatch(client_session_t *session, const char *line, size_t len) {
+    if (!worker_pool_enabled()) {
+        dispatch_command(session, line);
+        return;
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.overflow == POOL_OVERFLOW_BLOCK) {
+        while (g_pool.depth >= g_pool.max_queue) pthread_cond_wait(&g_pool.has_room, &g_pool.lock);
+    } else if (g_pool.depth >= g_pool.max_queue) {
+        pthread_mutex_unlock(&g_pool.lock);
+        // Still goes through the session FIFO so the 503 keeps its place among replies.
+        worker_pool_reply(session, "503 Server busy\r\n");
+        return;
+    }
+    g_pool.depth++;
+    pthread_mutex_unlock(&g_pool.lock);
+
+    pool_job_t *job = make_job(line, len, 0);
+    if (!job) {
+        pthread_mutex_lock(&g_pool.lock);
+        g_pool.depth--;
+        pthread_mutex_unlock(&g_pool.lock);
+        worker_pool_reply(session, "500 Internal server error\r\n");
+        return;
+    }
+    enqueue_job(session, job);
+}
+
+/**
+ * @function worker_pool_reply: Send a reply from the I/O side without reordering it
+ * ahead of replies still owed for earlier commands.
+ *
+ * @param session: Target session.
+ * @param reply: Complete reply line including "\r\n".
+ */
+void worker_pool_reply(client_session_t *session, const char *reply) {
+    pool_job_t *job = worker_pool_enabled() ? make_job(reply, strlen(reply), 1) : NULL;
+    if (!job) {
+        send_reply(session, reply);
+        return;
+    }
+    enqueue_job(session, job);
+}
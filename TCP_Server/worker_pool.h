@@ -0,0 +1,23 @@
+#ifndef TCP_SERVER_WORKER_POOL_H
+#define TCP_SERVER_WORKER_POOL_H
+
+#include <stddef.h>
+#include "../entity/entities.h"
+
+/**
+ * @typedef pool_overflow_t: What the I/O side does when the request queue is full.
+ *  - POOL_OVERFLOW_REJECT: answer the command with "503 Server busy" right away
+ *  - POOL_OVERFLOW_BLOCK: stall the submitting I/O thread until a worker frees a slot
+ */
+typedef enum pool_overflow {
+    POOL_OVERFLOW_REJECT = 0,
+    POOL_OVERFLOW_BLOCK
+} pool_overflow_t;
+
+// WORKER POOL FUNCTIONS
+int worker_pool_start(int nworkers, int max_queue, pool_overflow_t overflow);
+int worker_pool_enabled(void);
+void worker_pool_dispatch(client_session_t *session, const char *line, size_t len);
+void worker_pool_reply(client_session_t *session, const char *reply);
+
+#endif
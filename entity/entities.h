@@ -1,9 +1,11 @@
 #ifndef ENTITY_ENTITIES_H
 #define ENTITY_ENTITIES_H
 
+#include <stdint.h>
 #include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <pthread.h>
 
 #define MAX_NAME_LEN 64
 #define MAX_PASS_LEN 128
@@ -12,30 +14,41 @@
 #define MAX_DESC_LEN 256
 #define MAX_TAGGED_LEN 256
 #define MAX_MSG_LEN 256
+#define MAX_PEER_LEN 32
 
+/*
+ * Users are referenced by accounts.id everywhere below the protocol. Row structs carry
+ * the ids plus name pointers for printing: on the server they point into the user
+ * directory (never freed), in the client into the line being parsed.
+ */
 typedef struct account_t {
+    uint32_t id;
     char username[MAX_NAME_LEN];
     char password[MAX_PASS_LEN]; 
-    int is_logged_in; 
 } Account;
 
 typedef struct friend_request_t {
     int id;
-    char from[MAX_NAME_LEN];
-    char to[MAX_NAME_LEN];
+    uint32_t from_id;
+    uint32_t to_id;
+    const char *from;
+    const char *to;
     int status; // 0: pending, 1: accepted 
     time_t created_at;
 } FriendRequest;
 
 typedef struct friend_rel_t {
-    char user_a[MAX_NAME_LEN];
-    char user_b[MAX_NAME_LEN];
+    uint32_t user_a_id;
+    uint32_t user_b_id;
+    const char *user_a;
+    const char *user_b;
     time_t since;
 } FriendRel;
 
 typedef struct favorite_place_t {
     int id;
-    char owner[MAX_NAME_LEN];
+    uint32_t owner_id;
+    const char *owner;
     char name[MAX_TITLE_LEN];
     char category[MAX_CAT_LEN];
     char location[MAX_DESC_LEN];
@@ -44,25 +57,32 @@ typedef struct favorite_place_t {
 
 typedef struct favorite_place_with_tags_t {
     int id;
-    char owner[MAX_NAME_LEN];
+    uint32_t owner_id;
+    const char *owner;
     char name[MAX_TITLE_LEN];
     char category[MAX_CAT_LEN];
     char location[MAX_DESC_LEN];
     time_t created_at;
-    char tagger[MAX_NAME_LEN];
+    uint32_t tagger_id;
+    const char *tagger;
 } FavoritePlaceWithTags;
 
 typedef struct favorite_tags_t {
     int fav_id;
-    char tagger[MAX_NAME_LEN];
-    char tagged_users[MAX_TAGGED_LEN];
+    uint32_t tagger_id;
+    uint32_t tagged_id;
+    const char *tagger;
+    const char *tagged_users;
 } FavoriteTags;
 
 typedef struct notification_t {
     int id;
-    char to[MAX_NAME_LEN];
-    char from[MAX_NAME_LEN];
+    uint32_t to_id;
+    uint32_t from_id;
+    const char *to;
+    const char *from;
     int fav_id;
+    int kind; // notify_kind_t on the server, -1 for rows stored before kinds were
     char message[MAX_MSG_LEN];
     int seen; 
     time_t created_at;
@@ -71,16 +91,68 @@ typedef struct notification_t {
 /**
  * @typedef client_session_t: Represents a client session stored on server side.
  * Fields:
+ *  - id: process-unique session number (ties binary log records together)
  *  - sockfd: socket descriptor for the client connection
  *  - client_addr: client's network address (sockaddr_in)
+ *  - peer: client_addr formatted as "ip:port" for the activity log
  *  - username: logged-in account name (empty if not logged in)
+ *  - user_id: accounts.id of the logged-in user (0 if not logged in)
  *  - logged_in: 1 if user is logged in, 0 otherwise
+ *  - cur_opcode: command being executed, attached to its replies in the log
+ *  - framer: ring buffer holding received bytes until a full line is available
+ *  - refcount: owners of the session (I/O side plus queued worker jobs)
+ *  - closed: set once the connection is being torn down
+ *  - lock: protects the pending job list, scheduled and closed (socket writes go
+ *    through out under send_lock)
+ *  - job_head/job_tail: command lines waiting for a worker, in arrival order
+ *  - scheduled: 1 while the session sits in (or is served from) the worker run queue
+ *  - run_next: link in the worker run queue
+ *  - out: reply bytes not yet written to the socket
+ *  - send_lock: protects out, batch_depth and nowait_depth
+ *  - batch_depth: >0 while a batch of commands is being dispatched (replies are held)
+ *  - nowait_depth: >0 while writes must not block (a database connection is held)
+ *  - push_lock: protects push_buf/push_len/push_cap; never held across a write
+ *  - push_buf/push_len/push_cap: unsolicited lines (NOTIFY) waiting to join out
+ *  - push_pending: push_buf holds lines; checked whenever send_lock is released
+ *  - mem_bytes: fixed per-session footprint reported to admission control
+ *  - reaper: reaper watching the session's deadlines (NULL if not watched)
+ *  - timers: idle/login/write-stall timers, owned by the reaper
+ *  - last_activity_ms: monotonic time of the last bytes received
+ *  - write_stall_ms: monotonic time replies started waiting on a full socket (0 if none)
+ *  - watch: parked WATCH command waiting for a change (NULL if none)
  */
 typedef struct client_session {
+    unsigned int id;
     int sockfd;
     struct sockaddr_in client_addr;
+    char peer[MAX_PEER_LEN];
     char username[MAX_NAME_LEN];
+    uint32_t user_id;
     int logged_in; 
+    int cur_opcode;
+    struct line_framer *framer;
+    int refcount;
+    int closed;
+    pthread_mutex_t lock;
+    struct pool_job *job_head;
+    struct pool_job *job_tail;
+    int scheduled;
+    struct client_session *run_next;
+    struct out_buffer *out;
+    pthread_mutex_t send_lock;
+    int batch_depth;
+    int nowait_depth;
+    pthread_mutex_t push_lock;
+    char *push_buf;
+    size_t push_len;
+    size_t push_cap;
+    int push_pending;
+    size_t mem_bytes;
+    struct reaper *reaper;
+    struct session_timers *timers;
+    long long last_activity_ms;
+    long long write_stall_ms;
+    struct watch_waiter *watch;
 } client_session_t;
 
 #endif 
@@ -0,0 +1,235 @@
+/*
+ * mmt-logcat: print binary activity log segments in the text log format,
+ *   [dd/mm/yyyy hh:mm:ss]$ip:port$TYPE$payload
+ * optionally filtered by time range, user and command.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "TCP_Server/binlog.h"
+#include "TCP_Server/ultilities.h"
+
+/**
+ * @typedef session_info_t: What the meta records told us about a session id.
+ */
+typedef struct session_info {
+    char peer[32];
+    char user[64];
+} session_info_t;
+
+/**
+ * @typedef filter_t: Selection from the command line (unset fields match everything).
+ */
+typedef struct filter {
+    int64_t from_ns;
+    int64_t to_ns;
+    const char *user;
+    int opcode;
+} filter_t;
+
+static session_info_t *g_sessions = NULL;
+static size_t g_session_cap = 0;
+static uint64_t g_run_id = 0;
+static int g_have_run = 0;
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] [segment.bin ...]\n", prog);
+    printf("Without segment arguments, reads %s.*.bin in the current directory.\n", LOG_BASENAME);
+    printf("Options:\n");
+    printf("  -f, --from=TIME    skip records before TIME (\"YYYY-MM-DD HH:MM:SS\" or @epoch)\n");
+    printf("  -t, --to=TIME      skip records after TIME\n");
+    printf("  -u, --user=NAME    only traffic of sessions logged in as NAME\n");
+    printf("  -c, --cmd=NAME     only records of command NAME (e.g. LIST_FRIENDS)\n");
+}
+
+static int parse_time(const char *s, int64_t *out_ns) {
+    if (s[0] == '@') {
+        char *end;
+        long long sec = strtoll(s + 1, &end, 10);
+        if (*end) return -1;
+        *out_ns = (int64_t)sec * 1000000000ll;
+        return 0;
+    }
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    const char *end = strptime(s, "%Y-%m-%d %H:%M:%S", &t);
+    if (!end || *end) return -1;
+    t.tm_isdst = -1;
+    *out_ns = (int64_t)mktime(&t) * 1000000000ll;
+    return 0;
+}
+
+static session_info_t *session_info(uint32_t id) {
+    if (id >= g_session_cap) {
+        size_t cap = g_session_cap ? g_session_cap : 1024;
+        while (cap <= id) cap *= 2;
+        session_info_t *grown = realloc(g_sessions, cap * sizeof(session_info_t));
+        if (!grown) return NULL;
+        memset(grown + g_session_cap, 0, (cap - g_session_cap) * sizeof(session_info_t));
+        g_sessions = grown;
+        g_session_cap = cap;
+    }
+    return &g_sessions[id];
+}
+
+static void copy_field(char *dst, size_t size, const char *src, size_t len) {
+    if (len >= size) len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static void print_record(const binlog_record_t *rec, const session_info_t *info, int64_t wall_ns) {
+    time_t wall = (time_t)(wall_ns / 1000000000ll);
+    struct tm t;
+    localtime_r(&wall, &t);
+    printf("[%02d/%02d/%04d %02d:%02d:%02d]$%s$%s$", t.tm_mday, t.tm_mon + 1, t.tm_year + 1900,
+           t.tm_hour, t.tm_min, t.tm_sec, info && info->peer[0] ? info->peer : "UNKNOWN",
+           rec->dir == BINLOG_OUT ? "REQUEST" : "RESPONSE");
+    fwrite(rec + 1, 1, rec->payload_len, stdout);
+    putchar('\n');
+}
+
+/**
+ * @function scan_segment: Map one segment and print the records that pass the filter.
+ *
+ * @return 0 on success, -1 if the file is not a readable segment.
+ */
+static int scan_segment(const char *path, const filter_t *f) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(binlog_segment_header_t)) {
+        fprintf(stderr, "%s: not a log segment\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise((void *)map, size, MADV_SEQUENTIAL);
+
+    const binlog_segment_header_t *hdr = (const binlog_segment_header_t *)map;
+    if (hdr->magic != BINLOG_MAGIC || hdr->version != BINLOG_VERSION) {
+        fprintf(stderr, "%s: not a log segment\n", path);
+        munmap((void *)map, size);
+        return -1;
+    }
+    // Session ids restart with every server run.
+    if (!g_have_run || hdr->run_id != g_run_id) {
+        if (g_sessions) memset(g_sessions, 0, g_session_cap * sizeof(session_info_t));
+        g_run_id = hdr->run_id;
+        g_have_run = 1;
+    }
+
+    size_t pos = hdr->header_size;
+    while (pos + sizeof(binlog_record_t) <= size) {
+        const binlog_record_t *rec = (const binlog_record_t *)(map + pos);
+        if (rec->size == 0 || pos + rec->size > size) break;
+        pos += rec->size;
+
+        session_info_t *info = session_info(rec->session_id);
+        const char *payload = (const char *)(rec + 1);
+        if (rec->kind == BINLOG_OPEN) {
+            if (info) {
+                copy_field(info->peer, sizeof(info->peer), payload, rec->payload_len);
+                info->user[0] = '\0';
+            }
+            continue;
+        }
+        if (rec->kind == BINLOG_LOGIN) {
+            if (info) copy_field(info->user, sizeof(info->user), payload, rec->payload_len);
+            continue;
+        }
+
+        int64_t wall_ns = (int64_t)rec->mono_ns + hdr->wall_offset_ns;
+        int match = 1;
+        if (f->from_ns && wall_ns < f->from_ns) match = 0;
+        if (f->to_ns && wall_ns > f->to_ns) match = 0;
+        if (f->opcode >= 0 && rec->opcode != f->opcode) match = 0;
+        if (f->user && (!info || strcmp(info->user, f->user) != 0)) match = 0;
+        if (match) print_record(rec, info, wall_ns);
+
+        // A successful LOGOUT ends the user's traffic on this session.
+        if (info && rec->dir == BINLOG_OUT && rec->opcode == binlog_opcode_by_name("LOGOUT") &&
+            rec->status == 200) {
+            info->user[0] = '\0';
+        }
+    }
+    munmap((void *)map, size);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_opts[] = {
+        {"from", required_argument, NULL, 'f'},
+        {"to", required_argument, NULL, 't'},
+        {"user", required_argument, NULL, 'u'},
+        {"cmd", required_argument, NULL, 'c'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    filter_t f = {0, 0, NULL, -1};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:u:c:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+        case 't':
+            if (parse_time(optarg, opt == 'f' ? &f.from_ns : &f.to_ns) != 0) {
+                fprintf(stderr, "Bad time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'u':
+            f.user = optarg;
+            break;
+        case 'c':
+            f.opcode = binlog_opcode_by_name(optarg);
+            if (f.opcode < 0) {
+                fprintf(stderr, "Unknown command: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    int rc = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i) {
+            if (scan_segment(argv[i], &f) != 0) rc = 1;
+        }
+    } else {
+        // Segment names are zero-padded, so glob order is write order.
+        glob_t g;
+        if (glob(LOG_BASENAME ".*.bin", 0, NULL, &g) != 0) {
+            fprintf(stderr, "No %s.*.bin segments found\n", LOG_BASENAME);
+            return 1;
+        }
+        for (size_t i = 0; i < g.gl_pathc; ++i) {
+            if (scan_segment(g.gl_pathv[i], &f) != 0) rc = 1;
+        }
+        globfree(&g);
+    }
+    free(g_sessions);
+    return rc;
+}